@@ -16,14 +16,8 @@ int *BANK_accounts;	//Array for storing account values
  */
 int initialize_accounts( int n )
 {
-	BANK_accounts = (int *) malloc(sizeof(int) * n);
+	BANK_accounts = (int *) calloc(n, sizeof(int));
 	if(BANK_accounts == NULL) return 0;
-
-	int i;
-	for( i = 0; i < n; i++)
-	{
-		BANK_accounts[i] = 0;
-	}
 	return 1;
 }
 
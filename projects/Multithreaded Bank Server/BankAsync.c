@@ -0,0 +1,129 @@
+#define _GNU_SOURCE	// syscall
+#include "BankAsync.h"
+#include "Bank.h"
+#include "futex.h"
+#include <stdlib.h>
+#include <pthread.h>
+
+#define IO_THREAD_STACK (64 * 1024)	/* a Bank.c call needs next to no stack */
+
+static pthread_t *io_threads;
+static int num_io_threads;
+
+/* FIFO of calls not yet taken by an I/O thread, guarded by io_mutex */
+static pthread_mutex_t io_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t io_cond = PTHREAD_COND_INITIALIZER;
+static struct bank_io *io_head, *io_tail;
+static int io_stop;
+static int in_flight;		/* queued or running */
+static struct bank_async_stats stats;
+
+static void *io_thread_routine(void *arg)
+{
+	(void)arg;
+	pthread_mutex_lock(&io_mutex);
+	while (1) {
+		while (io_head == NULL && !io_stop)
+			pthread_cond_wait(&io_cond, &io_mutex);
+		if (io_head == NULL) break;
+
+		struct bank_io *io = io_head;
+		io_head = io->next;
+		if (io_head == NULL) io_tail = NULL;
+		pthread_mutex_unlock(&io_mutex);
+
+		if (io->write)
+			write_account(io->id, io->value);
+		else
+			io->value = read_account(io->id);
+
+		/* the group may be gone as soon as pending reaches 0 */
+		struct bank_io_group *group = io->group;
+		uint32_t *wake = group->wake;
+		if (__atomic_sub_fetch(&group->pending, 1, __ATOMIC_ACQ_REL) == 0) {
+			if (wake != NULL) {
+				__atomic_add_fetch(wake, 1, __ATOMIC_SEQ_CST);
+				futex_wake(wake, 1);
+			} else {
+				futex_wake(&group->pending, 1);
+			}
+		}
+
+		pthread_mutex_lock(&io_mutex);
+		in_flight--;
+	}
+	pthread_mutex_unlock(&io_mutex);
+	return NULL;
+}
+
+int bank_async_start(int threads)
+{
+	io_threads = (pthread_t *)malloc(threads * sizeof(pthread_t));
+	if (io_threads == NULL) return 0;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, IO_THREAD_STACK);
+	for (num_io_threads = 0; num_io_threads < threads; num_io_threads++) {
+		if (pthread_create(&io_threads[num_io_threads], &attr, io_thread_routine, NULL) != 0) {
+			pthread_attr_destroy(&attr);
+			bank_async_stop();
+			return 0;
+		}
+	}
+	pthread_attr_destroy(&attr);
+	return 1;
+}
+
+void bank_async_submit(struct bank_io_group *group, struct bank_io *ios, int n)
+{
+	group->pending = n;
+	if (n == 0) return;
+	for (int i = 0; i < n; i++) {
+		ios[i].group = group;
+		ios[i].next = i + 1 < n ? &ios[i + 1] : NULL;
+	}
+
+	pthread_mutex_lock(&io_mutex);
+	if (io_tail == NULL)
+		io_head = &ios[0];
+	else
+		io_tail->next = &ios[0];
+	io_tail = &ios[n - 1];
+	in_flight += n;
+	if (in_flight > stats.max_in_flight) stats.max_in_flight = in_flight;
+	stats.calls += n;
+	stats.groups++;
+	if (n == 1)
+		pthread_cond_signal(&io_cond);
+	else
+		pthread_cond_broadcast(&io_cond);
+	pthread_mutex_unlock(&io_mutex);
+}
+
+void bank_async_wait(struct bank_io_group *group)
+{
+	uint32_t pending;
+	while ((pending = __atomic_load_n(&group->pending, __ATOMIC_ACQUIRE)) != 0)
+		futex_wait(&group->pending, pending);
+}
+
+void bank_async_stop()
+{
+	pthread_mutex_lock(&io_mutex);
+	io_stop = 1;
+	pthread_cond_broadcast(&io_cond);
+	pthread_mutex_unlock(&io_mutex);
+	for (int i = 0; i < num_io_threads; i++)
+		pthread_join(io_threads[i], NULL);
+	free(io_threads);
+	io_threads = NULL;
+	num_io_threads = 0;
+}
+
+void bank_async_get_stats(struct bank_async_stats *out)
+{
+	pthread_mutex_lock(&io_mutex);
+	*out = stats;
+	pthread_mutex_unlock(&io_mutex);
+}
@@ -0,0 +1,66 @@
+#ifndef BANKASYNC_H
+#define BANKASYNC_H
+
+/*
+ *  Asynchronous Bank.c calls. A pool of I/O threads runs read_account() and
+ *  write_account() for its callers, so one caller can have many of the 10 ms
+ *  calls in flight at once. A caller fills an array of struct bank_io,
+ *  submits it as one group and waits for the whole group.
+ *
+ *  The calls of a group run at the same time and in no particular order:
+ *  the caller must own every account involved, and must not write an
+ *  account that another call of the same group reads or writes.
+ */
+
+#include <stdint.h>
+
+struct bank_io {
+	int id;
+	int value;		/* write: balance to store; read: balance read */
+	int write;		/* 1 for write_account(), 0 for read_account() */
+	struct bank_io *next;		/* internal */
+	struct bank_io_group *group;	/* internal */
+};
+
+struct bank_io_group {
+	uint32_t pending;	/* calls not finished yet */
+	uint32_t *wake;		/* if not NULL, bumped and woken instead of pending
+				   when the group finishes, so one thread can
+				   sleep on many groups */
+};
+
+/*
+ *  Start the I/O threads.
+ *  Input:  int threads - calls that may be in flight at once
+ *  Return:  1 if succeeded, 0 if error
+ */
+int bank_async_start(int threads);
+
+/*
+ *  Queue ios[0..n) as one group; set group->wake first. The array and group
+ *  must stay valid until pending is back to 0.
+ */
+void bank_async_submit(struct bank_io_group *group, struct bank_io *ios, int n);
+
+/*
+ *  Wait until every call of group has finished (group->wake must be NULL).
+ */
+void bank_async_wait(struct bank_io_group *group);
+
+/*
+ *  Finish the queued calls and stop the I/O threads.
+ */
+void bank_async_stop();
+
+/*
+ *  Counters since bank_async_start(): calls, groups, and the most calls
+ *  that were queued or running at once.
+ */
+struct bank_async_stats {
+	long calls;
+	long groups;
+	int max_in_flight;
+};
+void bank_async_get_stats(struct bank_async_stats *stats);
+
+#endif
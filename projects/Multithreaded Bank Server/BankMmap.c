@@ -0,0 +1,94 @@
+#define _GNU_SOURCE
+#include "BankMmap.h"
+#include "Bank.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+
+#define STORE_MAGIC "BANKMMAP"
+#define STORE_VERSION 1
+#define STORE_HEADER_SIZE 4096	/* keeps the accounts page aligned */
+
+extern int *BANK_accounts;	/* Bank.c */
+
+struct store_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t clean;		/* 1 once closed by mmap_accounts_close() */
+	int64_t accounts;
+};
+
+static struct store_header *store;	/* start of the mapping */
+static size_t store_size;
+
+int mmap_accounts_open(const char *path, int n)
+{
+	struct store_header header;
+	int64_t kept = 0;
+
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		perror("Error opening the account store");
+		return -1;
+	}
+	ssize_t got = pread(fd, &header, sizeof(header), 0);
+	if (got > 0) {
+		if (got != sizeof(header) || memcmp(header.magic, STORE_MAGIC, 8) != 0 ||
+		    header.version != STORE_VERSION || header.accounts < 0) {
+			fprintf(stderr, "Error: %s is not an account store.\n", path);
+			close(fd);
+			return -1;
+		}
+		kept = header.accounts < n ? header.accounts : n;
+		if (!header.clean)
+			fprintf(stderr, "Store: %s was not closed cleanly; balances are as of the crash\n", path);
+	} else {
+		memset(&header, 0, sizeof(header));
+		memcpy(header.magic, STORE_MAGIC, 8);
+		header.version = STORE_VERSION;
+	}
+	if (header.accounts < n) header.accounts = n;
+
+	/* ftruncate() zero-fills new accounts without touching their pages */
+	store_size = STORE_HEADER_SIZE + (size_t)header.accounts * sizeof(int);
+	if (ftruncate(fd, store_size) != 0) {
+		perror("Error sizing the account store");
+		close(fd);
+		return -1;
+	}
+	store = mmap(NULL, store_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (store == MAP_FAILED) {
+		perror("Error mapping the account store");
+		store = NULL;
+		return -1;
+	}
+
+	header.clean = 0;
+	memcpy(store, &header, sizeof(header));
+	free(BANK_accounts);
+	BANK_accounts = (int *)((char *)store + STORE_HEADER_SIZE);
+	return (int)kept;
+}
+
+int mmap_accounts_sync(int wait)
+{
+	if (store == NULL) return 0;
+	return msync(store, store_size, wait ? MS_SYNC : MS_ASYNC) == 0;
+}
+
+void mmap_accounts_close()
+{
+	if (store == NULL) return;
+	if (!mmap_accounts_sync(1))
+		perror("Error syncing the account store");
+	store->clean = 1;
+	msync(store, STORE_HEADER_SIZE, MS_SYNC);
+	munmap(store, store_size);
+	store = NULL;
+	BANK_accounts = NULL;
+}
@@ -0,0 +1,40 @@
+#ifndef BANKMMAP_H
+#define BANKMMAP_H
+
+/*
+ *  Memory-mapped account store for Bank.c. The Bank.h API is unchanged:
+ *  after initialize_accounts(), mmap_accounts_open() moves the account array
+ *  onto a shared mapping of a file, so read_account() and write_account()
+ *  go straight to the page cache. Balances survive a restart (even a kill -9)
+ *  without being reloaded, and the kernel pages very large stores in and out.
+ *
+ *  File layout: one 4 KiB header page, then one int per account, ID 1 first.
+ */
+
+/*
+ *  Map the store at path in place of the array from initialize_accounts().
+ *  A new store starts with every account at 0. A store holding fewer than n
+ *  accounts is extended with zeroed accounts; one holding more keeps them.
+ *  Input:  const char *path - store file, created if missing
+ *  Input:  int n - number of accounts given to initialize_accounts()
+ *  Return:  number of accounts kept from an earlier run (0 for a new store),
+ *           or -1 with an error printed
+ */
+int mmap_accounts_open(const char *path, int n);
+
+/*
+ *  Write every changed page of the store back to its file (msync). Called
+ *  on close, and by SNAPSHOT before it replies, so every write made before
+ *  the snapshot is on disk in the store as well.
+ *  Input:  int wait - 1 to return once the data is on disk, 0 to only start
+ *  Return:  1 if succeeded, 0 if error
+ */
+int mmap_accounts_sync(int wait);
+
+/*
+ *  Sync and unmap the store and mark it cleanly closed. BANK_accounts is left
+ *  NULL, so free_accounts() may still be called afterwards.
+ */
+void mmap_accounts_close();
+
+#endif
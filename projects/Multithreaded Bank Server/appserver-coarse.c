@@ -6,14 +6,16 @@
 #include <sys/time.h>
 #include <errno.h>      
 #include "Bank.h" 
+#include "BankMmap.h"
+#include "lockprof.h"
 
 // --- Fix for implicit declaration warnings (strdup) ---
 // Explicitly declare strdup prototype as it's often missing in standard C libraries
 char *strdup(const char *s); 
 
 // --- Configuration and Constants ---
-#define MAX_ACCOUNTS 10000 
 #define MAX_TOKENS 50    
+#define LOCKPROF_TOP 10
 
 // --- Global Synchronization and Data Structures ---
 // ADDED: Single mutex to protect the entire bank database
@@ -23,6 +25,10 @@ pthread_cond_t queue_cond;
 pthread_mutex_t output_mutex;                 
 FILE *output_file;                           
 
+// --lockprof: counters for the three locks above (lockprof.h)
+struct lock_profile bank_lock_profile, queue_mutex_profile, output_mutex_profile;
+int lockprof_enabled = 0;
+
 int NUM_ACCOUNTS;
 int NUM_WORKERS;
 
@@ -49,6 +55,29 @@ void enqueue_request(struct request *req);
 struct request *dequeue_request();
 
 
+// --- Lock Profiling (--lockprof) ---
+// Every lock goes through here; without --lockprof it is pthread_mutex_lock()
+void profiled_lock(pthread_mutex_t *mutex, struct lock_profile *prof) {
+    if (lockprof_enabled) {
+        lockprof_lock(mutex, prof);
+    } else {
+        pthread_mutex_lock(mutex);
+    }
+}
+
+void report_lock_profile(const char *csv_path) {
+    struct lockprof_group groups[] = {
+        {"bank_lock", &bank_lock_profile, 1, -1},
+        {"queue_mutex", &queue_mutex_profile, 1, -1},
+        {"output_mutex", &output_mutex_profile, 1, -1},
+    };
+    lockprof_report(stderr, groups, 3, LOCKPROF_TOP);
+    if (!lockprof_write_csv(csv_path, groups, 3)) {
+        perror("Error writing lock profile");
+    }
+}
+
+
 // --- Comparator for Deadlock Prevention (qsort) ---
 int integer_comparator(const void *a, const void *b) {
     return (*(int*)a - *(int*)b);
@@ -58,7 +87,7 @@ int integer_comparator(const void *a, const void *b) {
 // --- Queue Management (Unchanged) ---
 
 void enqueue_request(struct request *req) {
-    pthread_mutex_lock(&queue_mutex);
+    profiled_lock(&queue_mutex, &queue_mutex_profile);
     
     if (request_queue.tail == NULL) {
         request_queue.head = request_queue.tail = req;
@@ -76,7 +105,7 @@ void enqueue_request(struct request *req) {
 struct request *dequeue_request() {
     struct request *req = NULL;
     
-    pthread_mutex_lock(&queue_mutex);
+    profiled_lock(&queue_mutex, &queue_mutex_profile);
     
     while (request_queue.head == NULL && request_queue.end_flag == 0) {
         pthread_cond_wait(&queue_cond, &queue_mutex);
@@ -155,13 +184,13 @@ void process_check(struct request *req) {
     int id = req->check_acc_id;
     
     // COARSE LOCK: Lock the entire bank for one account read
-    pthread_mutex_lock(&bank_lock);
+    profiled_lock(&bank_lock, &bank_lock_profile);
     int balance = read_account(id);
     pthread_mutex_unlock(&bank_lock);
     
     // Output
     gettimeofday(&req->endtime, NULL); 
-    pthread_mutex_lock(&output_mutex);
+    profiled_lock(&output_mutex, &output_mutex_profile);
     fprintf(output_file, "%d BAL %d TIME %ld.%06ld %ld.%06ld\n", 
             req->request_id, balance, req->starttime.tv_sec, req->starttime.tv_usec,
             req->endtime.tv_sec, req->endtime.tv_usec);
@@ -176,7 +205,7 @@ void process_transaction(struct request *req) {
     }
     
     // 1. Acquire the single Coarse Lock
-    pthread_mutex_lock(&bank_lock);
+    profiled_lock(&bank_lock, &bank_lock_profile);
     
     // 2. Atomicity Check (Read & Verify Balances)
     int insufficient_acc_id = -1;
@@ -205,7 +234,7 @@ void process_transaction(struct request *req) {
         
         // Success Output
         gettimeofday(&req->endtime, NULL);
-        pthread_mutex_lock(&output_mutex);
+        profiled_lock(&output_mutex, &output_mutex_profile);
         fprintf(output_file, "%d OK TIME %ld.%06ld %ld.%06ld\n", 
                 req->request_id, req->starttime.tv_sec, req->starttime.tv_usec,
                 req->endtime.tv_sec, req->endtime.tv_usec);
@@ -213,7 +242,7 @@ void process_transaction(struct request *req) {
     } else {
         // ISF: Output failure, state remains original
         gettimeofday(&req->endtime, NULL);
-        pthread_mutex_lock(&output_mutex);
+        profiled_lock(&output_mutex, &output_mutex_profile);
         fprintf(output_file, "%d ISF %d TIME %ld.%06ld %ld.%06ld\n", 
                 req->request_id, insufficient_acc_id, 
                 req->starttime.tv_sec, req->starttime.tv_usec,
@@ -264,17 +293,34 @@ void *worker_thread(void *arg) {
 
 // --- Main Function (Initialization Changes) ---
 int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: ./appserver-coarse <# of worker threads> <# of accounts> <output file>\n");
+    // Optional flags, same as appserver: --store=mem|mmap:PATH, --lockprof=CSV
+    char *store_path = NULL;
+    char *lockprof_path = NULL;
+    int arg = 1, bad_option = 0;
+    while (arg < argc && strncmp(argv[arg], "--", 2) == 0) {
+        if (strncmp(argv[arg], "--store=", 8) == 0) {
+            char *store = argv[arg] + 8;
+            if (strncmp(store, "mmap:", 5) == 0 && store[5] != '\0') store_path = store + 5;
+            else bad_option |= strcmp(store, "mem") != 0;
+        } else if (strncmp(argv[arg], "--lockprof=", 11) == 0 && argv[arg][11] != '\0') {
+            lockprof_path = argv[arg] + 11;
+            lockprof_enabled = 1;
+        } else {
+            bad_option = 1;
+        }
+        arg++;
+    }
+    if (bad_option || argc - arg != 3) {
+        fprintf(stderr, "Usage: ./appserver-coarse [--store=mem|mmap:PATH] [--lockprof=CSV] <# of worker threads> <# of accounts> <output file>\n");
         return 1;
     }
 
-    NUM_WORKERS = atoi(argv[1]);
-    NUM_ACCOUNTS = atoi(argv[2]);
-    char *output_filename = argv[3];
+    NUM_WORKERS = atoi(argv[arg]);
+    NUM_ACCOUNTS = atoi(argv[arg + 1]);
+    char *output_filename = argv[arg + 2];
 
-    if (NUM_ACCOUNTS > MAX_ACCOUNTS) {
-        fprintf(stderr, "Error: Max accounts supported is %d\n", MAX_ACCOUNTS);
+    if (NUM_WORKERS < 1 || NUM_ACCOUNTS < 1) {
+        fprintf(stderr, "Error: Need at least one worker thread and one account\n");
         return 1;
     }
 
@@ -282,6 +328,9 @@ int main(int argc, char **argv) {
         fprintf(stderr, "Error: Failed to initialize bank accounts.\n");
         return 1;
     }
+    if (store_path != NULL && mmap_accounts_open(store_path, NUM_ACCOUNTS) < 0) {
+        return 1;
+    }
     
     output_file = fopen(output_filename, "w");
     if (output_file == NULL) {
@@ -336,7 +385,13 @@ int main(int argc, char **argv) {
     for (int i = 0; i < NUM_WORKERS; i++) {
         pthread_join(workers[i], NULL);
     }
+    if (lockprof_enabled) {
+        report_lock_profile(lockprof_path);
+    }
     
+    if (store_path != NULL) {
+        mmap_accounts_close();
+    }
     free_accounts();
     fclose(output_file);
     return 0;
@@ -1,29 +1,190 @@
+#define _GNU_SOURCE     // strdup, getopt_long
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <stdarg.h>
 #include <string.h>
 #include <unistd.h>
+#include <limits.h>
 #include <pthread.h>
+#include <sched.h>
+#include <ucontext.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <sys/mman.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
 #include <errno.h>      
+#include <getopt.h>
 #include "Bank.h" 
+#include "BankMmap.h"
+#include "ringqueue.h"
+#include "futex.h"
+#include "protocol.h"
+#include "uring.h"
+#include "histogram.h"
+#include "mvcc.h"
+#include "lockprof.h"
+#include "BankAsync.h"
 
 // --- Configuration and Constants ---
-#define MAX_ACCOUNTS 10000 
-#define MAX_TOKENS 50    
+#define MAX_TOKENS PROTO_MAX_TOKENS
+#define CACHE_LINE 64
+#define MAX_TRANS ((MAX_TOKENS - 1) / 2)    // account/amount pairs per TRANS
+#define DEFAULT_RING_SIZE 4096
+#define BENCH_QUEUE_REQUESTS 200000
+#define BENCH_QUEUE_MAX_WORKERS 64
+#define DEQUE_INITIAL_SIZE 64
+#define STEAL_SPIN_TRIES 64
+#define DEFAULT_BATCH_SIZE 32
+#define DEFAULT_BATCH_WAIT_MS 5
+#define DEFAULT_ORDER_WINDOW 4096   // requests admitted to the EXEC_ORDERED graph at once
+#define DEFAULT_FLUSH_INTERVAL_MS 100
+#define DEFAULT_IDLE_TIMEOUT_MS 500 // --max-workers: idle time before a worker above the floor retires
+#define ASYNC_IO_GROUP 128          // --async-io: Bank.c calls submitted and awaited together
+#define DEFAULT_COROUTINES 64       // --exec=coro: requests in flight per worker
+#define CORO_STACK_SIZE (64 * 1024)
+#define CORO_LOCK_POLL_NS 10000000  // --exec=coro: lock retry period, one Bank.c call
+#define SMALL_TRANS_ACCOUNTS 2      // a TRANS of up to this many accounts is PRIO_NORMAL, else PRIO_LOW
+#define PRIO_STRIDE (1 << 20)       // --priority: pass added per dequeue is PRIO_STRIDE / weight
+#define PRIO_SERVICE_SHIFT 3        // smoothed service time moves 1/8 of the way per result
+#define POOL_INTERVAL_MS 20         // how often the elastic pool checks the backlog
+#define POOL_DRAIN_TARGET_MS 100    // grow until the queued requests would drain in this long
+#define SEQLOCK_MAX_RETRIES 4
+#define OCC_MAX_RETRIES 5           // optimistic attempts before a TRANS takes its locks up front
+#define OCC_BACKOFF_US 2000         // first retry waits up to twice this, doubling per abort
+#define MAX_HOT_ACCOUNTS 64         // accounts --hot may promote to delta slots
+#define HOT_REPORT_TOP 8            // most contended accounts listed at END
+#define LOCKPROF_TOP 10             // locks listed by --lockprof at END
+#define TIMELINE_SECONDS 3600       // per-second throughput counted for the first hour
+#define OUTPUT_RING_SIZE 65536      // bytes of pending result lines per worker (power of two)
+#define OUTPUT_LINE_MAX 128
+#define REQUEST_POOL_SLAB 256       // requests carved from one pool allocation
+#define INPUT_BLOCK_SIZE (1 << 20)  // bytes per read() of binary input
+#define MAX_LISTENERS 4
+#define CONN_INPUT_SIZE 65536       // unparsed request bytes held per connection
+#define CONN_OUTPUT_HIGH (1 << 20)  // stop reading a client this far behind on its replies
+#define NET_MAX_EVENTS 64
+#define URING_INPUT_BLOCKS 4        // input blocks read ahead with --io=uring
+#define URING_OUTPUT_STAGES 2
+#define URING_OUTPUT_STAGE_SIZE (1 << 20)
+#define WAL_BUFFER_SIZE (1 << 16)    // initial log buffer, doubled when a group outgrows it
 
 // --- Global Synchronization and Data Structures ---
-pthread_mutex_t account_locks[MAX_ACCOUNTS]; 
+// Lock table sized at startup: one stripe per account unless --lock-stripes
+// asks for fewer. Account id maps to stripe (id - 1) % num_lock_stripes, so
+// neighbouring accounts land on different stripes, and each stripe has its own
+// cache line.
+struct account_lock {
+    pthread_mutex_t mutex;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct account_lock *account_locks;
+int num_lock_stripes;
 pthread_mutex_t queue_mutex;                  
 pthread_cond_t queue_cond;                   
-pthread_mutex_t output_mutex;                 
-FILE *output_file;                           
+
+// --lockprof: per-lock counters, allocated only when profiling (lockprof.h)
+struct lock_profile *account_lock_profiles;     // one per stripe
+struct lock_profile queue_mutex_profile;
+int lockprof_enabled = 0;
+FILE *output_file;                            // written only by the result writer thread
 
 int NUM_ACCOUNTS;
 int NUM_WORKERS;
 
+// --- Queue Backend Selection ---
+// QUEUE_LIST is the original mutex/condvar linked list; QUEUE_RING is the
+// lock-free bounded ring from ringqueue.c; QUEUE_STEAL gives every worker its
+// own deque and lets idle workers steal from the others.
+enum queue_backend { QUEUE_LIST, QUEUE_RING, QUEUE_STEAL };
+enum queue_backend queue_backend = QUEUE_LIST;
+unsigned queue_capacity = DEFAULT_RING_SIZE;
+struct ring_queue *request_ring;
+
+// --- Priority Classes (--priority, --deadline) ---
+// A CHECK or STATS is PRIO_HIGH, a TRANS of up to SMALL_TRANS_ACCOUNTS
+// accounts PRIO_NORMAL, a larger TRANS or a SNAPSHOT PRIO_LOW, unless the
+// request line names its class with PRIO (protocol.h). With --priority the
+// list queue keeps one FIFO per class and serves the classes by weight. A
+// request may also carry a deadline (DEADLINE, or --deadline per class).
+// A result produced after it is flagged LATE, and with --deadline-miss=drop
+// a request that cannot finish in time is answered EXPIRED without running.
+enum prio_class { PRIO_HIGH, PRIO_NORMAL, PRIO_LOW, NUM_PRIO };  // NUM_PRIO == PROTO_PRIORITIES
+const char *prio_class_names[NUM_PRIO] = {"high", "normal", "low"};
+int priority_enabled = 0;
+int prio_weight[NUM_PRIO] = {8, 4, 1};
+struct request *prio_head[NUM_PRIO], *prio_tail[NUM_PRIO];  // queue_mutex
+uint64_t prio_pass[NUM_PRIO], prio_global_pass;     // stride scheduling (queue_mutex)
+long prio_dequeued[NUM_PRIO];                       // queue_mutex
+enum deadline_miss { MISS_FLAG, MISS_DROP };
+enum deadline_miss deadline_miss = MISS_FLAG;
+int prio_deadline_ms[NUM_PRIO];                     // --deadline, 0 for none
+long deadline_requests;                             // producer only
+long deadline_met[NUM_PRIO], deadline_late[NUM_PRIO], deadline_dropped[NUM_PRIO];
+uint64_t prio_service_ns[NUM_PRIO];     // smoothed time from a worker taking a request to its result
+
+// --- Execution Mode Selection ---
+// EXEC_LOCK is the original sorted per-account locking; EXEC_PARTITION shards
+// the accounts across workers and runs single-shard requests without locks;
+// EXEC_BATCH commits up to batch_size queued requests in one pass over Bank.c;
+// EXEC_OCC reads without locks and only locks to validate and write;
+// EXEC_ORDERED runs conflicting requests in arrival order and the rest in
+// parallel, with the same results as a serial run; EXEC_CORO runs EXEC_LOCK
+// requests as coroutines, many per worker.
+enum exec_mode { EXEC_LOCK, EXEC_PARTITION, EXEC_BATCH, EXEC_OCC, EXEC_ORDERED, EXEC_CORO };
+enum exec_mode exec_mode = EXEC_LOCK;
+int shard_size;                                  // accounts owned by each worker
+long single_shard_requests, multi_shard_requests;  // producer only
+int batch_size = DEFAULT_BATCH_SIZE;
+int batch_wait_ms = DEFAULT_BATCH_WAIT_MS;       // max wait to fill a batch
+int batch_filling = 0;                          // a worker is waiting to fill its batch (queue_mutex)
+
+// --- Account Cache Selection ---
+// CACHE_OFF calls Bank.c on every access; CACHE_WRITEBACK serves reads and
+// writes from memory and lets a flusher thread store dirty balances in the
+// background; CACHE_STRICT serves reads from memory but writes through to
+// Bank.c before the request is acknowledged.
+enum cache_mode { CACHE_OFF, CACHE_WRITEBACK, CACHE_STRICT };
+enum cache_mode cache_mode = CACHE_OFF;
+int flush_interval_ms = DEFAULT_FLUSH_INTERVAL_MS;
+
+// --- CHECK Read Path Selection ---
+// CHECK_LOCK takes the account mutex like a TRANS; CHECK_SEQLOCK reads
+// without it and retries if a TRANS wrote the account meanwhile; CHECK_MVCC
+// reads the latest committed version of the account and never waits.
+enum check_mode { CHECK_LOCK, CHECK_SEQLOCK, CHECK_MVCC };
+enum check_mode check_mode = CHECK_LOCK;
+
+// --- Input Selection ---
+// INPUT_TEXT reads CHECK/TRANS lines; INPUT_BINARY reads length-prefixed
+// frames (protocol.h). Either is read in INPUT_BLOCK_SIZE blocks from stdin
+// or from --input-file.
+enum input_format { INPUT_TEXT, INPUT_BINARY };
+enum input_format input_format = INPUT_TEXT;
+int input_fd = STDIN_FILENO;
+struct proto_reader *input_reader;
+
+// --- I/O Backend Selection ---
+// IO_STDIO reads input with read() and writes results with writev();
+// IO_URING does both through io_uring, and falls back to IO_STDIO when the
+// kernel does not allow it.
+enum io_backend { IO_STDIO, IO_URING };
+enum io_backend io_backend = IO_STDIO;
+
 struct trans {
     int acc_id; 
     int amount;
+    unsigned ticket;    // per-account arrival ticket (QUEUE_STEAL only)
 };
 
 struct request {
@@ -31,9 +192,24 @@ struct request {
     int request_id;
     char request_type; 
     int check_acc_id; 
-    struct trans *transactions; 
     int num_trans;
+    unsigned check_ticket;  // per-account arrival ticket for CHECK (QUEUE_STEAL only)
+    int shard_arrivals;     // owners yet to reach this multi-shard TRANS (EXEC_PARTITION)
+    int shard_refs;         // owners still holding this request (EXEC_PARTITION)
+    uint32_t shard_done;    // set once the multi-shard TRANS has been applied
     struct timeval starttime, endtime; 
+    uint64_t arrival_ns;    // monotonic time the request was read (latency statistics)
+    uint64_t wal_lsn;       // log record to wait for before replying (--wal)
+    int wal_logged;         // the TRANS appended that record (0 for an ISF)
+    uint32_t hot_deposits;  // transactions[] applied through delta slots (--hot)
+    int order_pending;      // accounts still held by earlier requests (EXEC_ORDERED)
+    uint32_t order_released;    // accounts of this request handed on, by request_accounts() index
+    struct request *order_next[MAX_TRANS];  // next request on each of those accounts (EXEC_ORDERED)
+    struct connection *conn;    // client to answer (--listen), or NULL for the output file
+    int prio_class;             // enum prio_class
+    int expired;                // answered EXPIRED without running
+    uint64_t deadline_ns;       // monotonic time the result is due by, or 0
+    struct trans transactions[MAX_TRANS];   // last: only num_trans entries are set
 };
 
 struct queue {
@@ -43,15 +219,333 @@ struct queue {
     int end_flag; 
 } request_queue;
 
+// --- Per-Worker State ---
+// Each worker owns a deque (used by QUEUE_STEAL) plus counters reported at END.
+// The deque is a growable circular array: the owner pops the oldest request
+// from the head, thieves take the newest from the tail.
+struct worker_deque {
+    pthread_mutex_t lock;
+    struct request **items;
+    unsigned capacity, head, count;
+    unsigned long pushes, depth_sum, max_depth;
+} __attribute__((aligned(CACHE_LINE)));
+
+// One distinct account of an EXEC_BATCH batch
+struct batch_account {
+    int acc_id;
+    unsigned first_ticket, last_ticket;
+    int value;      // in-memory balance while the batch is replayed
+    int dirty;
+};
+
+// Result lines a worker has formatted but the writer has not stored yet.
+// Single producer (the worker) and single consumer (the writer thread).
+struct output_ring {
+    char *buf;
+    uint64_t head;                                          // bytes produced
+    uint64_t tail __attribute__((aligned(CACHE_LINE)));     // bytes written out
+    long lines;
+};
+
+// Latency phases of a request, from being read to its result being queued
+enum latency_phase { PHASE_QUEUE, PHASE_LOCK, PHASE_BANK, PHASE_OUTPUT, PHASE_TOTAL, NUM_PHASES };
+
+enum worker_state { WORKER_UNUSED, WORKER_RUNNING, WORKER_RETIRED };
+
+// One request in flight on an EXEC_CORO worker (see "Coroutine Executor")
+enum coro_state { CORO_FREE, CORO_READY, CORO_RUNNING, CORO_IO, CORO_LOCK };
+
+struct coroutine {
+    ucontext_t context;
+    char *stack;                    // mapping, guard page first
+    enum coro_state state;
+    struct request *req;
+    struct bank_io_group *io;       // Bank.c calls it waits for (CORO_IO)
+    uint64_t started_ns, lock_ns, bank_ns;  // its phase_*_ns while it is not running
+};
+
+struct worker {
+    struct worker_deque deque;
+    struct output_ring output;
+    enum worker_state state;    // queue_mutex
+    int joinable;               // thread started here and not joined yet (pool thread, then main)
+    pthread_mutex_t latency_mutex;      // lets STATS read latency[] while the worker records
+    struct histogram latency[NUM_PHASES];   // nanoseconds
+    struct histogram class_latency[NUM_PRIO];   // total latency by priority class
+    struct ring_queue *inbox;   // requests for this worker's shard (EXEC_PARTITION)
+    int id;
+    pthread_t thread;
+    long processed;
+    long steals;
+
+    // EXEC_CORO coroutines. coro_events is bumped when a Bank.c group of one
+    // of them finishes, or a request arrives while coro_parked.
+    struct coroutine *coros;
+    uint32_t coro_events;
+    uint32_t coro_parked;
+    int coro_peak;
+    long coro_switches, coro_parks;
+
+    // EXEC_BATCH scratch space, sized once for batch_size requests
+    struct request **batch;
+    struct trans *batch_refs;           // (account, ticket) of every access in the batch
+    struct batch_account *batch_accts;  // distinct accounts, sorted by ID
+    long batches, batch_reads, batch_writes, unbatched_calls;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct worker *workers;
+
+// Idle QUEUE_STEAL workers park on steal_events (bumped on every push)
+uint32_t steal_events;
+uint32_t steal_idle;
+unsigned steal_round_robin;
+
+// Per-account ticket locks for QUEUE_STEAL. The producer hands out tickets in
+// arrival order, so conflicting requests run in arrival order no matter which
+// worker ends up executing them.
+unsigned *account_next_ticket;
+uint32_t *account_now_serving;
+
+// Account cache. Entry i is guarded by account_lock(i + 1); the flusher only
+// peeks at cache_state[] without the lock to skip clean entries.
+#define CACHE_VALID 0x1
+#define CACHE_DIRTY 0x2
+int *cache_values;
+unsigned char *cache_state;
+long cache_hits, cache_misses, cache_writes;
+long flush_passes, flush_writes;
+double flush_seconds;               // wall time of all flush passes
+int flush_stop;
+pthread_t flush_thread;
+pthread_mutex_t flush_mutex;
+pthread_cond_t flush_cond;
+
+// I/O threads of BankAsync.c (--async-io); 0 makes every Bank.c call on the
+// worker itself
+int async_io_threads;
+
+// Per-account sequence numbers for CHECK_SEQLOCK and EXEC_OCC: odd while a
+// TRANS is writing the account. Readers that find it odd park on the word.
+uint32_t *account_seq;
+uint32_t seq_parked;
+long seqlock_reads, seqlock_retries, seqlock_parks, seqlock_fallbacks;
+
+// EXEC_OCC outcomes
+long occ_commits, occ_isf, occ_aborts, occ_fallbacks;
+
+// EXEC_ORDERED request graph (see "Deterministic Execution" below)
+struct request **account_last;      // latest request per account still in the graph
+int order_window = DEFAULT_ORDER_WINDOW;
+int order_in_flight;                // admitted and not yet finished
+pthread_cond_t order_window_cond;
+long order_admitted, order_dependent, order_window_waits;
+
+// Account versions for CHECK_MVCC; slot i belongs to worker i
+struct mvcc *account_versions;
+__thread int worker_slot;           // id of the calling worker
+long mvcc_reads;
+
+// Hot accounts (see "Hot-Account Delta Slots" below). Deposits to a promoted
+// account go to the depositing worker's slot, one cache line per worker.
+struct hot_slot {
+    long deposited;     // running total, only ever added to by its worker
+} __attribute__((aligned(CACHE_LINE)));
+
+struct hot_account {
+    int acc_id;
+    struct hot_slot *slots;     // NUM_WORKERS entries
+    long merged;        // slot total already in the stored balance (account lock)
+    long seen;          // slot total of the last locked read (account lock)
+    long deposits, merges;
+};
+
+int hot_threshold = 0;              // contended lock attempts before promotion; 0 = off
+uint32_t *account_contention;       // contended lock attempts per account
+int *account_hot;                   // index + 1 in hot_accounts, 0 if not promoted
+struct hot_account hot_accounts[MAX_HOT_ACCOUNTS];
+int num_hot_accounts;               // hot_mutex
+pthread_mutex_t hot_mutex;
+
+// Elastic worker pool (see "Elastic Worker Pool" below). NUM_WORKERS is the
+// ceiling; pool_running and worker states are guarded by queue_mutex.
+int pool_max_workers = 0;           // --max-workers; 0 = every worker runs until END
+int pool_min_workers;               // the command-line worker count
+int idle_timeout_ms = DEFAULT_IDLE_TIMEOUT_MS;
+int pool_running, pool_peak;
+long pool_started, pool_retired;
+uint64_t pool_service_ns, pool_served;  // service time of every result so far (atomic)
+uint64_t pool_service_avg_ns;       // smoothed per request (pool thread only)
+uint64_t pool_last_service_ns, pool_last_served;
+int pool_logged_running;            // pool size last logged (pool thread only)
+int pool_stop;
+pthread_t pool_thread;
+pthread_mutex_t pool_mutex;
+pthread_cond_t pool_cond;           // pool thread timer
+pthread_cond_t pool_exit_cond;      // a worker exited at END (queue_mutex)
+__thread int worker_retired;        // the calling worker has retired
+
+// Result writer thread. Workers bump output_events after every line and wake
+// the writer only if it is parked.
+__thread struct output_ring *worker_output;     // ring of the calling worker
+int ordered_output = 0;                         // write results in request-ID order
+uint32_t output_events;
+uint32_t writer_parked;
+int output_stop;
+pthread_t writer_thread;
+long output_writes, output_bytes;
+
+// Latency statistics (see "Latency Statistics" below). A worker's lock and
+// Bank.c time add up here until it emits its next result.
+__thread uint64_t phase_started_ns;     // when the calling worker took its request(s)
+__thread uint64_t phase_lock_ns;        // blocked on account locks or tickets since then
+__thread uint64_t phase_bank_ns;        // inside Bank.c calls since then
+
+// EXEC_CORO: coroutines per worker, and the one running on this thread
+int coroutines_per_worker = DEFAULT_COROUTINES;
+__thread struct coroutine *current_coro;
+__thread ucontext_t coro_scheduler;      // context of the worker loop
+uint64_t server_start_ns;
+uint32_t throughput_timeline[TIMELINE_SECONDS];    // results emitted in each second since start
+char *timeline_path;                    // --timeline
+
+// Request pool (see "Request Pool" below)
+struct request_slab {
+    struct request_slab *next;
+    struct request requests[REQUEST_POOL_SLAB];
+};
+struct request_slab *request_slabs;
+struct request *request_freelist;       // producer only
+struct request *request_pool_returned;  // finished requests pushed by workers
+long request_slab_count;
+long requests_parsed;
+long request_path_allocs;               // every heap allocation made while serving requests
+
+// Network listener (see "Network Listener" below). epoll data points at a
+// struct net_source, which is also the first member of struct connection.
+enum net_kind { NET_LISTENER, NET_WAKEUP, NET_SIGNAL, NET_CONNECTION };
+struct net_source {
+    enum net_kind kind;
+    int fd;
+};
+
+struct connection {
+    struct net_source source;
+    pthread_mutex_t mutex;      // guards out, inflight and dirty, which workers touch
+    char *out;                  // acks and results not yet sent
+    size_t out_len, out_cap;
+    int inflight;               // requests queued but not yet answered
+    int dirty;                  // on net_dirty, waiting for the event loop
+    struct connection *dirty_next;
+    // Everything below belongs to the event loop thread
+    unsigned events;            // current epoll interest
+    int reading;                // 0 after EOF, END or a protocol error
+    int magic_seen;             // INPUT_BINARY: stream header consumed
+    int closed;
+    struct connection *prev, *next;
+    size_t in_len;
+    char in[CONN_INPUT_SIZE];
+};
+
+char *listen_specs[MAX_LISTENERS];
+int num_listeners;
+struct net_source net_listeners[MAX_LISTENERS];
+struct net_source net_wakeup = {NET_WAKEUP, -1};  // eventfd written by workers
+struct net_source net_signal = {NET_SIGNAL, -1};  // SIGINT/SIGTERM
+int net_epoll_fd = -1;
+int net_stop;
+struct connection *net_connections;     // open connections
+struct connection *net_closed;          // freed after the current epoll batch
+pthread_mutex_t net_dirty_mutex = PTHREAD_MUTEX_INITIALIZER;
+struct connection *net_dirty;           // connections with new replies (net_dirty_mutex)
+long net_accepted, net_requests, net_reads, net_sends, net_wakeups;
+
+// Write-ahead log (see "Write-Ahead Log" below). Everything but wal_fd and
+// the buffer being written out is guarded by wal_mutex.
+struct wal_buffer {
+    char *data;
+    size_t len, capacity;
+};
+int wal_fd = -1;
+pthread_mutex_t wal_mutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t wal_writer_cond = PTHREAD_COND_INITIALIZER;     // records to write, or stop
+pthread_cond_t wal_durable_cond = PTHREAD_COND_INITIALIZER;    // wal_durable_lsn moved
+struct wal_buffer wal_active, wal_flushing;     // workers append to wal_active
+uint64_t wal_next_lsn;          // LSN of the last appended record
+uint64_t wal_durable_lsn;       // every record up to this one is on disk
+int wal_writer_busy, wal_stop;
+pthread_t wal_thread;
+long wal_fsyncs, wal_records, wal_max_group, wal_bytes;
+struct histogram wal_commit_latency;    // time an OK waited for the disk, in ns
+
+// Snapshots (see "Consistent Snapshots" below). account_snap_epoch[] and
+// snapshot_copy[] entry i are guarded by account_lock(i + 1).
+extern int *BANK_accounts;              // Bank.c, used directly by snapshots and WAL replay
+char *snapshot_path;                    // --snapshot; SNAPSHOT is refused without it
+int store_mapped;                       // --store=mmap: SNAPSHOT also syncs the store
+uint32_t snapshot_epoch;                // epoch of the running snapshot, 0 when none
+uint32_t snapshot_count;                // last epoch handed out (snapshot_mutex)
+uint32_t *account_snap_epoch;           // latest epoch that has account i's balance
+int *snapshot_copy;                     // balance a TRANS replaced during that epoch
+int *snapshot_values;                   // scratch for the snapshot being written
+pthread_mutex_t snapshot_mutex = PTHREAD_MUTEX_INITIALIZER;
+long snapshot_copies;
+double snapshot_seconds;
+
 
 // --- Function Prototypes ---
 void *worker_thread(void *arg);
+void steal_push(struct request *req);
+struct request *steal_dequeue(struct worker *self);
+void acquire_ticket(int id, unsigned ticket);
+void release_ticket(int id, unsigned ticket);
+void assign_tickets(struct request *req);
+void partition_push(struct request *req);
+void order_admit(struct request *req);
+int is_repeat_account(struct request *req, int i);
+int is_overwritten_account(struct request *req, int i);
+int process_partitioned(struct request *req);
+int apply_transaction(struct request *req);
+void install_transaction(struct request *req, const int *original_balances);
+void order_written(struct request *req, int i);
+int hot_read(int id);
+void hot_merged(int id);
+void hot_deposit(int id, int amount);
+void report_transaction(struct request *req, int insufficient_acc_id);
+void wal_append(struct request *req);
+void wal_note_read(struct request *req);
+void wal_wait(struct request *req);
+pthread_mutex_t *account_lock(int id);
+int lock_stripe(int id);
+int bank_read(int id);
+void bank_write(int id, int value);
+int timed_read_account(int id);
+void timed_write_account(int id, int value);
+void bank_read_many(const int *ids, int *values, int n);
+void bank_write_many(const int *ids, const int *values, int n);
+int coro_lock_stripe(int stripe);
+void coro_wait_io(struct bank_io_group *group);
+void coro_notify_arrival();
+uint64_t monotonic_ns();
+int pool_idle_wait(struct worker *self, struct timespec *deadline);
+void latency_start();
+void latency_record(struct request *req, uint64_t output_start);
+void process_stats(struct request *req);
+void batch_worker_loop(struct worker *self);
+void emit_result(struct request *req, const char *fmt, ...);
 int integer_comparator(const void *a, const void *b);
 void process_transaction(struct request *req);
+void process_transaction_hot(struct request *req);
+void hot_lock(int id);
 void process_check(struct request *req);
-struct request *parse_input(char *input_line, int current_id);
+int read_input_frame(struct proto_frame *frame);
+struct request *request_from_frame(const struct proto_frame *frame, int current_id);
+void conn_send_result(struct connection *conn, const char *line, int len);
+struct request *request_alloc();
+void request_free(struct request *req);
 void enqueue_request(struct request *req);
-struct request *dequeue_request();
+struct request *dequeue_request(struct worker *self);
+void close_request_queue();
+int run_queue_benchmark();
 
 
 // --- Comparator for Deadlock Prevention (qsort) ---
@@ -60,264 +554,4241 @@ int integer_comparator(const void *a, const void *b) {
 }
 
 
-// --- Queue Management ---
+// --- Account Lock Table ---
 
-void enqueue_request(struct request *req) {
-    pthread_mutex_lock(&queue_mutex);
-    
-    if (request_queue.tail == NULL) {
-        request_queue.head = request_queue.tail = req;
+int lock_stripe(int id) {
+    return (id - 1) % num_lock_stripes;
+}
+
+pthread_mutex_t *account_lock(int id) {
+    return &account_locks[lock_stripe(id)].mutex;
+}
+
+// Every account and queue lock is taken through these two. An account lock
+// is tried first; only a lock that was held costs clock reads, and the wait
+// counts toward the lock phase of the current request. Returns 1 if the lock
+// was held by another thread (or coroutine).
+int lock_stripe_mutex(int stripe) {
+    if (current_coro != NULL) return coro_lock_stripe(stripe);
+
+    pthread_mutex_t *mutex = &account_locks[stripe].mutex;
+    uint64_t waited;
+    if (lockprof_enabled) {
+        waited = lockprof_lock(mutex, &account_lock_profiles[stripe]);
+    } else {
+        if (pthread_mutex_trylock(mutex) == 0) return 0;
+        uint64_t start = monotonic_ns();
+        pthread_mutex_lock(mutex);
+        waited = monotonic_ns() - start;
+    }
+    phase_lock_ns += waited;
+    return waited != 0;
+}
+
+int lock_account(int id) {
+    return lock_stripe_mutex(lock_stripe(id));
+}
+
+void lock_queue() {
+    if (lockprof_enabled) {
+        lockprof_lock(&queue_mutex, &queue_mutex_profile);
     } else {
-        request_queue.tail->next = req;
-        request_queue.tail = req;
+        pthread_mutex_lock(&queue_mutex);
     }
+}
+
+void report_lock_profile(const char *csv_path) {
+    struct lockprof_group groups[] = {
+        {num_lock_stripes == NUM_ACCOUNTS ? "account" : "stripe", account_lock_profiles, num_lock_stripes,
+         num_lock_stripes == NUM_ACCOUNTS ? 1 : 0},
+        {"queue_mutex", &queue_mutex_profile, 1, -1},
+    };
+    lockprof_report(stderr, groups, 2, LOCKPROF_TOP);
+    if (!lockprof_write_csv(csv_path, groups, 2)) {
+        fprintf(stderr, "Error writing lock profile %s: %s\n", csv_path, strerror(errno));
+    } else {
+        fprintf(stderr, "Lock profile written to %s\n", csv_path);
+    }
+}
+
+// Stripes of every account of req, sorted for a consistent lock acquisition
+// order. Two accounts of one TRANS can share a stripe, so the lock and unlock
+// helpers skip repeats.
+void sort_stripes(struct request *req, int *sorted_ids) {
+    for (int i = 0; i < req->num_trans; i++) {
+        sorted_ids[i] = lock_stripe(req->transactions[i].acc_id);
+    }
+    qsort(sorted_ids, req->num_trans, sizeof(int), integer_comparator);
+}
+
+void lock_stripes(const int *sorted_ids, int n) {
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && sorted_ids[i] == sorted_ids[i - 1]) continue;
+        lock_stripe_mutex(sorted_ids[i]);
+    }
+}
+
+void unlock_stripes(const int *sorted_ids, int n) {
+    for (int i = n - 1; i >= 0; i--) {
+        if (i > 0 && sorted_ids[i] == sorted_ids[i - 1]) continue;
+        pthread_mutex_unlock(&account_locks[sorted_ids[i]].mutex);
+    }
+}
+
+// Scale a byte count to KiB or MiB for display
+double display_size(double bytes, const char **unit) {
+    if (bytes >= 1024.0 * 1024.0) { *unit = "MiB"; return bytes / (1024.0 * 1024.0); }
+    *unit = "KiB";
+    return bytes / 1024.0;
+}
+
+// Startup report of the per-account memory this configuration uses
+void report_footprint() {
+    const char *lock_unit, *state_unit;
+    size_t per_account = sizeof(int);   // Bank.c balance
+    if (account_next_ticket) per_account += sizeof(unsigned) + sizeof(uint32_t);
+    if (cache_values) per_account += sizeof(int) + sizeof(unsigned char);
+    if (account_seq) per_account += sizeof(uint32_t);
+    if (account_snap_epoch) per_account += sizeof(uint32_t) + 2 * sizeof(int);
+    if (account_last) per_account += sizeof(struct request *);
+    if (account_contention) per_account += sizeof(uint32_t) + sizeof(int);
+
+    double locks = display_size((double)num_lock_stripes * sizeof(struct account_lock), &lock_unit);
+    double state = display_size((double)per_account * NUM_ACCOUNTS, &state_unit);
+    fprintf(stderr, "Footprint: %d accounts, lock table %d x %zu B = %.1f %s, account state %zu B each = %.1f %s\n",
+            NUM_ACCOUNTS, num_lock_stripes, sizeof(struct account_lock), locks, lock_unit,
+            per_account, state, state_unit);
+}
+
+
+// --- Queue Management ---
+
+// The list queue itself; the caller holds queue_mutex. With --priority each
+// class has its own FIFO. Stride scheduling picks the class with the lowest
+// pass, so while every class is backlogged, they are served in proportion to
+// their weights. A class that was empty starts from the current pass, so it
+// cannot save up turns while idle.
+void queue_push(struct request *req) {
     req->next = NULL;
     request_queue.num_jobs++;
-    
+    if (!priority_enabled) {
+        if (request_queue.tail == NULL) {
+            request_queue.head = request_queue.tail = req;
+        } else {
+            request_queue.tail->next = req;
+            request_queue.tail = req;
+        }
+        return;
+    }
+
+    int c = req->prio_class;
+    if (prio_tail[c] == NULL) {
+        if (prio_pass[c] < prio_global_pass) prio_pass[c] = prio_global_pass;
+        prio_head[c] = prio_tail[c] = req;
+    } else {
+        prio_tail[c]->next = req;
+        prio_tail[c] = req;
+    }
+}
+
+struct request *queue_pop() {
+    struct request *req;
+    if (request_queue.num_jobs == 0) return NULL;
+    request_queue.num_jobs--;
+    if (!priority_enabled) {
+        req = request_queue.head;
+        request_queue.head = req->next;
+        if (request_queue.head == NULL) {
+            request_queue.tail = NULL;
+        }
+        return req;
+    }
+
+    int c = -1;
+    for (int k = 0; k < NUM_PRIO; k++) {
+        if (prio_head[k] != NULL && (c < 0 || prio_pass[k] < prio_pass[c])) c = k;
+    }
+    req = prio_head[c];
+    prio_head[c] = req->next;
+    if (prio_head[c] == NULL) prio_tail[c] = NULL;
+    prio_global_pass = prio_pass[c];
+    prio_pass[c] += PRIO_STRIDE / prio_weight[c];
+    prio_dequeued[c]++;
+    return req;
+}
+
+void enqueue_request(struct request *req) {
+    if (exec_mode == EXEC_BATCH) {
+        assign_tickets(req);
+    }
+    if (exec_mode == EXEC_ORDERED) {
+        order_admit(req);
+        return;
+    }
+    if (exec_mode == EXEC_PARTITION) {
+        partition_push(req);
+        return;
+    }
+    if (queue_backend == QUEUE_RING) {
+        ring_push(request_ring, req);
+        return;
+    }
+    if (queue_backend == QUEUE_STEAL) {
+        steal_push(req);
+        return;
+    }
+
+    lock_queue();
+    queue_push(req);
     pthread_cond_signal(&queue_cond);
     pthread_mutex_unlock(&queue_mutex);
+    if (exec_mode == EXEC_CORO) coro_notify_arrival();
 }
 
-struct request *dequeue_request() {
+struct request *dequeue_request(struct worker *self) {
     struct request *req = NULL;
     
-    pthread_mutex_lock(&queue_mutex);
+    if (exec_mode == EXEC_PARTITION) {
+        return ring_pop(self->inbox);
+    }
+    if (queue_backend == QUEUE_RING) {
+        // Returns NULL only after close_request_queue() and once drained
+        return ring_pop(request_ring);
+    }
+    if (queue_backend == QUEUE_STEAL) {
+        return steal_dequeue(self);
+    }
+
+    lock_queue();
     
-    while (request_queue.head == NULL && request_queue.end_flag == 0) {
-        pthread_cond_wait(&queue_cond, &queue_mutex);
+    struct timespec idle_deadline;
+    if (pool_max_workers) {
+        clock_gettime(CLOCK_REALTIME, &idle_deadline);
+        idle_deadline.tv_nsec += idle_timeout_ms * 1000000L;
+        idle_deadline.tv_sec += idle_deadline.tv_nsec / 1000000000L;
+        idle_deadline.tv_nsec %= 1000000000L;
     }
 
-    if (request_queue.head != NULL) {
-        req = request_queue.head;
-        request_queue.head = request_queue.head->next;
-        if (request_queue.head == NULL) {
-            request_queue.tail = NULL;
+    // EXEC_ORDERED: requests still in the graph may yet release more work
+    while (request_queue.num_jobs == 0 && (request_queue.end_flag == 0 || order_in_flight > 0)) {
+        if (!pool_max_workers) {
+            pthread_cond_wait(&queue_cond, &queue_mutex);
+        } else if (pool_idle_wait(self, &idle_deadline)) {
+            pthread_mutex_unlock(&queue_mutex);
+            return NULL;
         }
-        request_queue.num_jobs--;
     }
+
+    req = queue_pop();
     
     pthread_mutex_unlock(&queue_mutex);
     return req;
 }
 
+// Wake every idle worker once end_flag is set so they can drain and exit
+void close_request_queue() {
+    if (exec_mode == EXEC_PARTITION) {
+        for (int i = 0; i < NUM_WORKERS; i++) {
+            ring_close(workers[i].inbox);
+        }
+        return;
+    }
+    if (queue_backend == QUEUE_RING) {
+        ring_close(request_ring);
+        return;
+    }
+    if (queue_backend == QUEUE_STEAL) {
+        __atomic_add_fetch(&steal_events, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&steal_events, INT32_MAX);
+        return;
+    }
+    lock_queue();
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
 
-// --- Request Parsing (Main Thread Helper) ---
+// --- Work-Stealing Deques (QUEUE_STEAL) ---
 
-struct request *parse_input(char *input_line, int current_id) {
-    char *tokens[MAX_TOKENS];
-    char *token;
-    int count = 0;
-    
-    // strdup requires <string.h> and <stdlib.h>
-    char *line_copy = strdup(input_line);
-    if (line_copy == NULL) { fprintf(stderr, "Memory error during parsing.\n"); return NULL; }
+void deque_init(struct worker_deque *dq) {
+    pthread_mutex_init(&dq->lock, NULL);
+    dq->items = NULL;
+    dq->capacity = dq->head = dq->count = 0;
+    dq->pushes = dq->depth_sum = dq->max_depth = 0;
+}
+
+// Called with dq->lock held. Doubles the array and unwraps it.
+int deque_grow(struct worker_deque *dq) {
+    unsigned new_capacity = dq->capacity ? dq->capacity * 2 : DEQUE_INITIAL_SIZE;
+    struct request **items = (struct request **)malloc(new_capacity * sizeof(struct request *));
+    if (items == NULL) return 0;
+    __atomic_add_fetch(&request_path_allocs, 1, __ATOMIC_RELAXED);
 
-    token = strtok(line_copy, " \t\r\n");
-    while (token != NULL && count < MAX_TOKENS) {
-        tokens[count++] = token;
-        token = strtok(NULL, " \t\r\n");
+    for (unsigned i = 0; i < dq->count; i++) {
+        items[i] = dq->items[(dq->head + i) % dq->capacity];
     }
-    if (count == 0) { free(line_copy); return NULL; }
-    
-    struct request *req = (struct request *)calloc(1, sizeof(struct request));
-    if (req == NULL) { free(line_copy); return NULL; }
-    req->request_id = current_id;
+    free(dq->items);
+    dq->items = items;
+    dq->capacity = new_capacity;
+    dq->head = 0;
+    return 1;
+}
 
-    if (strcmp(tokens[0], "CHECK") == 0) {
-        if (count != 2) { goto invalid_input; }
-        req->request_type = 'C';
-        req->check_acc_id = atoi(tokens[1]);
-    } else if (strcmp(tokens[0], "TRANS") == 0) {
-        if (count < 3 || count % 2 != 1) { goto invalid_input; }
-        req->request_type = 'T';
-        req->num_trans = (count - 1) / 2;
-        req->transactions = (struct trans *)calloc(req->num_trans, sizeof(struct trans));
-        
-        for (int i = 0; i < req->num_trans; i++) {
-            req->transactions[i].acc_id = atoi(tokens[2 * i + 1]);
-            req->transactions[i].amount = atoi(tokens[2 * i + 2]);
-        }
-    } else if (strcmp(tokens[0], "END") == 0) {
-        req->request_type = 'E';
-        request_queue.end_flag = 1; 
-    } else {
-        goto invalid_input;
+struct request *deque_pop_head(struct worker_deque *dq) {
+    struct request *req = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        req = dq->items[dq->head];
+        dq->head = (dq->head + 1) % dq->capacity;
+        dq->count--;
     }
-    
-    free(line_copy); 
+    pthread_mutex_unlock(&dq->lock);
     return req;
-
-invalid_input:
-    fprintf(stderr, "Error: Invalid command format for '%s'.\n", tokens[0]);
-    if (req) free(req); 
-    free(line_copy);
-    return NULL;
 }
 
+struct request *deque_pop_tail(struct worker_deque *dq) {
+    struct request *req = NULL;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count > 0) {
+        dq->count--;
+        req = dq->items[(dq->head + dq->count) % dq->capacity];
+    }
+    pthread_mutex_unlock(&dq->lock);
+    return req;
+}
 
-// --- Worker Processing Logic ---
+// Route by the first account so a worker keeps seeing the same accounts
+int steal_home_worker(struct request *req) {
+    int acc_id;
+    if (req->request_type == 'C') {
+        acc_id = req->check_acc_id;
+    } else if (req->request_type == 'T' && req->num_trans > 0) {
+        acc_id = req->transactions[0].acc_id;
+    } else {
+        return steal_round_robin++ % NUM_WORKERS;
+    }
+    return (int)(((unsigned)acc_id * 2654435761u) % (unsigned)NUM_WORKERS);
+}
 
-void process_check(struct request *req) {
-    int id = req->check_acc_id;
-    
-    pthread_mutex_lock(&account_locks[id - 1]);
-    int balance = read_account(id);
-    pthread_mutex_unlock(&account_locks[id - 1]);
-    
-    // Output
-    gettimeofday(&req->endtime, NULL); 
-    pthread_mutex_lock(&output_mutex);
-    fprintf(output_file, "%d BAL %d TIME %ld.%06ld %ld.%06ld\n", 
-            req->request_id, balance, req->starttime.tv_sec, req->starttime.tv_usec,
-            req->endtime.tv_sec, req->endtime.tv_usec);
-    pthread_mutex_unlock(&output_mutex);
+// 1 if transactions[i] names an account already listed earlier in the request
+int is_repeat_account(struct request *req, int i) {
+    for (int j = 0; j < i; j++) {
+        if (req->transactions[j].acc_id == req->transactions[i].acc_id) return 1;
+    }
+    return 0;
 }
 
-void process_transaction(struct request *req) {
-    // 1. Prepare for Deadlock Prevention: Collect and Sort IDs
-    int *sorted_ids = (int *)malloc(req->num_trans * sizeof(int));
-    int *all_ids = (int *)malloc(req->num_trans * sizeof(int));
-    
-    for (int i = 0; i < req->num_trans; i++) {
-        all_ids[i] = req->transactions[i].acc_id;
-        sorted_ids[i] = req->transactions[i].acc_id;
+// 1 if a later entry of req names the same account: a TRANS reads every
+// account before writing any, so only the last write to an account counts
+int is_overwritten_account(struct request *req, int i) {
+    for (int j = i + 1; j < req->num_trans; j++) {
+        if (req->transactions[j].acc_id == req->transactions[i].acc_id) return 1;
     }
-    
-    // CRITICAL STEP: Sort the list of involved account IDs for consistent lock acquisition order
-    qsort(sorted_ids, req->num_trans, sizeof(int), integer_comparator); 
+    return 0;
+}
 
-    // 2. Acquire Locks in Sorted Order (Deadlock Prevention)
-    for (int i = 0; i < req->num_trans; i++) {
-        pthread_mutex_lock(&account_locks[sorted_ids[i] - 1]);
+// Producer only: take one ticket per distinct account in arrival order
+void assign_tickets(struct request *req) {
+    if (account_next_ticket == NULL) return;
+
+    if (req->request_type == 'C') {
+        req->check_ticket = account_next_ticket[req->check_acc_id - 1]++;
+        return;
     }
-    
-    // 3. Atomicity Check (Read & Verify Balances)
-    int insufficient_acc_id = -1;
-    int *original_balances = (int *)malloc(req->num_trans * sizeof(int));
-    
     for (int i = 0; i < req->num_trans; i++) {
-        int id = all_ids[i];
-        int amount = req->transactions[i].amount;
-        original_balances[i] = read_account(id); 
-        
-        // Insufficient Funds Check 
-        if (original_balances[i] + amount < 0) {
-            insufficient_acc_id = id;
-            break; 
+        int id = req->transactions[i].acc_id;
+        if (!is_repeat_account(req, i)) {
+            req->transactions[i].ticket = account_next_ticket[id - 1]++;
         }
     }
-    
-    // 4. Execute or Void
-    if (insufficient_acc_id == -1) {
-        // SUCCESS: Apply all writes
-        for (int i = 0; i < req->num_trans; i++) {
-            int id = all_ids[i];
-            int amount = req->transactions[i].amount;
-            write_account(id, original_balances[i] + amount); 
-        }
-        
-        // Success Output
-        gettimeofday(&req->endtime, NULL);
-        pthread_mutex_lock(&output_mutex);
-        fprintf(output_file, "%d OK TIME %ld.%06ld %ld.%06ld\n", 
-                req->request_id, req->starttime.tv_sec, req->starttime.tv_usec,
-                req->endtime.tv_sec, req->endtime.tv_usec);
-        pthread_mutex_unlock(&output_mutex);
-    } else {
-        // ISF: Output failure, state remains original (no writes performed)
-        gettimeofday(&req->endtime, NULL);
-        pthread_mutex_lock(&output_mutex);
-        fprintf(output_file, "%d ISF %d TIME %ld.%06ld %ld.%06ld\n", 
-                req->request_id, insufficient_acc_id, 
-                req->starttime.tv_sec, req->starttime.tv_usec,
-                req->endtime.tv_sec, req->endtime.tv_usec);
-        pthread_mutex_unlock(&output_mutex);
+}
+
+void steal_push(struct request *req) {
+    assign_tickets(req);
+
+    struct worker_deque *dq = &workers[steal_home_worker(req)].deque;
+    pthread_mutex_lock(&dq->lock);
+    if (dq->count == dq->capacity && !deque_grow(dq)) {
+        pthread_mutex_unlock(&dq->lock);
+        fprintf(stderr, "Memory error while queueing request %d.\n", req->request_id);
+        return;
     }
+    dq->items[(dq->head + dq->count) % dq->capacity] = req;
+    dq->count++;
+    dq->pushes++;
+    dq->depth_sum += dq->count;
+    if (dq->count > dq->max_depth) dq->max_depth = dq->count;
+    pthread_mutex_unlock(&dq->lock);
 
-    // 5. Release Locks in Sorted Order
-    for (int i = req->num_trans - 1; i >= 0; i--) { 
-        pthread_mutex_unlock(&account_locks[sorted_ids[i] - 1]);
+    __atomic_add_fetch(&steal_events, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&steal_idle, __ATOMIC_SEQ_CST) > 0) {
+        futex_wake(&steal_events, 1);
     }
-    
-    // Free dynamically allocated memory
-    if (sorted_ids) free(sorted_ids);
-    if (original_balances) free(original_balances);
-    if (all_ids) free(all_ids);
 }
 
+// Own deque first (oldest first), then the newest request of another worker
+struct request *steal_try(struct worker *self) {
+    struct request *req = deque_pop_head(&self->deque);
+    if (req != NULL) return req;
 
-// --- Worker Thread Routine ---
+    for (int i = 1; i < NUM_WORKERS; i++) {
+        struct worker *victim = &workers[(self->id + i) % NUM_WORKERS];
+        if (__atomic_load_n(&victim->deque.count, __ATOMIC_RELAXED) == 0) continue;
+        req = deque_pop_tail(&victim->deque);
+        if (req != NULL) {
+            self->steals++;
+            return req;
+        }
+    }
+    return NULL;
+}
 
-void *worker_thread(void *arg) {
-    // FIX 5: Comment out the unused parameter 'arg' to clear the warning
-    // (void *arg) is the signature required by pthreads, but we ignore the parameter itself
+struct request *steal_dequeue(struct worker *self) {
     struct request *req;
+    int spins = 0;
 
-    while (1) {
-        req = dequeue_request(); 
-        
-        if (req == NULL && request_queue.end_flag == 1) {
-            pthread_cond_broadcast(&queue_cond); 
-            break;
-        } 
-        
-        if (req != NULL) {
-            if (req->request_type == 'C') {
-                process_check(req);
-            } else if (req->request_type == 'T') {
-                process_transaction(req);
-            }
-            
-            if (req->request_type == 'T' && req->transactions != NULL) {
-                free(req->transactions);
-            }
-            free(req); 
+    while ((req = steal_try(self)) == NULL) {
+        if (request_queue.end_flag) {
+            return steal_try(self);
+        }
+        if (spins++ < STEAL_SPIN_TRIES) {
+            sched_yield();
+            continue;
+        }
+
+        uint32_t seen = __atomic_load_n(&steal_events, __ATOMIC_SEQ_CST);
+        __atomic_add_fetch(&steal_idle, 1, __ATOMIC_SEQ_CST);
+
+        // Re-check after announcing ourselves idle so a racing push is not missed
+        req = steal_try(self);
+        if (req != NULL || request_queue.end_flag) {
+            __atomic_sub_fetch(&steal_idle, 1, __ATOMIC_SEQ_CST);
+            return req;
         }
+        futex_wait(&steal_events, seen);
+        __atomic_sub_fetch(&steal_idle, 1, __ATOMIC_SEQ_CST);
     }
-    return NULL;
+    return req;
 }
 
+void acquire_ticket(int id, unsigned ticket) {
+    uint32_t serving = __atomic_load_n(&account_now_serving[id - 1], __ATOMIC_ACQUIRE);
+    if (serving == ticket) return;
 
-// --- Main Function (Producer) ---
-// FIX 3: Corrected the main function signature
-int main(int argc, char **argv) {
-    if (argc != 4) {
-        fprintf(stderr, "Usage: ./appserver <# of worker threads> <# of accounts> <output file>\n");
-        return 1;
+    uint64_t start = monotonic_ns();
+    do {
+        futex_wait(&account_now_serving[id - 1], serving);
+    } while ((serving = __atomic_load_n(&account_now_serving[id - 1], __ATOMIC_ACQUIRE)) != ticket);
+    phase_lock_ns += monotonic_ns() - start;
+}
+
+// Hand the account to whoever holds ticket + 1
+void release_ticket(int id, unsigned ticket) {
+    __atomic_store_n(&account_now_serving[id - 1], ticket + 1, __ATOMIC_RELEASE);
+    futex_wake(&account_now_serving[id - 1], INT32_MAX);
+}
+
+void report_worker_stats() {
+    fprintf(stderr, "%8s %10s %8s %10s %10s\n", "worker", "processed", "steals", "avg depth", "max depth");
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        struct worker_deque *dq = &workers[i].deque;
+        fprintf(stderr, "%8d %10ld %8ld %10.1f %10lu\n", i, workers[i].processed, workers[i].steals,
+                dq->pushes ? (double)dq->depth_sum / dq->pushes : 0.0, dq->max_depth);
     }
+}
 
-    // 1. Parse Arguments
-    NUM_WORKERS = atoi(argv[1]);
-    NUM_ACCOUNTS = atoi(argv[2]);
-    char *output_filename = argv[3];
 
-    if (NUM_ACCOUNTS > MAX_ACCOUNTS) {
-        fprintf(stderr, "Error: Max accounts supported is %d\n", MAX_ACCOUNTS);
-        return 1;
+// --- Partitioned Execution (EXEC_PARTITION) ---
+// Worker i owns accounts [i * shard_size + 1, (i + 1) * shard_size] and is the
+// only thread that touches them, so single-shard requests need no locks.
+// A multi-shard TRANS is queued to every owner involved; since the single
+// producer queues it to all of them in arrival order, the owners meet it in a
+// consistent order and the last one to arrive runs it while the rest wait.
+
+int shard_of(int acc_id) {
+    return (acc_id - 1) / shard_size;
+}
+
+void partition_push(struct request *req) {
+    int owners[MAX_TOKENS];
+    int num_owners = 0;
+
+    if (req->request_type == 'C') {
+        owners[num_owners++] = shard_of(req->check_acc_id);
+    } else if (req->request_type == 'T') {
+        for (int i = 0; i < req->num_trans; i++) {
+            int owner = shard_of(req->transactions[i].acc_id);
+            int j;
+            for (j = 0; j < num_owners; j++) {
+                if (owners[j] == owner) break;
+            }
+            if (j == num_owners) owners[num_owners++] = owner;
+        }
+    } else {
+        owners[num_owners++] = 0;
     }
 
-    // 2. Initialization
-    if (initialize_accounts(NUM_ACCOUNTS) == 0) {
-        fprintf(stderr, "Error: Failed to initialize bank accounts.\n");
+    if (num_owners > 1) multi_shard_requests++;
+    else single_shard_requests++;
+
+    req->shard_arrivals = num_owners;
+    req->shard_refs = num_owners;
+    req->shard_done = 0;
+    for (int i = 0; i < num_owners; i++) {
+        ring_push(workers[owners[i]].inbox, req);
+    }
+}
+
+// Returns 1 when the caller dropped the last reference and should free req
+int process_partitioned(struct request *req) {
+    if (req->request_type == 'C') {
+        process_check(req);
         return 1;
     }
-    
-    // Open the global output file pointer
-    // FIX 2: output_file is declared globally and opened here
-    output_file = fopen(output_filename, "w");
-    if (output_file == NULL) {
-        perror("Error opening output file");
+    if (req->request_type == 'Q') {
+        process_stats(req);
+        return 1;
+    }
+    if (req->request_type != 'T') {
+        return 1;
+    }
+    if (req->shard_refs == 1) {
+        report_transaction(req, apply_transaction(req));
+        return 1;
+    }
+
+    if (__atomic_sub_fetch(&req->shard_arrivals, 1, __ATOMIC_ACQ_REL) == 0) {
+        // Every other owner is parked below, so all involved shards are ours
+        int insufficient_acc_id = apply_transaction(req);
+        __atomic_store_n(&req->shard_done, 1, __ATOMIC_RELEASE);
+        futex_wake(&req->shard_done, INT32_MAX);
+        report_transaction(req, insufficient_acc_id);
+    } else {
+        while (__atomic_load_n(&req->shard_done, __ATOMIC_ACQUIRE) == 0) {
+            futex_wait(&req->shard_done, 0);
+        }
+    }
+    return __atomic_sub_fetch(&req->shard_refs, 1, __ATOMIC_ACQ_REL) == 0;
+}
+
+
+// --- Batch Commit (EXEC_BATCH) ---
+// A worker drains up to batch_size requests, reads every distinct account of
+// the batch once, replays the requests in arrival order against the in-memory
+// balances (so each TRANS sees the effect of the ones before it, exactly as if
+// run serially), and finally writes each changed account once.
+//
+// Accounts are claimed with the QUEUE_STEAL arrival tickets. A batch is a
+// contiguous run of the FIFO, so for each account its requests hold a
+// contiguous ticket range: the batch waits for the first ticket and releases
+// past the last. Conflicting batches therefore commit in arrival order.
+
+// Blocks for the first request, then waits at most batch_wait_ms for more.
+// The timed wait drops queue_mutex, so only one worker may be filling at a
+// time; otherwise two batches could interleave and break ticket contiguity.
+int dequeue_batch(struct request **batch) {
+    int n = 0;
+    struct timespec deadline;
+
+    lock_queue();
+    while (batch_filling || (request_queue.num_jobs == 0 && request_queue.end_flag == 0)) {
+        pthread_cond_wait(&queue_cond, &queue_mutex);
+    }
+    batch_filling = 1;
+
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_nsec += batch_wait_ms * 1000000L;
+    deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+    deadline.tv_nsec %= 1000000000L;
+
+    while (n < batch_size) {
+        if (request_queue.num_jobs > 0) {
+            batch[n++] = queue_pop();
+            continue;
+        }
+        if (request_queue.end_flag || n == 0) break;
+        if (pthread_cond_timedwait(&queue_cond, &queue_mutex, &deadline) == ETIMEDOUT && request_queue.num_jobs == 0) break;
+    }
+    batch_filling = 0;
+    pthread_cond_broadcast(&queue_cond);
+    pthread_mutex_unlock(&queue_mutex);
+    return n;
+}
+
+int trans_comparator(const void *a, const void *b) {
+    const struct trans *x = (const struct trans *)a, *y = (const struct trans *)b;
+    if (x->acc_id != y->acc_id) return x->acc_id < y->acc_id ? -1 : 1;
+    return (x->ticket > y->ticket) - (x->ticket < y->ticket);
+}
+
+// Entry for id in the sorted self->batch_accts[0..count)
+struct batch_account *batch_lookup(struct worker *self, int count, int id) {
+    int lo = 0, hi = count - 1;
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (self->batch_accts[mid].acc_id < id) lo = mid + 1;
+        else hi = mid;
+    }
+    return &self->batch_accts[lo];
+}
+
+void process_batch(struct worker *self, int n) {
+    struct request **batch = self->batch;
+    int count = 0;
+
+    // 1. Collect every (account, ticket) of the batch and group by account
+    for (int r = 0; r < n; r++) {
+        struct request *req = batch[r];
+        if (req->request_type == 'C') {
+            self->batch_refs[count].acc_id = req->check_acc_id;
+            self->batch_refs[count++].ticket = req->check_ticket;
+        } else if (req->request_type == 'T') {
+            for (int i = 0; i < req->num_trans; i++) {
+                if (is_repeat_account(req, i)) continue;
+                self->batch_refs[count++] = req->transactions[i];
+            }
+        }
+    }
+    qsort(self->batch_refs, count, sizeof(struct trans), trans_comparator);
+    int distinct = 0;
+    for (int i = 0; i < count; i++) {
+        struct batch_account *acct = &self->batch_accts[distinct];
+        if (distinct > 0 && acct[-1].acc_id == self->batch_refs[i].acc_id) {
+            acct[-1].last_ticket = self->batch_refs[i].ticket;
+            continue;
+        }
+        acct->acc_id = self->batch_refs[i].acc_id;
+        acct->first_ticket = acct->last_ticket = self->batch_refs[i].ticket;
+        acct->dirty = 0;
+        distinct++;
+    }
+
+    // 2. Claim every account and read it once (ASYNC_IO_GROUP at a time with
+    //    --async-io)
+    int ids[ASYNC_IO_GROUP], values[ASYNC_IO_GROUP];
+    for (int done = 0; done < distinct; done += ASYNC_IO_GROUP) {
+        struct batch_account *accts = &self->batch_accts[done];
+        int count = distinct - done < ASYNC_IO_GROUP ? distinct - done : ASYNC_IO_GROUP;
+        for (int i = 0; i < count; i++) {
+            acquire_ticket(accts[i].acc_id, accts[i].first_ticket);
+            ids[i] = accts[i].acc_id;
+        }
+        bank_read_many(ids, values, count);
+        for (int i = 0; i < count; i++) accts[i].value = values[i];
+    }
+    self->batch_reads += distinct;
+
+    // 3. Replay the requests in arrival order against the in-memory balances
+    for (int r = 0; r < n; r++) {
+        struct request *req = batch[r];
+        if (req->request_type == 'C') {
+            req->num_trans = batch_lookup(self, distinct, req->check_acc_id)->value;
+            self->unbatched_calls += 1;
+            wal_note_read(req);
+            continue;
+        }
+        if (req->request_type != 'T') continue;
+
+        req->check_acc_id = -1;     // reused as the ISF account, -1 for OK
+        for (int i = 0; i < req->num_trans; i++) {
+            if (batch_lookup(self, distinct, req->transactions[i].acc_id)->value + req->transactions[i].amount < 0) {
+                req->check_acc_id = req->transactions[i].acc_id;
+                self->unbatched_calls += i + 1;
+                break;
+            }
+        }
+        if (req->check_acc_id != -1) {
+            wal_note_read(req);
+            continue;
+        }
+
+        wal_append(req);
+        for (int i = 0; i < req->num_trans; i++) {
+            if (is_overwritten_account(req, i)) continue;
+            struct batch_account *acct = batch_lookup(self, distinct, req->transactions[i].acc_id);
+            acct->value += req->transactions[i].amount;    // still the balance before this TRANS
+            acct->dirty = 1;
+        }
+        self->unbatched_calls += 2 * req->num_trans;
+    }
+
+    // 4. Write each changed account once, handing it to the next batch as
+    //    soon as its final balance is stored (with --async-io, once the
+    //    writes of its group are)
+    for (int done = 0; done < distinct; done += ASYNC_IO_GROUP) {
+        struct batch_account *accts = &self->batch_accts[done];
+        int count = distinct - done < ASYNC_IO_GROUP ? distinct - done : ASYNC_IO_GROUP;
+        if (async_io_threads) {
+            int dirty = 0;
+            for (int i = 0; i < count; i++) {
+                if (!accts[i].dirty) continue;
+                ids[dirty] = accts[i].acc_id;
+                values[dirty++] = accts[i].value;
+            }
+            bank_write_many(ids, values, dirty);
+            self->batch_writes += dirty;
+            for (int i = 0; i < count; i++) release_ticket(accts[i].acc_id, accts[i].last_ticket);
+            continue;
+        }
+        for (int i = 0; i < count; i++) {
+            if (accts[i].dirty) {
+                bank_write(accts[i].acc_id, accts[i].value);
+                self->batch_writes++;
+            }
+            release_ticket(accts[i].acc_id, accts[i].last_ticket);
+        }
+    }
+
+    // 5. Report every request of the batch
+    for (int r = 0; r < n; r++) {
+        struct request *req = batch[r];
+        if (req->request_type == 'C') {
+            wal_wait(req);
+            emit_result(req, "BAL %d", req->num_trans);
+        } else if (req->request_type == 'T') {
+            report_transaction(req, req->check_acc_id);
+        } else if (req->request_type == 'Q') {
+            process_stats(req);
+        }
+    }
+    self->batches++;
+}
+
+void batch_worker_loop(struct worker *self) {
+    int n;
+    while ((n = dequeue_batch(self->batch)) > 0) {
+        latency_start();
+        process_batch(self, n);
+        for (int r = 0; r < n; r++) {
+            request_free(self->batch[r]);
+        }
+        self->processed += n;
+    }
+}
+
+void report_batch_stats() {
+    long batches = 0, processed = 0, reads = 0, writes = 0, unbatched = 0;
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        batches += workers[i].batches;
+        processed += workers[i].processed;
+        reads += workers[i].batch_reads;
+        writes += workers[i].batch_writes;
+        unbatched += workers[i].unbatched_calls;
+    }
+    fprintf(stderr, "Batch: %ld requests in %ld batches (avg %.1f), %ld reads + %ld writes = %ld Bank calls (%ld unbatched)\n",
+            processed, batches, batches ? (double)processed / batches : 0.0,
+            reads, writes, reads + writes, unbatched);
+}
+
+
+// --- Deterministic Execution (EXEC_ORDERED) ---
+// The producer links every request behind the latest earlier request that
+// touches any of the same accounts, and queues it only once all of those have
+// finished. Conflicting requests therefore run one at a time in arrival order,
+// unrelated ones run in parallel, and each OK, ISF and BAL is exactly what a
+// serial run would produce. A worker only ever takes a request whose accounts
+// nobody else can touch, so it holds no lock during its Bank.c calls and never
+// waits behind another request. A TRANS hands each account on as soon as
+// its final value is written, so chains of transfers through a hot account
+// overlap. All graph state is guarded by queue_mutex; at most order_window
+// requests are in the graph at once.
+
+// Distinct accounts of req
+int request_accounts(struct request *req, int *ids) {
+    if (req->request_type == 'C') {
+        ids[0] = req->check_acc_id;
+        return 1;
+    }
+    int n = 0;
+    for (int i = 0; i < req->num_trans; i++) {
+        if (!is_repeat_account(req, i)) ids[n++] = req->transactions[i].acc_id;
+    }
+    return n;
+}
+
+// The caller holds queue_mutex
+void order_make_ready(struct request *req) {
+    queue_push(req);
+    pthread_cond_signal(&queue_cond);
+}
+
+// Index of account id in request_accounts(req)
+int order_slot(struct request *req, int id) {
+    int ids[MAX_TRANS];
+    int n = request_accounts(req, ids);
+    for (int k = 0; k < n; k++) {
+        if (ids[k] == id) return k;
+    }
+    return -1;
+}
+
+// Producer only. Each account links req behind its latest request, which
+// gets at most one successor per account.
+void order_admit(struct request *req) {
+    int ids[MAX_TRANS];
+    int n = request_accounts(req, ids);
+
+    lock_queue();
+    if (order_in_flight >= order_window) {
+        order_window_waits++;
+        while (order_in_flight >= order_window) {
+            pthread_cond_wait(&order_window_cond, &queue_mutex);
+        }
+    }
+    order_in_flight++;
+    order_admitted++;
+    req->order_pending = 0;
+    req->order_released = 0;
+    for (int i = 0; i < n; i++) {
+        req->order_next[i] = NULL;
+        struct request *prev = account_last[ids[i] - 1];
+        if (prev != NULL) {
+            prev->order_next[order_slot(prev, ids[i])] = req;
+            req->order_pending++;
+        }
+        account_last[ids[i] - 1] = req;
+    }
+    if (req->order_pending > 0) {
+        order_dependent++;
+    } else {
+        order_make_ready(req);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// Hand account slot k of req to the next request on it. The caller holds
+// queue_mutex.
+void order_hand_on(struct request *req, int k, int id) {
+    req->order_released |= 1u << k;
+    if (account_last[id - 1] == req) account_last[id - 1] = NULL;
+    struct request *next = req->order_next[k];
+    if (next != NULL && --next->order_pending == 0) order_make_ready(next);
+}
+
+// Called after each Bank.c write of a TRANS: once transactions[i] is the last
+// write to its account, the next request on that account may start, even
+// though this TRANS still has other accounts to write.
+void order_written(struct request *req, int i) {
+    if (exec_mode != EXEC_ORDERED) return;
+    int id = req->transactions[i].acc_id;
+    for (int j = i + 1; j < req->num_trans; j++) {
+        if (req->transactions[j].acc_id == id) return;
+    }
+    lock_queue();
+    order_hand_on(req, order_slot(req, id), id);
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+// req has done its Bank.c calls: hand on every account it still holds
+void order_finish(struct request *req) {
+    int ids[MAX_TRANS];
+    int n = request_accounts(req, ids);
+
+    lock_queue();
+    for (int k = 0; k < n; k++) {
+        if (!(req->order_released & (1u << k))) order_hand_on(req, k, ids[k]);
+    }
+    order_in_flight--;
+    pthread_cond_signal(&order_window_cond);
+    if (order_in_flight == 0 && request_queue.end_flag) {
+        pthread_cond_broadcast(&queue_cond);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+}
+
+void process_ordered(struct request *req) {
+    if (req->request_type == 'C') {
+        int balance = bank_read(req->check_acc_id);
+        wal_note_read(req);
+        order_finish(req);
+        wal_wait(req);
+        emit_result(req, "BAL %d", balance);
+    } else if (req->request_type == 'T') {
+        int insufficient_acc_id = apply_transaction(req);
+        order_finish(req);
+        report_transaction(req, insufficient_acc_id);
+    } else {
+        order_finish(req);
+        if (req->request_type == 'Q') process_stats(req);
+    }
+}
+
+void report_order_stats() {
+    fprintf(stderr, "Ordered: %ld requests, %ld (%.1f%%) queued behind an earlier request, input waited for the window %ld times\n",
+            order_admitted, order_dependent, order_admitted ? 100.0 * order_dependent / order_admitted : 0.0,
+            order_window_waits);
+}
+
+
+// --- Request Pool ---
+// Requests are carved from REQUEST_POOL_SLAB-sized slabs and recycled instead
+// of freed. Workers push finished requests onto request_pool_returned (a
+// lock-free stack); the producer, the only thread that allocates, takes the
+// whole stack with one exchange when its private freelist runs dry. Since the
+// stack is only ever emptied as a whole there is no ABA problem. Once enough
+// requests are in circulation, serving a request allocates nothing.
+
+struct request *request_alloc() {
+    if (request_freelist == NULL) {
+        request_freelist = __atomic_exchange_n(&request_pool_returned, NULL, __ATOMIC_ACQUIRE);
+    }
+    if (request_freelist == NULL) {
+        struct request_slab *slab = (struct request_slab *)malloc(sizeof(struct request_slab));
+        if (slab == NULL) return NULL;
+        __atomic_add_fetch(&request_path_allocs, 1, __ATOMIC_RELAXED);
+        request_slab_count++;
+        slab->next = request_slabs;
+        request_slabs = slab;
+        for (int i = 0; i < REQUEST_POOL_SLAB - 1; i++) {
+            slab->requests[i].next = &slab->requests[i + 1];
+        }
+        slab->requests[REQUEST_POOL_SLAB - 1].next = NULL;
+        request_freelist = &slab->requests[0];
+    }
+
+    struct request *req = request_freelist;
+    request_freelist = req->next;
+    return req;
+}
+
+void request_free(struct request *req) {
+    struct request *head = __atomic_load_n(&request_pool_returned, __ATOMIC_RELAXED);
+    do {
+        req->next = head;
+    } while (!__atomic_compare_exchange_n(&request_pool_returned, &head, req, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+void report_request_pool() {
+    fprintf(stderr, "Allocations: %ld while serving %ld requests (%ld pool slabs of %d requests)\n",
+            request_path_allocs, requests_parsed, request_slab_count, REQUEST_POOL_SLAB);
+}
+
+void free_request_pool() {
+    while (request_slabs != NULL) {
+        struct request_slab *next = request_slabs->next;
+        free(request_slabs);
+        request_slabs = next;
+    }
+}
+
+
+// --- Request Input (Main Thread Helper) ---
+// Text lines and binary frames both decode into a struct proto_frame
+// (protocol.c), which is then copied into a pooled request.
+
+// Every account a CHECK or TRANS names must be 1..NUM_ACCOUNTS: the lock
+// table, the cache and Bank.c index by it without checking again
+int frame_accounts_valid(const struct proto_frame *frame) {
+    if (frame->type == 'C') {
+        return frame->values[0] >= 1 && frame->values[0] <= NUM_ACCOUNTS;
+    }
+    if (frame->type == 'T') {
+        for (int i = 0; i < frame->count; i++) {
+            if (frame->values[2 * i] < 1 || frame->values[2 * i] > NUM_ACCOUNTS) return 0;
+        }
+    }
+    return 1;
+}
+
+// Returns 1 with *frame filled, -1 for a line that was skipped, 0 at end of input
+int read_input_frame(struct proto_frame *frame) {
+    if (input_format == INPUT_BINARY) {
+        int status = proto_read_frame(input_reader, frame);
+        if (status < 0) {
+            fprintf(stderr, "Error: Corrupt binary input after request %d; stopping.\n",
+                    request_queue.next_request_id - 1);
+            return 0;
+        }
+        if (status > 0 && frame->type == 'S' && snapshot_path == NULL) {
+            fprintf(stderr, "Error: SNAPSHOT needs --snapshot=PATH; skipped.\n");
+            return -1;
+        }
+        if (status > 0 && !frame_accounts_valid(frame)) {
+            fprintf(stderr, "Error: Request names an account outside 1..%d; skipped.\n", NUM_ACCOUNTS);
+            return -1;
+        }
+        return status;
+    }
+
+    char *line;
+    if (!proto_read_line(input_reader, &line)) return 0;
+    int status = proto_parse_text(line, frame);
+    if (status < 0) {
+        char *cursor = line;
+        int command_len;
+        char *command = proto_next_token(&cursor, &command_len);
+        fprintf(stderr, "Error: Invalid command format for '%.*s'.\n", command_len, command);
+    }
+    if (status > 0 && frame->type == 'S' && snapshot_path == NULL) {
+        fprintf(stderr, "Error: SNAPSHOT needs --snapshot=PATH; skipped.\n");
+        return -1;
+    }
+    if (status > 0 && !frame_accounts_valid(frame)) {
+        fprintf(stderr, "Error: Request names an account outside 1..%d; skipped.\n", NUM_ACCOUNTS);
+        return -1;
+    }
+    return status > 0 ? 1 : -1;
+}
+
+struct request *request_from_frame(const struct proto_frame *frame, int current_id) {
+    struct request *req = request_alloc();
+    if (req == NULL) { fprintf(stderr, "Memory error during parsing.\n"); return NULL; }
+    memset(req, 0, offsetof(struct request, transactions));
+    req->request_id = current_id;
+    req->request_type = frame->type;
+
+    if (frame->type == 'C') {
+        req->check_acc_id = frame->values[0];
+    } else if (frame->type == 'T') {
+        req->num_trans = frame->count;
+        for (int i = 0; i < frame->count; i++) {
+            req->transactions[i].acc_id = frame->values[2 * i];
+            req->transactions[i].amount = frame->values[2 * i + 1];
+        }
+    }
+
+    if (frame->priority >= 0) {
+        req->prio_class = frame->priority;
+    } else if (frame->type == 'C' || frame->type == 'Q') {
+        req->prio_class = PRIO_HIGH;
+    } else if (frame->type == 'T' && frame->count <= SMALL_TRANS_ACCOUNTS) {
+        req->prio_class = PRIO_NORMAL;
+    } else {
+        req->prio_class = PRIO_LOW;
+    }
+    int deadline_ms = frame->deadline_ms;
+    if (deadline_ms == 0 && frame->type != 'E') deadline_ms = prio_deadline_ms[req->prio_class];
+    if (deadline_ms > 0) {
+        req->deadline_ns = monotonic_ns() + (uint64_t)deadline_ms * 1000000ULL;
+        deadline_requests++;
+    }
+
+    requests_parsed++;
+    return req;
+}
+
+
+// Input loop for stdin or --input-file; returns at END or end of input
+void run_input_loop() {
+    struct proto_frame frame;
+    int status;
+    while (request_queue.end_flag == 0 && (status = read_input_frame(&frame)) != 0) {
+        if (status < 0) continue;
+        struct request *req = request_from_frame(&frame, request_queue.next_request_id);
+        
+        if (req != NULL) {
+            gettimeofday(&req->starttime, NULL); 
+            req->arrival_ns = monotonic_ns();
+            
+            if (req->request_type == 'E') {
+                lock_queue();
+                request_queue.end_flag = 1;
+                pthread_mutex_unlock(&queue_mutex);
+                enqueue_request(req); 
+                break;
+            } else {
+                enqueue_request(req);
+                printf("< ID %d\n", req->request_id);
+                request_queue.next_request_id++;
+            }
+        }
+    }
+}
+
+
+// --- Network Listener (--listen) ---
+// The main thread runs one epoll loop over the listening sockets, every client
+// connection, an eventfd the workers poke when results are ready, and a
+// signalfd for SIGINT/SIGTERM. A client may pipeline any number of requests;
+// each one is acknowledged with "< ID n" as it is queued, and its result line
+// is sent back on the same connection instead of to the output file.
+//
+// Workers only append to conn->out under conn->mutex and put the connection
+// on net_dirty; all socket I/O happens on the event loop thread.
+
+int net_listen(const char *spec) {
+    int fd;
+    if (strncmp(spec, "tcp:", 4) == 0) {
+        struct sockaddr_in addr;
+        int one = 1;
+        int port = atoi(spec + 4);
+        if (port <= 0 || port > 65535) { errno = EINVAL; return -1; }
+        fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(port);
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    } else if (strncmp(spec, "unix:", 5) == 0) {
+        struct sockaddr_un addr;
+        const char *path = spec + 5;
+        if (path[0] == '\0' || strlen(path) >= sizeof(addr.sun_path)) { errno = EINVAL; return -1; }
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) return -1;
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        strcpy(addr.sun_path, path);
+        unlink(path);       // socket left behind by an earlier run
+        if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    if (listen(fd, SOMAXCONN) < 0) { close(fd); return -1; }
+    return fd;
+}
+
+int net_watch(struct net_source *src, unsigned events) {
+    struct epoll_event ev;
+    ev.events = events;
+    ev.data.ptr = src;
+    return epoll_ctl(net_epoll_fd, EPOLL_CTL_ADD, src->fd, &ev);
+}
+
+// Open every --listen socket and block SIGINT/SIGTERM so they arrive through
+// the signalfd. Must run before any thread is created.
+int net_start() {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &mask, NULL);
+
+    net_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    net_wakeup.fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    net_signal.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (net_epoll_fd < 0 || net_wakeup.fd < 0 || net_signal.fd < 0 ||
+        net_watch(&net_wakeup, EPOLLIN) < 0 || net_watch(&net_signal, EPOLLIN) < 0) {
+        perror("Error setting up the event loop");
+        return 0;
+    }
+    for (int i = 0; i < num_listeners; i++) {
+        net_listeners[i].kind = NET_LISTENER;
+        net_listeners[i].fd = net_listen(listen_specs[i]);
+        if (net_listeners[i].fd < 0 || net_watch(&net_listeners[i], EPOLLIN) < 0) {
+            fprintf(stderr, "Error: Cannot listen on %s: %s\n", listen_specs[i], strerror(errno));
+            return 0;
+        }
+        fprintf(stderr, "Listening on %s\n", listen_specs[i]);
+    }
+    return 1;
+}
+
+// Caller holds conn->mutex. Output for a client that is gone is dropped.
+void conn_append(struct connection *conn, const char *text, size_t len) {
+    if (conn->source.fd < 0) return;
+    if (conn->out_len + len > conn->out_cap) {
+        size_t cap = conn->out_cap ? conn->out_cap * 2 : 4096;
+        while (cap < conn->out_len + len) cap *= 2;
+        char *out = (char *)realloc(conn->out, cap);
+        if (out == NULL) { fprintf(stderr, "Memory error: dropping a reply.\n"); return; }
+        __atomic_add_fetch(&request_path_allocs, 1, __ATOMIC_RELAXED);
+        conn->out = out;
+        conn->out_cap = cap;
+    }
+    memcpy(conn->out + conn->out_len, text, len);
+    conn->out_len += len;
+}
+
+// Called by workers from emit_result()
+void conn_send_result(struct connection *conn, const char *line, int len) {
+    int wake = 0;
+    pthread_mutex_lock(&conn->mutex);
+    conn_append(conn, line, len);
+    conn->inflight--;
+    if (!conn->dirty) {
+        conn->dirty = 1;
+        pthread_mutex_lock(&net_dirty_mutex);
+        wake = net_dirty == NULL;
+        conn->dirty_next = net_dirty;
+        net_dirty = conn;
+        pthread_mutex_unlock(&net_dirty_mutex);
+    }
+    pthread_mutex_unlock(&conn->mutex);
+
+    // Only the first connection on an empty list needs to wake the loop
+    if (wake) {
+        uint64_t one = 1;
+        if (write(net_wakeup.fd, &one, sizeof(one)) < 0) {
+            // counter saturated: the loop has a wakeup pending anyway
+        }
+    }
+}
+
+// Caller holds conn->mutex: stop all I/O, the client is gone
+void conn_fail(struct connection *conn) {
+    if (conn->source.fd >= 0) {
+        epoll_ctl(net_epoll_fd, EPOLL_CTL_DEL, conn->source.fd, NULL);
+        close(conn->source.fd);
+        conn->source.fd = -1;
+    }
+    conn->out_len = 0;
+    conn->reading = 0;
+}
+
+// Caller holds conn->mutex: send as much of conn->out as the socket takes
+void conn_send(struct connection *conn) {
+    size_t sent = 0;
+    while (conn->source.fd >= 0 && sent < conn->out_len) {
+        ssize_t n = send(conn->source.fd, conn->out + sent, conn->out_len - sent, MSG_NOSIGNAL);
+        net_sends++;
+        if (n > 0) { sent += n; continue; }
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        conn_fail(conn);
+    }
+    if (conn->source.fd >= 0 && sent > 0) {
+        memmove(conn->out, conn->out + sent, conn->out_len - sent);
+        conn->out_len -= sent;
+    }
+}
+
+// Caller holds conn->mutex. Read while the client is not too far behind on
+// its replies; wait for EPOLLOUT while replies are pending.
+void conn_update_events(struct connection *conn) {
+    unsigned events = 0;
+    if (conn->source.fd < 0) return;
+    if (conn->reading && conn->out_len < CONN_OUTPUT_HIGH) events |= EPOLLIN;
+    if (conn->out_len > 0) events |= EPOLLOUT;
+    if (events != conn->events) {
+        struct epoll_event ev;
+        ev.events = events;
+        ev.data.ptr = &conn->source;
+        epoll_ctl(net_epoll_fd, EPOLL_CTL_MOD, conn->source.fd, &ev);
+        conn->events = events;
+    }
+}
+
+// Unlink a finished connection. It is freed after the current epoll batch,
+// which may still hold events for it.
+void conn_close(struct connection *conn) {
+    pthread_mutex_lock(&conn->mutex);
+    conn_fail(conn);
+    pthread_mutex_unlock(&conn->mutex);
+    if (conn->prev) conn->prev->next = conn->next;
+    else net_connections = conn->next;
+    if (conn->next) conn->next->prev = conn->prev;
+    conn->closed = 1;
+    conn->next = net_closed;
+    net_closed = conn;
+}
+
+void net_free_closed() {
+    while (net_closed != NULL) {
+        struct connection *conn = net_closed;
+        net_closed = conn->next;
+        pthread_mutex_destroy(&conn->mutex);
+        free(conn->out);
+        free(conn);
+    }
+}
+
+// Send what is pending; close once the client is done and fully answered
+void conn_flush(struct connection *conn) {
+    pthread_mutex_lock(&conn->mutex);
+    conn_send(conn);
+    conn_update_events(conn);
+    int done = !conn->reading && conn->inflight == 0 && conn->out_len == 0 && !conn->dirty;
+    pthread_mutex_unlock(&conn->mutex);
+    if (done) conn_close(conn);
+}
+
+void conn_reply(struct connection *conn, const char *text) {
+    pthread_mutex_lock(&conn->mutex);
+    conn_append(conn, text, strlen(text));
+    pthread_mutex_unlock(&conn->mutex);
+}
+
+// Acknowledge and queue one request. The ack is appended before the request
+// is queued so it always precedes the result on the wire.
+void conn_submit(struct connection *conn, const struct proto_frame *frame) {
+    struct request *req = request_from_frame(frame, request_queue.next_request_id);
+    if (req == NULL) return;
+    req->conn = conn;
+    gettimeofday(&req->starttime, NULL);
+    req->arrival_ns = monotonic_ns();
+
+    char ack[32];
+    int len = snprintf(ack, sizeof(ack), "< ID %d\n", req->request_id);
+    pthread_mutex_lock(&conn->mutex);
+    conn_append(conn, ack, len);
+    conn->inflight++;
+    pthread_mutex_unlock(&conn->mutex);
+
+    request_queue.next_request_id++;
+    net_requests++;
+    enqueue_request(req);
+}
+
+// Queue every complete request in conn->in and keep a partial one for later.
+// END stops reading; the connection closes once every reply is sent.
+void conn_parse(struct connection *conn) {
+    struct proto_frame frame;
+    size_t used = 0;
+
+    while (conn->reading) {
+        char *start = conn->in + used;
+        size_t avail = conn->in_len - used;
+
+        if (input_format == INPUT_BINARY) {
+            if (!conn->magic_seen) {
+                if (avail < PROTO_MAGIC_LEN) break;
+                if (memcmp(start, PROTO_MAGIC, PROTO_MAGIC_LEN) != 0) {
+                    conn_reply(conn, "ERR not a binary request stream\n");
+                    conn->reading = 0;
+                    break;
+                }
+                conn->magic_seen = 1;
+                used += PROTO_MAGIC_LEN;
+                continue;
+            }
+            int n = proto_decode((unsigned char *)start, avail, &frame);
+            if (n == 0) break;
+            if (n < 0) {
+                conn_reply(conn, "ERR corrupt frame\n");
+                conn->reading = 0;
+                break;
+            }
+            used += n;
+        } else {
+            char *eol = (char *)memchr(start, '\n', avail);
+            if (eol == NULL) {
+                if (avail >= PROTO_MAX_LINE) {
+                    conn_reply(conn, "ERR line too long\n");
+                    conn->reading = 0;
+                }
+                break;
+            }
+            *eol = '\0';
+            used += eol - start + 1;
+            int status = proto_parse_text(start, &frame);
+            if (status == 0) continue;
+            if (status < 0) { conn_reply(conn, "ERR invalid request\n"); continue; }
+        }
+
+        // END only ends this client's input; the server runs until SIGINT/SIGTERM
+        if (frame.type == 'E') {
+            conn->reading = 0;
+            break;
+        }
+        if (frame.type == 'S' && snapshot_path == NULL) {
+            conn_reply(conn, "ERR SNAPSHOT needs --snapshot=PATH\n");
+            continue;
+        }
+        if (!frame_accounts_valid(&frame)) {
+            conn_reply(conn, "ERR account out of range\n");
+            continue;
+        }
+        conn_submit(conn, &frame);
+    }
+    memmove(conn->in, conn->in + used, conn->in_len - used);
+    conn->in_len -= used;
+}
+
+void conn_read(struct connection *conn) {
+    ssize_t n = read(conn->source.fd, conn->in + conn->in_len, CONN_INPUT_SIZE - conn->in_len);
+    net_reads++;
+    if (n > 0) {
+        conn->in_len += n;
+        conn_parse(conn);
+    } else if (n == 0) {
+        conn->reading = 0;
+    } else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        pthread_mutex_lock(&conn->mutex);
+        conn_fail(conn);
+        pthread_mutex_unlock(&conn->mutex);
+    }
+}
+
+void net_accept(struct net_source *listener) {
+    for (;;) {
+        int fd = accept4(listener->fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) continue;
+            if (errno != EAGAIN && errno != EWOULDBLOCK) perror("accept");
+            return;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // fails harmlessly on Unix sockets
+
+        struct connection *conn = (struct connection *)malloc(sizeof(struct connection));
+        if (conn == NULL) { close(fd); continue; }
+        conn->source.kind = NET_CONNECTION;
+        conn->source.fd = fd;
+        pthread_mutex_init(&conn->mutex, NULL);
+        conn->out = NULL;
+        conn->out_len = conn->out_cap = 0;
+        conn->inflight = conn->dirty = 0;
+        conn->dirty_next = NULL;
+        conn->events = EPOLLIN;
+        conn->reading = 1;
+        conn->magic_seen = 0;
+        conn->closed = 0;
+        conn->in_len = 0;
+        if (net_watch(&conn->source, EPOLLIN) < 0) {
+            close(fd);
+            free(conn);
+            continue;
+        }
+        conn->prev = NULL;
+        conn->next = net_connections;
+        if (net_connections) net_connections->prev = conn;
+        net_connections = conn;
+        net_accepted++;
+    }
+}
+
+// Send the replies workers have produced since the last wakeup
+void net_flush_dirty() {
+    uint64_t count;
+    if (read(net_wakeup.fd, &count, sizeof(count)) > 0) net_wakeups++;
+
+    pthread_mutex_lock(&net_dirty_mutex);
+    struct connection *list = net_dirty;
+    net_dirty = NULL;
+    pthread_mutex_unlock(&net_dirty_mutex);
+
+    while (list != NULL) {
+        struct connection *conn = list;
+        pthread_mutex_lock(&conn->mutex);
+        list = conn->dirty_next;
+        conn->dirty = 0;
+        pthread_mutex_unlock(&conn->mutex);
+        conn_flush(conn);
+    }
+}
+
+// Input loop for --listen; returns on SIGINT or SIGTERM
+void run_listener() {
+    struct epoll_event events[NET_MAX_EVENTS];
+
+    while (!net_stop) {
+        int n = epoll_wait(net_epoll_fd, events, NET_MAX_EVENTS, -1);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("epoll_wait");
+            break;
+        }
+        for (int i = 0; i < n; i++) {
+            struct net_source *src = (struct net_source *)events[i].data.ptr;
+            if (src->kind == NET_LISTENER) {
+                net_accept(src);
+            } else if (src->kind == NET_WAKEUP) {
+                net_flush_dirty();
+            } else if (src->kind == NET_SIGNAL) {
+                net_stop = 1;
+            } else {
+                struct connection *conn = (struct connection *)src;
+                if (conn->closed) continue;
+                if (events[i].events & EPOLLIN) conn_read(conn);
+                if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    pthread_mutex_lock(&conn->mutex);
+                    conn_fail(conn);
+                    pthread_mutex_unlock(&conn->mutex);
+                }
+                conn_flush(conn);
+            }
+        }
+        net_free_closed();
+    }
+}
+
+// Called once every worker has exited: every reply has been produced, so send
+// what is left (giving each client up to a second) and close everything.
+void net_shutdown() {
+    struct timeval timeout = {1, 0};
+
+    for (int i = 0; i < num_listeners; i++) {
+        if (net_listeners[i].fd < 0) continue;
+        close(net_listeners[i].fd);
+        if (strncmp(listen_specs[i], "unix:", 5) == 0) unlink(listen_specs[i] + 5);
+    }
+    while (net_connections != NULL) {
+        struct connection *conn = net_connections;
+        pthread_mutex_lock(&conn->mutex);
+        if (conn->source.fd >= 0) {
+            fcntl(conn->source.fd, F_SETFL, fcntl(conn->source.fd, F_GETFL) & ~O_NONBLOCK);
+            setsockopt(conn->source.fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+            conn_send(conn);
+        }
+        pthread_mutex_unlock(&conn->mutex);
+        conn_close(conn);
+    }
+    net_free_closed();
+    close(net_wakeup.fd);
+    close(net_signal.fd);
+    close(net_epoll_fd);
+
+    fprintf(stderr, "Network: %ld connections, %ld requests, %ld reads, %ld sends (%.2f syscalls per request), %ld worker wakeups\n",
+            net_accepted, net_requests, net_reads, net_sends,
+            net_requests ? (double)(net_reads + net_sends) / net_requests : 0.0, net_wakeups);
+}
+
+
+// --- Write-Back Account Cache ---
+// bank_read() and bank_write() stand in for read_account() and write_account().
+// The caller must own the account exactly as it would for a direct Bank.c
+// call. Entries are never evicted: once loaded, an account is only read from
+// memory, so a flusher store can never race with a Bank.c read of the same
+// account.
+
+// Bank.c calls made for a request; their time is its Bank-I/O phase
+int timed_read_account(int id) {
+    if (current_coro != NULL) {
+        int value;
+        bank_read_many(&id, &value, 1);     // suspends instead of sleeping
+        return value;
+    }
+    uint64_t start = monotonic_ns();
+    int value = read_account(id);
+    phase_bank_ns += monotonic_ns() - start;
+    return value;
+}
+
+void timed_write_account(int id, int value) {
+    if (current_coro != NULL) {
+        bank_write_many(&id, &value, 1);
+        return;
+    }
+    uint64_t start = monotonic_ns();
+    write_account(id, value);
+    phase_bank_ns += monotonic_ns() - start;
+}
+
+int bank_read(int id) {
+    if (cache_mode == CACHE_OFF) return timed_read_account(id);
+
+    if (cache_state[id - 1] & CACHE_VALID) {
+        __atomic_add_fetch(&cache_hits, 1, __ATOMIC_RELAXED);
+        return cache_values[id - 1];
+    }
+    __atomic_add_fetch(&cache_misses, 1, __ATOMIC_RELAXED);
+    cache_values[id - 1] = timed_read_account(id);
+    __atomic_store_n(&cache_state[id - 1], CACHE_VALID, __ATOMIC_RELEASE);
+    return cache_values[id - 1];
+}
+
+void bank_write(int id, int value) {
+    if (cache_mode == CACHE_OFF) {
+        timed_write_account(id, value);
+        return;
+    }
+
+    __atomic_add_fetch(&cache_writes, 1, __ATOMIC_RELAXED);
+    cache_values[id - 1] = value;
+    if (cache_mode == CACHE_STRICT) {
+        timed_write_account(id, value);
+        __atomic_store_n(&cache_state[id - 1], CACHE_VALID, __ATOMIC_RELAXED);
+    } else {
+        __atomic_store_n(&cache_state[id - 1], CACHE_VALID | CACHE_DIRTY, __ATOMIC_RELEASE);
+    }
+}
+
+// Several Bank.c calls of one request at once. With --async-io they go to
+// the I/O threads together and the request waits for the slowest instead of
+// the sum; otherwise (or through the cache) they are made one by one. A
+// coroutine always goes through the I/O threads and suspends meanwhile. The
+// caller owns every account and ids[] holds no account twice.
+void bank_io_many(const int *ids, int *values, int n, int write) {
+    if (current_coro == NULL && (async_io_threads == 0 || cache_mode != CACHE_OFF || n < 2)) {
+        for (int i = 0; i < n; i++) {
+            if (write) bank_write(ids[i], values[i]);
+            else values[i] = bank_read(ids[i]);
+        }
+        return;
+    }
+
+    struct bank_io ios[ASYNC_IO_GROUP];
+    struct bank_io_group group;
+    for (int done = 0; done < n; done += ASYNC_IO_GROUP) {
+        int count = n - done < ASYNC_IO_GROUP ? n - done : ASYNC_IO_GROUP;
+        for (int i = 0; i < count; i++) {
+            ios[i].id = ids[done + i];
+            ios[i].value = write ? values[done + i] : 0;
+            ios[i].write = write;
+        }
+        uint64_t start = monotonic_ns();
+        if (current_coro != NULL) {
+            group.wake = &workers[worker_slot].coro_events;
+            bank_async_submit(&group, ios, count);
+            coro_wait_io(&group);
+        } else {
+            group.wake = NULL;
+            bank_async_submit(&group, ios, count);
+            bank_async_wait(&group);
+        }
+        phase_bank_ns += monotonic_ns() - start;
+        if (!write) {
+            for (int i = 0; i < count; i++) values[done + i] = ios[i].value;
+        }
+    }
+}
+
+void bank_read_many(const int *ids, int *values, int n) {
+    bank_io_many(ids, values, n, 0);
+}
+
+void bank_write_many(const int *ids, const int *values, int n) {
+    bank_io_many(ids, (int *)values, n, 1);
+}
+
+void report_async_io() {
+    struct bank_async_stats stats;
+    bank_async_get_stats(&stats);
+    fprintf(stderr, "Async I/O: %d threads, %ld Bank.c calls in %ld groups (%.1f per group), at most %d in flight\n",
+            async_io_threads, stats.calls, stats.groups,
+            stats.groups ? (double)stats.calls / stats.groups : 0.0, stats.max_in_flight);
+}
+
+// Store every dirty entry. The value is copied and the dirty bit cleared
+// under the account lock, but the slow Bank.c write happens after unlocking
+// so workers are not held up; a newer write just marks the entry dirty again.
+// Only the flusher thread (or main, once it has been joined) calls this.
+void cache_flush_pass() {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    for (int i = 0; i < NUM_ACCOUNTS; i++) {
+        if (!(__atomic_load_n(&cache_state[i], __ATOMIC_ACQUIRE) & CACHE_DIRTY)) continue;
+
+        lock_account(i + 1);
+        int value = cache_values[i];
+        int dirty = cache_state[i] & CACHE_DIRTY;
+        cache_state[i] &= ~CACHE_DIRTY;
+        pthread_mutex_unlock(account_lock(i + 1));
+
+        if (dirty) {
+            write_account(i + 1, value);
+            flush_writes++;
+        }
+    }
+
+    gettimeofday(&end, NULL);
+    flush_seconds += (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    flush_passes++;
+}
+
+void *flush_thread_routine(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&flush_mutex);
+    while (!flush_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += flush_interval_ms * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&flush_cond, &flush_mutex, &deadline);
+        if (flush_stop) break;
+
+        pthread_mutex_unlock(&flush_mutex);
+        cache_flush_pass();
+        pthread_mutex_lock(&flush_mutex);
+    }
+    pthread_mutex_unlock(&flush_mutex);
+    return NULL;
+}
+
+// Called on END once every worker has exited: stop the flusher and store
+// whatever is still dirty.
+void cache_shutdown() {
+    if (cache_mode == CACHE_WRITEBACK) {
+        pthread_mutex_lock(&flush_mutex);
+        flush_stop = 1;
+        pthread_cond_signal(&flush_cond);
+        pthread_mutex_unlock(&flush_mutex);
+        pthread_join(flush_thread, NULL);
+        cache_flush_pass();
+    }
+
+    long lookups = cache_hits + cache_misses;
+    fprintf(stderr, "Cache (%s): %ld hits, %ld misses (%.1f%% hit rate), %ld writes\n",
+            cache_mode == CACHE_STRICT ? "strict" : "writeback",
+            cache_hits, cache_misses, lookups ? 100.0 * cache_hits / lookups : 0.0, cache_writes);
+    if (cache_mode == CACHE_WRITEBACK) {
+        fprintf(stderr, "Flush: %ld accounts stored in %ld passes (%.1f%% of writes absorbed), %.0f stores/s\n",
+                flush_writes, flush_passes,
+                cache_writes ? 100.0 * (cache_writes - flush_writes) / cache_writes : 0.0,
+                flush_seconds > 0 ? flush_writes / flush_seconds : 0.0);
+    }
+}
+
+
+// --- Seqlock CHECK Path (CHECK_SEQLOCK) ---
+// A TRANS makes the sequence number of every account it writes odd for the
+// duration of its writes. A CHECK samples the number, reads the balance
+// without any lock, and keeps the value only if the number is unchanged and
+// even; CHECKs never block each other and only wait while a write is in
+// flight. After SEQLOCK_MAX_RETRIES failed attempts it takes the mutex.
+
+// Unlocked balance read: never fills the cache, so it needs no ownership
+int bank_peek(int id) {
+    if (cache_mode != CACHE_OFF && (__atomic_load_n(&cache_state[id - 1], __ATOMIC_ACQUIRE) & CACHE_VALID)) {
+        return cache_values[id - 1];
+    }
+    return timed_read_account(id);
+}
+
+// The caller owns every account of req
+void seq_write_begin(struct request *req) {
+    if (account_seq == NULL) return;
+    for (int i = 0; i < req->num_trans; i++) {
+        if (is_repeat_account(req, i)) continue;
+        uint32_t *seq = &account_seq[req->transactions[i].acc_id - 1];
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    }
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void seq_write_end(struct request *req) {
+    if (account_seq == NULL) return;
+    for (int i = 0; i < req->num_trans; i++) {
+        if (is_repeat_account(req, i)) continue;
+        uint32_t *seq = &account_seq[req->transactions[i].acc_id - 1];
+        __atomic_store_n(seq, *seq + 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&seq_parked, __ATOMIC_SEQ_CST) > 0) {
+            futex_wake(seq, INT32_MAX);
+        }
+    }
+}
+
+int seqlock_read(int id) {
+    uint32_t *seq = &account_seq[id - 1];
+    int balance;
+
+    __atomic_add_fetch(&seqlock_reads, 1, __ATOMIC_RELAXED);
+    for (int attempt = 0; attempt < SEQLOCK_MAX_RETRIES; ) {
+        uint32_t start = __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+        if (start & 1) {
+            // A TRANS is writing this account: sleep until it is done
+            __atomic_add_fetch(&seqlock_parks, 1, __ATOMIC_RELAXED);
+            __atomic_add_fetch(&seq_parked, 1, __ATOMIC_SEQ_CST);
+            futex_wait(seq, start);
+            __atomic_sub_fetch(&seq_parked, 1, __ATOMIC_SEQ_CST);
+            continue;
+        }
+
+        balance = bank_peek(id);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) == start) return balance;
+
+        __atomic_add_fetch(&seqlock_retries, 1, __ATOMIC_RELAXED);
+        attempt++;
+    }
+
+    // Writers keep winning: fall back to the account lock
+    __atomic_add_fetch(&seqlock_fallbacks, 1, __ATOMIC_RELAXED);
+    lock_account(id);
+    balance = bank_read(id);
+    pthread_mutex_unlock(account_lock(id));
+    return balance;
+}
+
+void report_seqlock_stats() {
+    fprintf(stderr, "Seqlock CHECK: %ld reads, %ld retries, %ld waits for a writer, %ld fell back to the lock\n",
+            seqlock_reads, seqlock_retries, seqlock_parks, seqlock_fallbacks);
+}
+
+
+// --- MVCC CHECK Path (CHECK_MVCC) ---
+// Every TRANS commits the new balances of all its accounts to mvcc.c under
+// one timestamp, after its Bank.c writes and before it lets the accounts go.
+// A CHECK reads the newest committed version from memory: it takes no lock,
+// never waits for a TRANS in flight, and makes no Bank.c call. A TRANS that
+// is still writing is simply not visible yet, so no CHECK sees part of it.
+
+// The caller owns every account of req and has written them all
+void mvcc_publish(struct request *req, const int *original_balances) {
+    if (check_mode != CHECK_MVCC) return;
+    int ids[MAX_TRANS], values[MAX_TRANS];
+    for (int i = 0; i < req->num_trans; i++) {
+        ids[i] = req->transactions[i].acc_id;
+        values[i] = original_balances[i] + req->transactions[i].amount;
+    }
+    if (mvcc_commit(account_versions, worker_slot, ids, values, req->num_trans) == 0) {
+        fprintf(stderr, "Error: Failed to allocate account versions.\n");
+        exit(1);
+    }
+}
+
+void report_mvcc_stats() {
+    struct mvcc_stats stats;
+    mvcc_get_stats(account_versions, &stats);
+    fprintf(stderr, "MVCC CHECK: %ld lock-free reads; %ld versions committed, %ld reclaimed, %ld allocated, longest chain %d\n",
+            mvcc_reads, stats.installed, stats.reclaimed, stats.heap_versions, stats.max_chain);
+}
+
+
+// --- io_uring I/O (--io=uring) ---
+// Input: URING_INPUT_BLOCKS registered blocks of INPUT_BLOCK_SIZE are read
+// ahead of the parser. A file gets every free block queued at its own offset;
+// a pipe gets one read at a time, since its reads cannot be positioned.
+// Refills are queued as blocks are used up and go to the kernel together the
+// next time the parser has to wait.
+//
+// Output: the writer copies result lines into one of two registered staging
+// buffers and submits a buffer when it is full or when the writer is about to
+// go idle, so one submission covers many writev() passes under load.
+
+struct uring_input {
+    struct uring *ring;
+    int fd, seekable;
+    char *blocks[URING_INPUT_BLOCKS];
+    int ready[URING_INPUT_BLOCKS];      // bytes in the block, or -1 while queued
+    uint64_t queued, consumed;          // block sequence numbers; slot = seq % URING_INPUT_BLOCKS
+    int in_flight;
+    size_t used;                        // bytes of block `consumed` already handed out
+    int eof;                            // a read hit the end: queue nothing more
+    long preads;                        // short reads completed synchronously
+} uring_in;
+
+struct uring_output {
+    struct uring *ring;
+    int fd, seekable;
+    int64_t offset;                     // file position of the next staged byte
+    char *stage[URING_OUTPUT_STAGES];
+    size_t fill[URING_OUTPUT_STAGES];   // bytes staged (or being written)
+    int64_t stage_offset[URING_OUTPUT_STAGES];
+    int busy[URING_OUTPUT_STAGES];      // write in flight
+    int cur;
+    long submissions;
+} uring_out;
+int output_uring;                       // results go through uring_out
+
+char *uring_alloc_buffer(size_t size) {
+    void *p;
+    return posix_memalign(&p, 4096, size) == 0 ? (char *)p : NULL;
+}
+
+int uring_input_open(int fd) {
+    struct iovec iov[URING_INPUT_BLOCKS];
+    for (int i = 0; i < URING_INPUT_BLOCKS; i++) {
+        uring_in.blocks[i] = uring_alloc_buffer(INPUT_BLOCK_SIZE);
+        if (uring_in.blocks[i] == NULL) return 0;
+        iov[i].iov_base = uring_in.blocks[i];
+        iov[i].iov_len = INPUT_BLOCK_SIZE;
+    }
+    uring_in.ring = uring_create(2 * URING_INPUT_BLOCKS, iov, URING_INPUT_BLOCKS);
+    if (uring_in.ring == NULL) {
+        for (int i = 0; i < URING_INPUT_BLOCKS; i++) free(uring_in.blocks[i]);
+        return 0;
+    }
+    uring_in.fd = fd;
+    uring_in.seekable = lseek(fd, 0, SEEK_CUR) >= 0;
+    return 1;
+}
+
+// Record finished reads. A short read from a file is completed with pread()
+// so every block but the last is full and the queued offsets stay right.
+void uring_input_reap() {
+    uint64_t seq;
+    int res;
+    while (uring_complete(uring_in.ring, &seq, &res)) {
+        int slot = seq % URING_INPUT_BLOCKS;
+        uring_in.in_flight--;
+        if (res < 0) {
+            fprintf(stderr, "Error reading input: %s\n", strerror(-res));
+            res = 0;
+        }
+        while (uring_in.seekable && res > 0 && res < INPUT_BLOCK_SIZE) {
+            ssize_t n = pread(uring_in.fd, uring_in.blocks[slot] + res, INPUT_BLOCK_SIZE - res,
+                              (off_t)(seq * INPUT_BLOCK_SIZE + res));
+            uring_in.preads++;
+            if (n <= 0) break;
+            res += n;
+        }
+        if (res < INPUT_BLOCK_SIZE && (res == 0 || uring_in.seekable)) uring_in.eof = 1;
+        uring_in.ready[slot] = res;
+    }
+}
+
+void uring_input_queue() {
+    int max_in_flight = uring_in.seekable ? URING_INPUT_BLOCKS : 1;
+    while (!uring_in.eof && uring_in.queued - uring_in.consumed < URING_INPUT_BLOCKS &&
+           uring_in.in_flight < max_in_flight) {
+        uint64_t seq = uring_in.queued;
+        int slot = seq % URING_INPUT_BLOCKS;
+        int64_t offset = uring_in.seekable ? (int64_t)(seq * INPUT_BLOCK_SIZE) : -1;
+        if (uring_queue_read(uring_in.ring, uring_in.fd, slot, uring_in.blocks[slot],
+                             INPUT_BLOCK_SIZE, offset, seq) < 0) break;
+        uring_in.ready[slot] = -1;
+        uring_in.queued++;
+        uring_in.in_flight++;
+    }
+}
+
+// proto_read_fn for the input reader
+ssize_t uring_input_read(void *ctx, void *buf, size_t len) {
+    (void)ctx;
+    for (;;) {
+        int slot = uring_in.consumed % URING_INPUT_BLOCKS;
+        if (uring_in.consumed < uring_in.queued && uring_in.ready[slot] >= 0) {
+            size_t avail = uring_in.ready[slot] - uring_in.used;
+            if (avail == 0) return 0;       // an empty block is the end of input
+            size_t n = len < avail ? len : avail;
+            memcpy(buf, uring_in.blocks[slot] + uring_in.used, n);
+            uring_in.used += n;
+            if (uring_in.used == (size_t)uring_in.ready[slot]) {
+                uring_in.consumed++;
+                uring_in.used = 0;
+                uring_input_queue();        // goes to the kernel with the next wait
+            }
+            return n;
+        }
+        uring_input_queue();
+        if (uring_in.consumed == uring_in.queued) return 0;
+        if (uring_submit(uring_in.ring, 1) < 0) {
+            perror("io_uring_enter");
+            return -1;
+        }
+        uring_input_reap();
+    }
+}
+
+void uring_input_close() {
+    uring_destroy(uring_in.ring);       // cancels a read still waiting on a pipe
+    for (int i = 0; i < URING_INPUT_BLOCKS; i++) free(uring_in.blocks[i]);
+}
+
+int uring_output_open(int fd) {
+    struct iovec iov[URING_OUTPUT_STAGES];
+    for (int i = 0; i < URING_OUTPUT_STAGES; i++) {
+        uring_out.stage[i] = uring_alloc_buffer(URING_OUTPUT_STAGE_SIZE);
+        if (uring_out.stage[i] == NULL) return 0;
+        iov[i].iov_base = uring_out.stage[i];
+        iov[i].iov_len = URING_OUTPUT_STAGE_SIZE;
+    }
+    uring_out.ring = uring_create(2 * URING_OUTPUT_STAGES, iov, URING_OUTPUT_STAGES);
+    if (uring_out.ring == NULL) {
+        for (int i = 0; i < URING_OUTPUT_STAGES; i++) free(uring_out.stage[i]);
+        return 0;
+    }
+    uring_out.fd = fd;
+    uring_out.offset = lseek(fd, 0, SEEK_CUR);
+    uring_out.seekable = uring_out.offset >= 0;
+    return 1;
+}
+
+// Record finished writes; a short write is finished synchronously
+void uring_output_reap() {
+    uint64_t slot;
+    int res;
+    while (uring_complete(uring_out.ring, &slot, &res)) {
+        size_t done = res > 0 ? (size_t)res : 0;
+        if (res < 0) fprintf(stderr, "Error writing output file: %s\n", strerror(-res));
+        while (res >= 0 && done < uring_out.fill[slot]) {
+            ssize_t n = uring_out.seekable
+                ? pwrite(uring_out.fd, uring_out.stage[slot] + done, uring_out.fill[slot] - done,
+                         (off_t)(uring_out.stage_offset[slot] + done))
+                : write(uring_out.fd, uring_out.stage[slot] + done, uring_out.fill[slot] - done);
+            if (n <= 0) { perror("Error writing output file"); break; }
+            done += n;
+        }
+        uring_out.busy[slot] = 0;
+    }
+}
+
+void uring_output_wait(int slot) {
+    uring_output_reap();
+    while (uring_out.busy[slot]) {
+        if (uring_submit(uring_out.ring, 1) < 0) { perror("io_uring_enter"); return; }
+        uring_output_reap();
+    }
+}
+
+// Write out the current stage and switch to the other one
+void uring_output_submit() {
+    int slot = uring_out.cur;
+    if (uring_out.fill[slot] == 0) return;
+
+    int next = (slot + 1) % URING_OUTPUT_STAGES;
+    if (!uring_out.seekable) uring_output_wait(next);   // keep pipe writes in order
+    uring_out.stage_offset[slot] = uring_out.seekable ? uring_out.offset : -1;
+    uring_queue_write(uring_out.ring, uring_out.fd, slot, uring_out.stage[slot],
+                      uring_out.fill[slot], uring_out.stage_offset[slot], slot);
+    uring_out.offset += uring_out.fill[slot];
+    uring_out.busy[slot] = 1;
+    uring_out.submissions++;
+
+    // Hand the write over and, if the next stage is still being written,
+    // wait for it in the same call
+    uring_output_reap();
+    if (uring_submit(uring_out.ring, uring_out.busy[next] ? 1 : 0) < 0) perror("io_uring_enter");
+    uring_output_wait(next);
+    uring_out.fill[next] = 0;
+    uring_out.cur = next;
+}
+
+void uring_output_stage(struct iovec *iov, int count) {
+    for (int i = 0; i < count; i++) {
+        char *data = (char *)iov[i].iov_base;
+        size_t len = iov[i].iov_len;
+        output_bytes += len;
+        while (len > 0) {
+            int slot = uring_out.cur;
+            size_t room = URING_OUTPUT_STAGE_SIZE - uring_out.fill[slot];
+            size_t n = len < room ? len : room;
+            memcpy(uring_out.stage[slot] + uring_out.fill[slot], data, n);
+            uring_out.fill[slot] += n;
+            data += n;
+            len -= n;
+            if (uring_out.fill[slot] == URING_OUTPUT_STAGE_SIZE) uring_output_submit();
+        }
+    }
+}
+
+// Returns the number of io_uring_enter() calls made for output
+long uring_output_close() {
+    uring_output_submit();
+    for (int i = 0; i < URING_OUTPUT_STAGES; i++) uring_output_wait(i);
+    long enters = uring_enters(uring_out.ring);
+    uring_destroy(uring_out.ring);
+    for (int i = 0; i < URING_OUTPUT_STAGES; i++) free(uring_out.stage[i]);
+    return enters;
+}
+
+// I/O system calls per request, to compare --io=stdio with --io=uring. Call
+// after stop_result_writer() and before the input is closed.
+void report_io_syscalls() {
+    long input_calls = uring_in.ring != NULL ? uring_enters(uring_in.ring) + uring_in.preads
+                                             : proto_reader_reads(input_reader);
+    fprintf(stderr, "I/O syscalls: %ld input (%s), %ld output (%s), %.3f per request\n",
+            input_calls, uring_in.ring != NULL ? "io_uring" : "read",
+            output_writes, output_uring ? "io_uring" : "writev",
+            requests_parsed ? (double)(input_calls + output_writes) / requests_parsed : 0.0);
+}
+
+
+// --- Result Writer ---
+// Workers format their result lines locally into their own output ring; a
+// single writer thread gathers whatever is pending in every ring into one
+// writev() call. No lock is taken on the reporting path.
+//
+// With --ordered-output the writer instead parks complete lines by request ID
+// and writes them out strictly in ID order.
+
+// Format "<id> <result> TIME <start> <end>" and queue it for the writer
+void emit_result(struct request *req, const char *fmt, ...) {
+    struct output_ring *ring = worker_output;
+    char line[OUTPUT_LINE_MAX];
+    va_list args;
+    int len;
+
+    uint64_t output_start = monotonic_ns();
+    gettimeofday(&req->endtime, NULL);
+    len = snprintf(line, sizeof(line), "%d ", req->request_id);
+    va_start(args, fmt);
+    len += vsnprintf(line + len, sizeof(line) - len, fmt, args);
+    va_end(args);
+    len += snprintf(line + len, sizeof(line) - len, " TIME %ld.%06ld %ld.%06ld",
+                    req->starttime.tv_sec, req->starttime.tv_usec,
+                    req->endtime.tv_sec, req->endtime.tv_usec);
+    if (req->deadline_ns != 0) {
+        int late = output_start > req->deadline_ns;
+        if (late) len += snprintf(line + len, sizeof(line) - len, " LATE");
+        __atomic_add_fetch(late ? &deadline_late[req->prio_class] : &deadline_met[req->prio_class], 1, __ATOMIC_RELAXED);
+    }
+    len += snprintf(line + len, sizeof(line) - len, "\n");
+
+    if (req->conn != NULL) {
+        conn_send_result(req->conn, line, len);
+        latency_record(req, output_start);
+        return;
+    }
+
+    unsigned size = (unsigned)len;
+
+    // Ring full: nudge the writer and wait for it to catch up
+    while (ring->head + size - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) > OUTPUT_RING_SIZE) {
+        __atomic_add_fetch(&output_events, 1, __ATOMIC_SEQ_CST);
+        futex_wake(&output_events, 1);
+        sched_yield();
+    }
+
+    unsigned offset = ring->head & (OUTPUT_RING_SIZE - 1);
+    unsigned first = size < OUTPUT_RING_SIZE - offset ? size : OUTPUT_RING_SIZE - offset;
+    memcpy(ring->buf + offset, line, first);
+    memcpy(ring->buf, line + first, size - first);
+    __atomic_store_n(&ring->head, ring->head + size, __ATOMIC_RELEASE);
+    ring->lines++;
+
+    __atomic_add_fetch(&output_events, 1, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&writer_parked, __ATOMIC_SEQ_CST)) {
+        futex_wake(&output_events, 1);
+    }
+    latency_record(req, output_start);
+}
+
+// writev() every byte of iov[0..count), resuming after short writes
+void write_iov(struct iovec *iov, int count) {
+    if (output_uring) {
+        uring_output_stage(iov, count);
+        return;
+    }
+    int fd = fileno(output_file);
+    while (count > 0) {
+        ssize_t n = writev(fd, iov, count < IOV_MAX ? count : IOV_MAX);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            perror("Error writing output file");
+            return;
+        }
+        output_writes++;
+        output_bytes += n;
+        while (count > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+// Lines held back by --ordered-output. Slot (id % pending_capacity) holds the
+// line of request id; the window is doubled when a line arrives too far ahead
+// of next_output_id, so steady state needs no allocation.
+struct pending_line {
+    int id;
+    int len;
+    char text[OUTPUT_LINE_MAX];
+};
+struct pending_line *pending_lines;
+int pending_capacity;               // power of two
+int pending_count;
+int next_output_id = 1;
+struct iovec *writer_iov;           // scratch, sized for every ring or IOV_MAX lines
+uint64_t *writer_heads;             // ring heads seen by the current pass
+
+int grow_pending_lines(int id) {
+    int capacity = pending_capacity ? pending_capacity * 2 : 1024;
+    while (id - next_output_id >= capacity) capacity *= 2;
+
+    struct pending_line *lines = (struct pending_line *)calloc(capacity, sizeof(struct pending_line));
+    if (lines == NULL) return 0;
+    __atomic_add_fetch(&request_path_allocs, 1, __ATOMIC_RELAXED);
+    for (int i = 0; i < pending_capacity; i++) {
+        if (pending_lines[i].id >= next_output_id) {
+            lines[pending_lines[i].id & (capacity - 1)] = pending_lines[i];
+        }
+    }
+    free(pending_lines);
+    pending_lines = lines;
+    pending_capacity = capacity;
+    return 1;
+}
+
+void park_line(char *text, int len) {
+    int id = atoi(text);
+    if (id - next_output_id >= pending_capacity && !grow_pending_lines(id)) {
+        fprintf(stderr, "Memory error while ordering output.\n");
+        return;
+    }
+    struct pending_line *slot = &pending_lines[id & (pending_capacity - 1)];
+    slot->id = id;
+    slot->len = len;
+    memcpy(slot->text, text, len);
+    pending_count++;
+}
+
+// Write the parked lines that continue the ID sequence. With all set (END)
+// gaps are skipped so nothing is left behind.
+void write_parked_lines(int all) {
+    int count = 0;
+
+    while (pending_count > 0) {
+        struct pending_line *slot = &pending_lines[next_output_id & (pending_capacity - 1)];
+        if (slot->id != next_output_id) {
+            if (!all) break;
+            next_output_id++;
+            continue;
+        }
+        writer_iov[count].iov_base = slot->text;
+        writer_iov[count].iov_len = slot->len;
+        next_output_id++;
+        pending_count--;
+        if (++count == IOV_MAX) {
+            write_iov(writer_iov, count);
+            count = 0;
+        }
+    }
+    write_iov(writer_iov, count);
+}
+
+// One pass over every ring. Returns 1 if anything was pending.
+int drain_output_rings() {
+    int count = 0;
+    uint64_t *heads = writer_heads;
+
+    for (int w = 0; w < NUM_WORKERS; w++) {
+        struct output_ring *ring = &workers[w].output;
+        uint64_t tail = ring->tail;
+        heads[w] = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (heads[w] == tail) continue;
+
+        unsigned offset = tail & (OUTPUT_RING_SIZE - 1);
+        unsigned pending = heads[w] - tail;
+        unsigned first = pending < OUTPUT_RING_SIZE - offset ? pending : OUTPUT_RING_SIZE - offset;
+
+        if (!ordered_output) {
+            writer_iov[count].iov_base = ring->buf + offset;
+            writer_iov[count++].iov_len = first;
+            if (pending > first) {
+                writer_iov[count].iov_base = ring->buf;
+                writer_iov[count++].iov_len = pending - first;
+            }
+            continue;
+        }
+
+        // Split the pending bytes into lines (a line may wrap around the ring)
+        char line[OUTPUT_LINE_MAX];
+        int len = 0;
+        for (unsigned i = 0; i < pending; i++) {
+            line[len++] = ring->buf[(tail + i) & (OUTPUT_RING_SIZE - 1)];
+            if (line[len - 1] == '\n') {
+                park_line(line, len);
+                len = 0;
+            }
+        }
+        count++;
+    }
+
+    if (count == 0) return 0;
+    if (ordered_output) {
+        write_parked_lines(0);
+    } else {
+        write_iov(writer_iov, count);
+    }
+    for (int w = 0; w < NUM_WORKERS; w++) {
+        __atomic_store_n(&workers[w].output.tail, heads[w], __ATOMIC_RELEASE);
+    }
+    return 1;
+}
+
+void *writer_thread_routine(void *arg) {
+    (void)arg;
+    for (;;) {
+        uint32_t seen = __atomic_load_n(&output_events, __ATOMIC_SEQ_CST);
+        if (drain_output_rings()) continue;
+        if (output_uring) uring_output_submit();    // going idle: write what is staged
+        if (__atomic_load_n(&output_stop, __ATOMIC_ACQUIRE)) break;
+
+        __atomic_store_n(&writer_parked, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&output_events, __ATOMIC_SEQ_CST) == seen) {
+            futex_wait(&output_events, seen);
+        }
+        __atomic_store_n(&writer_parked, 0, __ATOMIC_SEQ_CST);
+    }
+    if (ordered_output) {
+        write_parked_lines(1);
+    }
+    return NULL;
+}
+
+int start_result_writer() {
+    int iov_slots = 2 * NUM_WORKERS > IOV_MAX ? 2 * NUM_WORKERS : IOV_MAX;
+    writer_iov = (struct iovec *)malloc(iov_slots * sizeof(struct iovec));
+    writer_heads = (uint64_t *)malloc(NUM_WORKERS * sizeof(uint64_t));
+    if (writer_iov == NULL || writer_heads == NULL) return 0;
+    for (int w = 0; w < NUM_WORKERS; w++) {
+        workers[w].output.buf = (char *)malloc(OUTPUT_RING_SIZE);
+        if (workers[w].output.buf == NULL) return 0;
+        workers[w].output.head = workers[w].output.tail = 0;
+        workers[w].output.lines = 0;
+    }
+    pthread_create(&writer_thread, NULL, writer_thread_routine, NULL);
+    return 1;
+}
+
+// Called once every worker has exited: write what is left and stop
+void stop_result_writer() {
+    __atomic_store_n(&output_stop, 1, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&output_events, 1, __ATOMIC_SEQ_CST);
+    futex_wake(&output_events, 1);
+    pthread_join(writer_thread, NULL);
+
+    long lines = 0;
+    for (int w = 0; w < NUM_WORKERS; w++) {
+        lines += workers[w].output.lines;
+        free(workers[w].output.buf);
+    }
+    free(writer_iov);
+    free(writer_heads);
+    free(pending_lines);
+    if (output_uring) {
+        output_writes = uring_output_close();
+        fprintf(stderr, "Output: %ld lines, %ld bytes in %ld io_uring writes, %ld submit calls (%.1f lines per call)%s\n",
+                lines, output_bytes, uring_out.submissions, output_writes,
+                output_writes ? (double)lines / output_writes : 0.0,
+                ordered_output ? ", ordered by request ID" : "");
+    } else {
+        fprintf(stderr, "Output: %ld lines, %ld bytes in %ld writev calls (%.1f lines per call)%s\n",
+                lines, output_bytes, output_writes, output_writes ? (double)lines / output_writes : 0.0,
+                ordered_output ? ", ordered by request ID" : "");
+    }
+}
+
+
+// --- Latency Statistics (STATS) ---
+// Every result records how long its request spent in each phase, in the
+// emitting worker's histograms:
+//   queue   read by the input thread until a worker took it (with
+//           --exec=ordered, also the wait behind earlier requests)
+//   lock    blocked on account locks or arrival tickets
+//   bank    inside Bank.c read_account() / write_account()
+//   output  formatting the line and handing it to the writer or client
+//   total   read until the result was handed over; it also covers WAL
+//           waits, OCC backoff and CPU time, so it exceeds the sum
+// A batch (--exec=batch) charges its lock and Bank.c time to its first
+// result. Each result also counts toward the second it was emitted in.
+
+// Called by a worker when it takes a request, or a batch of them
+void latency_start() {
+    phase_started_ns = monotonic_ns();
+    phase_lock_ns = phase_bank_ns = 0;
+}
+
+void latency_record(struct request *req, uint64_t output_start) {
+    uint64_t now = monotonic_ns();
+    struct worker *self = &workers[worker_slot];
+
+    pthread_mutex_lock(&self->latency_mutex);
+    hist_record(&self->latency[PHASE_QUEUE], phase_started_ns > req->arrival_ns ? phase_started_ns - req->arrival_ns : 0);
+    hist_record(&self->latency[PHASE_LOCK], phase_lock_ns);
+    hist_record(&self->latency[PHASE_BANK], phase_bank_ns);
+    hist_record(&self->latency[PHASE_OUTPUT], now - output_start);
+    hist_record(&self->latency[PHASE_TOTAL], now - req->arrival_ns);
+    hist_record(&self->class_latency[req->prio_class], now - req->arrival_ns);
+    pthread_mutex_unlock(&self->latency_mutex);
+    phase_lock_ns = phase_bank_ns = 0;
+
+    // Smoothed per-class service time for --deadline-miss=drop; races
+    // between workers only lose a sample
+    uint64_t *service = &prio_service_ns[req->prio_class];
+    uint64_t old = __atomic_load_n(service, __ATOMIC_RELAXED), sample = now - phase_started_ns;
+    if (!req->expired) {
+        __atomic_store_n(service, old == 0 ? sample : old - (old >> PRIO_SERVICE_SHIFT) + (sample >> PRIO_SERVICE_SHIFT), __ATOMIC_RELAXED);
+    }
+
+    if (pool_max_workers) {
+        __atomic_add_fetch(&pool_service_ns, now - phase_started_ns, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&pool_served, 1, __ATOMIC_RELAXED);
+    }
+
+    uint64_t second = (now - server_start_ns) / 1000000000ULL;
+    if (second < TIMELINE_SECONDS) {
+        __atomic_add_fetch(&throughput_timeline[second], 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Every worker's histogram of one phase, added up
+void latency_merge(enum latency_phase phase, struct histogram *merged) {
+    memset(merged, 0, sizeof(*merged));
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        pthread_mutex_lock(&workers[i].latency_mutex);
+        hist_merge(merged, &workers[i].latency[phase]);
+        pthread_mutex_unlock(&workers[i].latency_mutex);
+    }
+}
+
+// STATS: results so far, their total latency, and the results emitted in
+// the last whole second
+void process_stats(struct request *req) {
+    struct histogram total;
+    latency_merge(PHASE_TOTAL, &total);
+
+    uint64_t second = (monotonic_ns() - server_start_ns) / 1000000000ULL;
+    uint32_t last_second = 0;
+    if (second > 0 && second <= TIMELINE_SECONDS) {
+        last_second = __atomic_load_n(&throughput_timeline[second - 1], __ATOMIC_RELAXED);
+    }
+    emit_result(req, "STATS %llu done, p50 %.1f p99 %.1f p99.9 %.1f ms, %u/s",
+                (unsigned long long)total.total, hist_percentile(&total, 0.50) / 1e6,
+                hist_percentile(&total, 0.99) / 1e6, hist_percentile(&total, 0.999) / 1e6, last_second);
+}
+
+void report_latency() {
+    static const char *phase_names[NUM_PHASES] = {"queue", "lock", "bank", "output", "total"};
+    struct histogram merged;
+
+    fprintf(stderr, "Latency (ms)  %10s %10s %10s %10s %10s\n", "mean", "p50", "p99", "p99.9", "max");
+    for (int phase = 0; phase < NUM_PHASES; phase++) {
+        latency_merge(phase, &merged);
+        fprintf(stderr, "  %-10s  %10.3f %10.3f %10.3f %10.3f %10.3f\n", phase_names[phase],
+                hist_mean(&merged) / 1e6, hist_percentile(&merged, 0.50) / 1e6,
+                hist_percentile(&merged, 0.99) / 1e6, hist_percentile(&merged, 0.999) / 1e6,
+                merged.max / 1e6);
+    }
+
+    int seconds = 0, peak_second = 0;
+    for (int i = 0; i < TIMELINE_SECONDS; i++) {
+        if (throughput_timeline[i] > 0) seconds = i + 1;
+        if (throughput_timeline[i] > throughput_timeline[peak_second]) peak_second = i;
+    }
+    if (seconds > 0) {
+        fprintf(stderr, "Throughput: %llu results over %d s, peak %u/s (second %d), mean %.0f/s\n",
+                (unsigned long long)merged.total, seconds, throughput_timeline[peak_second], peak_second,
+                (double)merged.total / seconds);
+    }
+
+    if (timeline_path != NULL) {
+        FILE *csv = fopen(timeline_path, "w");
+        if (csv != NULL) {
+            fprintf(csv, "second,results\n");
+            for (int i = 0; i < seconds; i++) {
+                fprintf(csv, "%d,%u\n", i, throughput_timeline[i]);
+            }
+        }
+        if (csv == NULL || fclose(csv) != 0) {
+            perror("Error writing throughput timeline");
+        }
+    }
+}
+
+
+// --- Deadlines (--deadline-miss=drop) ---
+// A worker that takes a request checks whether it can still make its
+// deadline: if now plus the smoothed service time of its class is past the
+// deadline, the request is answered EXPIRED and never touches an account.
+// Returns 1 if req was dropped (the caller still frees it).
+int drop_expired(struct request *req) {
+    if (deadline_miss != MISS_DROP || req->deadline_ns == 0) return 0;
+    uint64_t service = __atomic_load_n(&prio_service_ns[req->prio_class], __ATOMIC_RELAXED);
+    if (monotonic_ns() + service <= req->deadline_ns) return 0;
+
+    if (exec_mode == EXEC_ORDERED) {
+        order_finish(req);
+    }
+    __atomic_add_fetch(&deadline_dropped[req->prio_class], 1, __ATOMIC_RELAXED);
+    req->deadline_ns = 0;
+    req->expired = 1;
+    emit_result(req, "EXPIRED");
+    return 1;
+}
+
+void report_priority() {
+    struct histogram merged;
+
+    if (priority_enabled) {
+        fprintf(stderr, "Priority: weights %d/%d/%d, dequeued %ld high, %ld normal, %ld low\n",
+                prio_weight[PRIO_HIGH], prio_weight[PRIO_NORMAL], prio_weight[PRIO_LOW],
+                prio_dequeued[PRIO_HIGH], prio_dequeued[PRIO_NORMAL], prio_dequeued[PRIO_LOW]);
+    }
+    fprintf(stderr, "Class latency (ms) %8s %9s %9s %9s %9s", "results", "mean", "p50", "p99", "max");
+    if (deadline_requests > 0) {
+        fprintf(stderr, " %8s %8s %8s", "met", "late", "expired");
+    }
+    fprintf(stderr, "\n");
+    for (int c = 0; c < NUM_PRIO; c++) {
+        memset(&merged, 0, sizeof(merged));
+        for (int i = 0; i < NUM_WORKERS; i++) {
+            pthread_mutex_lock(&workers[i].latency_mutex);
+            hist_merge(&merged, &workers[i].class_latency[c]);
+            pthread_mutex_unlock(&workers[i].latency_mutex);
+        }
+        fprintf(stderr, "  %-16s %8llu %9.3f %9.3f %9.3f %9.3f", prio_class_names[c],
+                (unsigned long long)merged.total, hist_mean(&merged) / 1e6,
+                hist_percentile(&merged, 0.50) / 1e6, hist_percentile(&merged, 0.99) / 1e6,
+                merged.max / 1e6);
+        if (deadline_requests > 0) {
+            fprintf(stderr, " %8ld %8ld %8ld", deadline_met[c], deadline_late[c], deadline_dropped[c]);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+
+// --- Write-Ahead Log (--wal) ---
+// Bank.c keeps balances in memory only, so with --wal every applied TRANS
+// also appends its deltas to an in-memory log buffer. The append happens
+// while the worker still owns the accounts, so the log order respects every
+// conflict. A single log writer swaps the buffer out, writes it and calls
+// fdatasync() once for everything appended meanwhile (group commit). The
+// reply to a TRANS waits until its record is on disk. Groups form on their
+// own: while one fdatasync() runs, the next group fills up.
+//
+// A record is a uint32 payload length, a uint32 FNV-1a checksum of the
+// payload, then the payload: int32 request ID, int32 pair count and that many
+// (int32 account, int32 delta) pairs, all in host byte order. Each account
+// appears once per record with the change the TRANS actually made to it (a
+// TRANS that names an account twice keeps only its last write). At startup
+// the deltas are summed and stored directly into the freshly initialized
+// (all zero) accounts before any worker starts. A torn or corrupt tail left
+// by a crash is cut off.
+
+uint32_t wal_checksum(const unsigned char *data, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 16777619u;
+    }
+    return hash;
+}
+
+uint64_t monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec;
+}
+
+// Log the deltas of req. Called while the caller still owns every account of req.
+void wal_append(struct request *req) {
+    if (wal_fd < 0) return;
+
+    uint32_t record[2 + 2 + 2 * MAX_TRANS];
+    int words = 2;
+    record[words++] = (uint32_t)req->request_id;
+    words++;    // pair count, filled in below
+    for (int i = 0; i < req->num_trans; i++) {
+        // The last entry of an account is the one that took effect, and its
+        // amount is that account's net change
+        if (is_overwritten_account(req, i)) continue;
+        record[words++] = (uint32_t)req->transactions[i].acc_id;
+        record[words++] = (uint32_t)req->transactions[i].amount;
+    }
+    record[3] = (uint32_t)(words - 4) / 2;
+    record[0] = (words - 2) * sizeof(uint32_t);
+    record[1] = wal_checksum((const unsigned char *)&record[2], record[0]);
+    size_t size = words * sizeof(uint32_t);
+
+    pthread_mutex_lock(&wal_mutex);
+    if (wal_active.len + size > wal_active.capacity) {
+        size_t capacity = wal_active.capacity * 2;
+        char *data = (char *)realloc(wal_active.data, capacity);
+        if (data == NULL) {
+            fprintf(stderr, "Error: Failed to grow the log buffer.\n");
+            exit(1);
+        }
+        __atomic_add_fetch(&request_path_allocs, 1, __ATOMIC_RELAXED);
+        wal_active.data = data;
+        wal_active.capacity = capacity;
+    }
+    memcpy(wal_active.data + wal_active.len, record, size);
+    wal_active.len += size;
+    req->wal_lsn = ++wal_next_lsn;
+    req->wal_logged = 1;
+    if (!wal_writer_busy) {
+        pthread_cond_signal(&wal_writer_cond);
+    }
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+// An ISF or a CHECK balance may rest on records that are not on disk yet,
+// so its reply waits for everything appended so far.
+void wal_note_read(struct request *req) {
+    if (wal_fd < 0) return;
+    pthread_mutex_lock(&wal_mutex);
+    req->wal_lsn = wal_next_lsn;
+    req->wal_logged = 0;
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+// Block until req's record is durable. The record was appended before the
+// Bank.c writes, so part of the fdatasync() is usually hidden behind them.
+void wal_wait(struct request *req) {
+    if (wal_fd < 0) return;
+    uint64_t start = monotonic_ns();
+    pthread_mutex_lock(&wal_mutex);
+    while (wal_durable_lsn < req->wal_lsn) {
+        pthread_cond_wait(&wal_durable_cond, &wal_mutex);
+    }
+    if (req->wal_logged) {
+        hist_record(&wal_commit_latency, monotonic_ns() - start);
+    }
+    pthread_mutex_unlock(&wal_mutex);
+}
+
+void *wal_writer_routine(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&wal_mutex);
+    while (1) {
+        while (wal_active.len == 0 && !wal_stop) {
+            pthread_cond_wait(&wal_writer_cond, &wal_mutex);
+        }
+        if (wal_active.len == 0) break;
+
+        // Take the whole group; workers keep appending to the other buffer
+        struct wal_buffer group = wal_active;
+        wal_active = wal_flushing;
+        wal_active.len = 0;
+        wal_flushing = group;
+        uint64_t lsn = wal_next_lsn;
+        long records = (long)(lsn - wal_durable_lsn);
+        wal_writer_busy = 1;
+        pthread_mutex_unlock(&wal_mutex);
+
+        for (size_t done = 0; done < group.len; ) {
+            ssize_t n = write(wal_fd, group.data + done, group.len - done);
+            if (n < 0 && errno == EINTR) continue;
+            if (n < 0) {
+                perror("Error writing the log");
+                exit(1);
+            }
+            done += n;
+        }
+        if (fdatasync(wal_fd) != 0) {
+            perror("Error syncing the log");
+            exit(1);
+        }
+
+        pthread_mutex_lock(&wal_mutex);
+        wal_writer_busy = 0;
+        wal_durable_lsn = lsn;
+        wal_fsyncs++;
+        wal_records += records;
+        wal_bytes += group.len;
+        if (records > wal_max_group) wal_max_group = records;
+        pthread_cond_broadcast(&wal_durable_cond);
+    }
+    pthread_mutex_unlock(&wal_mutex);
+    return NULL;
+}
+
+// Open (or create) the log, replay it into the accounts and start the log
+// writer. Call after the account locks and cache are set up and before any
+// worker starts.
+// Returns 0 after printing why the log cannot be used.
+int wal_open(const char *path) {
+    wal_fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (wal_fd < 0) {
+        perror("Error opening the log");
+        return 0;
+    }
+    off_t size = lseek(wal_fd, 0, SEEK_END);
+    unsigned char *log = (unsigned char *)malloc(size > 0 ? size : 1);
+    long *deltas = (long *)calloc(NUM_ACCOUNTS, sizeof(long));
+    if (size < 0 || log == NULL || deltas == NULL) {
+        fprintf(stderr, "Error: Failed to read the log.\n");
+        return 0;
+    }
+    for (off_t done = 0; done < size; ) {
+        ssize_t n = pread(wal_fd, log + done, size - done, done);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            perror("Error reading the log");
+            return 0;
+        }
+        done += n;
+    }
+
+    // Sum every intact record; stop at the first torn or corrupt one
+    off_t valid = 0;
+    long recovered = 0;
+    while (valid + 8 <= size) {
+        uint32_t header[2], payload[2 + 2 * MAX_TRANS];
+        memcpy(header, log + valid, sizeof(header));
+        if (header[0] < 16 || header[0] > sizeof(payload) || header[0] % 8 != 0 ||
+            valid + 8 + (off_t)header[0] > size ||
+            wal_checksum(log + valid + 8, header[0]) != header[1]) break;
+        memcpy(payload, log + valid + 8, header[0]);
+        int pairs = (int)payload[1];
+        if (pairs != (int)(header[0] - 8) / 8) break;
+
+        for (int i = 0; i < pairs; i++) {
+            int id = (int)payload[2 + 2 * i];
+            if (id < 1 || id > NUM_ACCOUNTS) {
+                fprintf(stderr, "Error: %s logs account %d, but there are only %d accounts.\n",
+                        path, id, NUM_ACCOUNTS);
+                return 0;
+            }
+            deltas[id - 1] += (int)payload[3 + 2 * i];
+        }
+        recovered++;
+        valid += 8 + header[0];
+    }
+    if (valid < size && (ftruncate(wal_fd, valid) != 0 || fdatasync(wal_fd) != 0)) {
+        perror("Error truncating the log");
+        return 0;
+    }
+    lseek(wal_fd, valid, SEEK_SET);
+
+    // Every account started at zero, so its balance is the sum of its deltas.
+    // No worker runs yet and the cache holds nothing, so the balances go
+    // straight into Bank.c's array instead of one 10 ms bank_write each.
+    int restored = 0;
+    for (int i = 0; i < NUM_ACCOUNTS; i++) {
+        if (deltas[i] == 0) continue;
+        BANK_accounts[i] = (int)deltas[i];
+        restored++;
+    }
+    free(log);
+    free(deltas);
+    fprintf(stderr, "WAL: recovered %ld transactions from %s, %d accounts restored, %lld torn bytes dropped\n",
+            recovered, path, restored, (long long)(size - valid));
+
+    wal_active.data = (char *)malloc(WAL_BUFFER_SIZE);
+    wal_flushing.data = (char *)malloc(WAL_BUFFER_SIZE);
+    if (wal_active.data == NULL || wal_flushing.data == NULL) {
+        fprintf(stderr, "Error: Failed to allocate the log buffers.\n");
+        return 0;
+    }
+    wal_active.capacity = wal_flushing.capacity = WAL_BUFFER_SIZE;
+    pthread_create(&wal_thread, NULL, wal_writer_routine, NULL);
+    return 1;
+}
+
+// Called once every worker has exited (so nothing is left to append)
+void wal_shutdown() {
+    pthread_mutex_lock(&wal_mutex);
+    wal_stop = 1;
+    pthread_cond_signal(&wal_writer_cond);
+    pthread_mutex_unlock(&wal_mutex);
+    pthread_join(wal_thread, NULL);
+
+    const char *unit;
+    double bytes = display_size((double)wal_bytes, &unit);
+    fprintf(stderr, "WAL: %ld transactions in %ld fsyncs (%.1f per fsync, max %ld), %.1f %s logged\n",
+            wal_records, wal_fsyncs, wal_fsyncs ? (double)wal_records / wal_fsyncs : 0.0,
+            wal_max_group, bytes, unit);
+    if (wal_commit_latency.total > 0) {
+        fprintf(stderr, "Commit latency: p50 %.2f ms, p90 %.2f ms, p99 %.2f ms, max %.2f ms\n",
+                hist_percentile(&wal_commit_latency, 0.50) / 1e6, hist_percentile(&wal_commit_latency, 0.90) / 1e6,
+                hist_percentile(&wal_commit_latency, 0.99) / 1e6, wal_commit_latency.max / 1e6);
+    }
+
+    free(wal_active.data);
+    free(wal_flushing.data);
+    close(wal_fd);
+}
+
+
+// --- Consistent Snapshots (SNAPSHOT) ---
+// SNAPSHOT writes every balance as of a single point in time while TRANS keep
+// running, without locking all accounts. The worker that takes the request
+// opens a new epoch (the cut), then visits the accounts one at a time under
+// their own lock. A TRANS that is about to overwrite an account the snapshot
+// has not visited yet first saves the balance it is replacing, stamped with
+// the epoch (copy on write). The snapshot uses that saved copy when there is
+// one, otherwise the live balance, and stamps the account either way.
+//
+// A TRANS samples the epoch while holding every one of its accounts, so it
+// lands wholly on one side of the cut: if it saw no snapshot, the visits to
+// its accounts all come after it released them; if it saw the epoch, each
+// account was either visited before it took the lock or copied before its
+// write. Only --exec=lock with the list or ring queue has those locks.
+//
+// Balances are taken straight from the cache or the Bank.c array rather than
+// read_account(), so a snapshot costs no 10 ms delays. Only one runs at a time.
+
+// Called by a TRANS that holds all its accounts, just before it writes them
+void snapshot_preserve(struct request *req, const int *original_balances) {
+    uint32_t epoch = __atomic_load_n(&snapshot_epoch, __ATOMIC_SEQ_CST);
+    if (epoch == 0) return;
+
+    for (int i = 0; i < req->num_trans; i++) {
+        int id = req->transactions[i].acc_id;
+        if (account_snap_epoch[id - 1] == epoch) continue;     // visited or already saved
+        snapshot_copy[id - 1] = original_balances[i];
+        account_snap_epoch[id - 1] = epoch;
+        __atomic_add_fetch(&snapshot_copies, 1, __ATOMIC_RELAXED);
+    }
+}
+
+// Current balance without the Bank.c delay. Caller holds the account lock.
+int bank_snapshot_value(int id) {
+    if (cache_mode != CACHE_OFF && (cache_state[id - 1] & CACHE_VALID)) {
+        return cache_values[id - 1];
+    }
+    return BANK_accounts[id - 1];
+}
+
+// Write "BANKSNAP <epoch> <accounts>" then "<id> <balance>" for every nonzero
+// account to a temporary file, sync it and rename it over snapshot_path.
+int snapshot_write(uint32_t epoch) {
+    char tmp_path[PATH_MAX];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", snapshot_path);
+    FILE *out = fopen(tmp_path, "w");
+    if (out == NULL) return 0;
+
+    fprintf(out, "BANKSNAP %u %d\n", epoch, NUM_ACCOUNTS);
+    for (int i = 0; i < NUM_ACCOUNTS; i++) {
+        if (snapshot_values[i] != 0) fprintf(out, "%d %d\n", i + 1, snapshot_values[i]);
+    }
+    int ok = fflush(out) == 0 && fsync(fileno(out)) == 0;
+    ok = fclose(out) == 0 && ok;
+    return ok && rename(tmp_path, snapshot_path) == 0;
+}
+
+void process_snapshot(struct request *req) {
+    struct timeval start, end;
+    gettimeofday(&start, NULL);
+
+    pthread_mutex_lock(&snapshot_mutex);
+    uint32_t epoch = ++snapshot_count;
+    __atomic_store_n(&snapshot_epoch, epoch, __ATOMIC_SEQ_CST);
+
+    for (int id = 1; id <= NUM_ACCOUNTS; id++) {
+        lock_account(id);
+        if (account_snap_epoch[id - 1] == epoch) {
+            snapshot_values[id - 1] = snapshot_copy[id - 1];
+        } else {
+            snapshot_values[id - 1] = bank_snapshot_value(id);
+            account_snap_epoch[id - 1] = epoch;
+        }
+        pthread_mutex_unlock(account_lock(id));
+    }
+    __atomic_store_n(&snapshot_epoch, 0, __ATOMIC_SEQ_CST);
+
+    int ok = snapshot_write(epoch);
+    if (ok && store_mapped) {
+        ok = mmap_accounts_sync(1);     // every Bank.c write so far is on disk too
+    }
+    gettimeofday(&end, NULL);
+    snapshot_seconds += (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+    pthread_mutex_unlock(&snapshot_mutex);
+
+    if (ok) {
+        emit_result(req, "SNAP %u", epoch);
+    } else {
+        fprintf(stderr, "Error writing snapshot %s: %s\n", snapshot_path, strerror(errno));
+        emit_result(req, "SNAP FAILED");
+    }
+}
+
+// --restore: load a SNAPSHOT file into the accounts before any worker starts.
+// Accounts missing from the file are set to 0.
+int snapshot_restore(const char *path) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        perror("Error opening the snapshot");
+        return 0;
+    }
+    unsigned epoch;
+    int accounts, id, balance, restored = 0;
+    if (fscanf(in, "BANKSNAP %u %d", &epoch, &accounts) != 2) {
+        fprintf(stderr, "Error: %s is not a snapshot.\n", path);
+        fclose(in);
+        return 0;
+    }
+    memset(BANK_accounts, 0, NUM_ACCOUNTS * sizeof(int));
+    while (fscanf(in, "%d %d", &id, &balance) == 2) {
+        if (id < 1 || id > NUM_ACCOUNTS) {
+            fprintf(stderr, "Error: %s holds account %d, but there are only %d accounts.\n", path, id, NUM_ACCOUNTS);
+            fclose(in);
+            return 0;
+        }
+        BANK_accounts[id - 1] = balance;
+        restored++;
+    }
+    int complete = feof(in);
+    fclose(in);
+    if (!complete) {
+        fprintf(stderr, "Error: %s is truncated or corrupt.\n", path);
+        return 0;
+    }
+    fprintf(stderr, "Restore: snapshot %u of %s, %d nonzero accounts\n", epoch, path, restored);
+    return 1;
+}
+
+void report_snapshot_stats() {
+    fprintf(stderr, "Snapshots: %u taken (%.1f ms avg), %ld balances copied on write by TRANS\n",
+            snapshot_count, snapshot_count ? 1000.0 * snapshot_seconds / snapshot_count : 0.0, snapshot_copies);
+}
+
+
+// --- Worker Processing Logic ---
+
+void process_check(struct request *req) {
+    int id = req->check_acc_id;
+    
+    int balance;
+    
+    if (exec_mode == EXEC_PARTITION) {
+        balance = bank_read(id);        // only the shard owner gets here
+    } else if (check_mode == CHECK_SEQLOCK) {
+        balance = seqlock_read(id);
+    } else if (check_mode == CHECK_MVCC) {
+        balance = mvcc_read(account_versions, worker_slot, id);
+        __atomic_add_fetch(&mvcc_reads, 1, __ATOMIC_RELAXED);
+    } else if (queue_backend == QUEUE_STEAL) {
+        acquire_ticket(id, req->check_ticket);
+        balance = bank_read(id);
+        release_ticket(id, req->check_ticket);
+    } else if (hot_threshold) {
+        hot_lock(id);
+        balance = hot_read(id);
+        pthread_mutex_unlock(account_lock(id));
+    } else {
+        lock_account(id);
+        balance = bank_read(id);
+        pthread_mutex_unlock(account_lock(id));
+    }
+    wal_note_read(req);
+    
+    // Output
+    wal_wait(req);
+    emit_result(req, "BAL %d", balance);
+}
+
+// Steps 3 and 4 of a TRANS. The caller must already own every account
+// involved (account_locks[], tickets, or shard ownership), and replies with
+// report_transaction() once it has let go of them.
+// Returns the account that lacked funds, or -1 if the TRANS was applied.
+int apply_transaction(struct request *req) {
+    // 3. Atomicity Check (Read & Verify Balances)
+    int insufficient_acc_id = -1;
+    int original_balances[MAX_TRANS];
+
+    // With --async-io every account is read at once, before the checks
+    int ids[MAX_TRANS], values[MAX_TRANS];
+    int n = 0;
+    if (async_io_threads) {
+        for (int i = 0; i < req->num_trans; i++) {
+            if (!is_repeat_account(req, i)) ids[n++] = req->transactions[i].acc_id;
+        }
+        bank_read_many(ids, values, n);
+    }
+    
+    for (int i = 0; i < req->num_trans; i++) {
+        int id = req->transactions[i].acc_id;
+        int amount = req->transactions[i].amount;
+        if (req->hot_deposits & (1u << i)) {
+            original_balances[i] = 0;   // a deposit never fails; its account is not locked
+            continue;
+        }
+        if (async_io_threads) {
+            int k = 0;
+            while (ids[k] != id) k++;
+            original_balances[i] = values[k];
+        } else {
+            original_balances[i] = hot_threshold ? hot_read(id) : bank_read(id); 
+        }
+        
+        // Insufficient Funds Check 
+        if (original_balances[i] + amount < 0) {
+            insufficient_acc_id = id;
+            break; 
+        }
+    }
+    
+    // 4. Execute or Void
+    if (insufficient_acc_id == -1) {
+        install_transaction(req, original_balances);
+    } else {
+        // ISF: state remains original (no writes performed)
+        wal_note_read(req);
+    }
+    return insufficient_acc_id;
+}
+
+// SUCCESS: Log the deltas, then apply all writes. The caller owns every
+// account and has verified original_balances against them.
+void install_transaction(struct request *req, const int *original_balances) {
+    wal_append(req);
+    if (snapshot_path != NULL) snapshot_preserve(req, original_balances);
+    seq_write_begin(req);
+    if (async_io_threads) {
+        // All writes at once; a repeated account gets only its last write,
+        // which is the one the loop below would leave behind
+        int ids[MAX_TRANS], values[MAX_TRANS];
+        int n = 0;
+        for (int i = 0; i < req->num_trans; i++) {
+            int j = i + 1;
+            while (j < req->num_trans && req->transactions[j].acc_id != req->transactions[i].acc_id) j++;
+            if (j < req->num_trans) continue;
+            ids[n] = req->transactions[i].acc_id;
+            values[n++] = original_balances[i] + req->transactions[i].amount;
+        }
+        bank_write_many(ids, values, n);
+        for (int i = 0; i < req->num_trans; i++) order_written(req, i);
+    } else {
+        for (int i = 0; i < req->num_trans; i++) {
+            int id = req->transactions[i].acc_id;
+            int amount = req->transactions[i].amount;
+            if (req->hot_deposits & (1u << i)) {
+                hot_deposit(id, amount);
+            } else {
+                bank_write(id, original_balances[i] + amount); 
+                if (hot_threshold) hot_merged(id);
+            }
+            order_written(req, i);
+        }
+    }
+    seq_write_end(req);
+    mvcc_publish(req, original_balances);
+}
+
+// Step 6 of a TRANS, after every account has been released. With --wal the
+// reply waits until the log record is on disk.
+void report_transaction(struct request *req, int insufficient_acc_id) {
+    wal_wait(req);
+    if (insufficient_acc_id == -1) {
+        emit_result(req, "OK");
+    } else {
+        emit_result(req, "ISF %d", insufficient_acc_id);
+    }
+}
+
+void process_transaction(struct request *req) {
+    if (hot_threshold) {
+        process_transaction_hot(req);
+        return;
+    }
+
+    // 1. Prepare for Deadlock Prevention: Collect and Sort Lock Stripes
+    // CRITICAL STEP: the sorted order is the consistent lock acquisition order.
+    int sorted_ids[MAX_TRANS];
+    sort_stripes(req, sorted_ids);
+
+    // 2. Acquire Locks in Sorted Order (Deadlock Prevention)
+    // QUEUE_STEAL uses arrival tickets instead: a request only ever waits for
+    // older requests, so any acquisition order is deadlock free.
+    if (queue_backend == QUEUE_STEAL) {
+        for (int i = 0; i < req->num_trans; i++) {
+            if (is_repeat_account(req, i)) continue;
+            acquire_ticket(req->transactions[i].acc_id, req->transactions[i].ticket);
+        }
+    } else {
+        lock_stripes(sorted_ids, req->num_trans);
+    }
+    
+    // 3-4. Read, verify and apply while holding every lock
+    int insufficient_acc_id = apply_transaction(req);
+
+    // 5. Release Locks in Sorted Order
+    if (queue_backend == QUEUE_STEAL) {
+        for (int i = 0; i < req->num_trans; i++) {
+            if (is_repeat_account(req, i)) continue;
+            release_ticket(req->transactions[i].acc_id, req->transactions[i].ticket);
+        }
+    } else {
+        unlock_stripes(sorted_ids, req->num_trans);
+    }
+
+    // 6. Output, outside the locks so a commit wait holds nobody up
+    report_transaction(req, insufficient_acc_id);
+}
+
+
+// --- Hot-Account Delta Slots (--hot) ---
+// Every lock attempt that finds an account's stripe held counts against the
+// account. Once an account reaches hot_threshold it is promoted: from then on
+// a TRANS deposits into it without taking its lock, by adding the amount to
+// its own worker's slot. Deposits cannot fail the ISF check, so only a
+// withdrawal or a CHECK needs the real balance: under the account lock it
+// reads the stored balance plus whatever the slots gained since the last
+// merge. A withdrawal then stores the sum, which is the merge; reads leave the
+// slots alone. Slot totals only grow, so a merge records how much of them the
+// stored balance includes instead of resetting them under the depositors.
+// Accounts are never demoted; hot_finish() merges what is left at END.
+
+int hot_index(int id) {
+    return __atomic_load_n(&account_hot[id - 1], __ATOMIC_ACQUIRE) - 1;
+}
+
+void hot_promote(int id) {
+    pthread_mutex_lock(&hot_mutex);
+    if (account_hot[id - 1] == 0 && num_hot_accounts < MAX_HOT_ACCOUNTS) {
+        struct hot_account *hot = &hot_accounts[num_hot_accounts];
+        hot->slots = (struct hot_slot *)aligned_alloc(CACHE_LINE, NUM_WORKERS * sizeof(struct hot_slot));
+        if (hot->slots != NULL) {
+            memset(hot->slots, 0, NUM_WORKERS * sizeof(struct hot_slot));
+            hot->acc_id = id;
+            hot->merged = hot->seen = hot->deposits = hot->merges = 0;
+            num_hot_accounts++;
+            __atomic_store_n(&account_hot[id - 1], num_hot_accounts, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&hot_mutex);
+}
+
+// Lock the stripe of id, counting the attempt against id if it has to wait
+void hot_lock(int id) {
+    if (!lock_account(id)) return;
+    uint32_t count = __atomic_add_fetch(&account_contention[id - 1], 1, __ATOMIC_RELAXED);
+    if (count == (uint32_t)hot_threshold) hot_promote(id);
+}
+
+long hot_total(struct hot_account *hot) {
+    long total = 0;
+    for (int w = 0; w < NUM_WORKERS; w++) {
+        total += __atomic_load_n(&hot->slots[w].deposited, __ATOMIC_ACQUIRE);
+    }
+    return total;
+}
+
+// bank_read() plus unmerged deposits. The caller holds the account lock.
+int hot_read(int id) {
+    int balance = bank_read(id);
+    int k = hot_index(id);
+    if (k >= 0) {
+        struct hot_account *hot = &hot_accounts[k];
+        hot->seen = hot_total(hot);
+        balance += (int)(hot->seen - hot->merged);
+    }
+    return balance;
+}
+
+// The balance read by hot_read() has just been stored
+void hot_merged(int id) {
+    int k = hot_index(id);
+    if (k < 0) return;
+    struct hot_account *hot = &hot_accounts[k];
+    if (hot->seen != hot->merged) {
+        hot->merged = hot->seen;
+        hot->merges++;
+    }
+}
+
+void hot_deposit(int id, int amount) {
+    struct hot_account *hot = &hot_accounts[hot_index(id)];
+    __atomic_add_fetch(&hot->slots[worker_slot].deposited, amount, __ATOMIC_RELEASE);
+    __atomic_add_fetch(&hot->deposits, 1, __ATOMIC_RELAXED);
+}
+
+// Pick the deposits of req that can skip their lock: a promoted account
+// named once with a non-negative amount
+void hot_classify(struct request *req) {
+    req->hot_deposits = 0;
+    for (int i = 0; i < req->num_trans; i++) {
+        int id = req->transactions[i].acc_id;
+        if (req->transactions[i].amount < 0 || hot_index(id) < 0) continue;
+        int repeated = 0;
+        for (int j = 0; j < req->num_trans; j++) {
+            if (j != i && req->transactions[j].acc_id == id) repeated = 1;
+        }
+        if (!repeated) req->hot_deposits |= 1u << i;
+    }
+}
+
+// process_transaction() with --hot: the same sorted locking, minus the
+// accounts deposited through slots, and with contention counted per account
+void process_transaction_hot(struct request *req) {
+    int locked[MAX_TRANS];
+    int n = 0;
+
+    hot_classify(req);
+    for (int i = 0; i < req->num_trans; i++) {
+        if (!(req->hot_deposits & (1u << i))) locked[n++] = req->transactions[i].acc_id;
+    }
+    // Sort by stripe, then account, so shared stripes are adjacent
+    for (int i = 1; i < n; i++) {
+        int id = locked[i], j = i;
+        while (j > 0 && (lock_stripe(locked[j - 1]) > lock_stripe(id) ||
+                         (lock_stripe(locked[j - 1]) == lock_stripe(id) && locked[j - 1] > id))) {
+            locked[j] = locked[j - 1];
+            j--;
+        }
+        locked[j] = id;
+    }
+
+    for (int i = 0; i < n; i++) {
+        if (i > 0 && lock_stripe(locked[i]) == lock_stripe(locked[i - 1])) continue;
+        hot_lock(locked[i]);
+    }
+    int insufficient_acc_id = apply_transaction(req);
+    for (int i = n - 1; i >= 0; i--) {
+        if (i > 0 && lock_stripe(locked[i]) == lock_stripe(locked[i - 1])) continue;
+        pthread_mutex_unlock(account_lock(locked[i]));
+    }
+
+    report_transaction(req, insufficient_acc_id);
+}
+
+// END, after every worker has exited: store each hot balance for good
+void hot_finish() {
+    for (int k = 0; k < num_hot_accounts; k++) {
+        struct hot_account *hot = &hot_accounts[k];
+        hot_read(hot->acc_id);
+        if (hot->seen != hot->merged) {
+            bank_write(hot->acc_id, bank_read(hot->acc_id) + (int)(hot->seen - hot->merged));
+            hot_merged(hot->acc_id);
+        }
+    }
+}
+
+int contention_comparator(const void *a, const void *b) {
+    uint32_t x = account_contention[*(const int *)a - 1];
+    uint32_t y = account_contention[*(const int *)b - 1];
+    return (x < y) - (x > y);
+}
+
+void report_hot_stats() {
+    long deposits = 0, merges = 0;
+    for (int k = 0; k < num_hot_accounts; k++) {
+        deposits += hot_accounts[k].deposits;
+        merges += hot_accounts[k].merges;
+    }
+    fprintf(stderr, "Hot accounts: %d promoted after %d contended locks; %ld deposits through delta slots, %ld merges\n",
+            num_hot_accounts, hot_threshold, deposits, merges);
+
+    int top[HOT_REPORT_TOP];
+    int num_top = 0;
+    for (int id = 1; id <= NUM_ACCOUNTS; id++) {
+        if (account_contention[id - 1] == 0) continue;
+        if (num_top < HOT_REPORT_TOP) {
+            top[num_top++] = id;
+        } else if (account_contention[id - 1] > account_contention[top[num_top - 1] - 1]) {
+            top[num_top - 1] = id;
+        } else {
+            continue;
+        }
+        qsort(top, num_top, sizeof(int), contention_comparator);
+    }
+    for (int i = 0; i < num_top; i++) {
+        int k = account_hot[top[i] - 1] - 1;
+        fprintf(stderr, "  account %d: %u contended locks", top[i], account_contention[top[i] - 1]);
+        if (k >= 0) {
+            fprintf(stderr, ", promoted: %ld deposits, %ld merges", hot_accounts[k].deposits, hot_accounts[k].merges);
+        }
+        fprintf(stderr, "\n");
+    }
+}
+
+
+// --- Optimistic Execution (EXEC_OCC) ---
+// A TRANS reads its balances without any lock, noting the sequence number of
+// each account it reads. Only then does it lock its stripes (sorted, as
+// above), and only to validate that no sequence number moved and to install
+// the writes, so the reads of one TRANS no longer hold up others on the same
+// accounts. A conflict unlocks, backs off for a random time that doubles with
+// every abort, and reads again. After OCC_MAX_RETRIES aborts the TRANS runs
+// pessimistically, so a hot account cannot starve it. An ISF is validated
+// without locking at all: the balances it saw must still be current.
+
+// Read phase. Waits out any TRANS writing an account, so every sampled
+// sequence number is even. Stops at the first account lacking funds.
+// Returns that account, or -1; *num_read is the number of accounts read.
+int occ_read(struct request *req, int *balances, uint32_t *seqs, int *num_read) {
+    for (int i = 0; i < req->num_trans; i++) {
+        int id = req->transactions[i].acc_id;
+        uint32_t *seq = &account_seq[id - 1];
+        while ((seqs[i] = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1) {
+            __atomic_add_fetch(&seq_parked, 1, __ATOMIC_SEQ_CST);
+            futex_wait(seq, seqs[i]);
+            __atomic_sub_fetch(&seq_parked, 1, __ATOMIC_SEQ_CST);
+        }
+        balances[i] = bank_peek(id);
+        *num_read = i + 1;
+        if (balances[i] + req->transactions[i].amount < 0) return id;
+    }
+    return -1;
+}
+
+// Validation: 1 if none of the first n accounts was written since it was read
+int occ_validate(struct request *req, const uint32_t *seqs, int n) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    for (int i = 0; i < n; i++) {
+        uint32_t *seq = &account_seq[req->transactions[i].acc_id - 1];
+        if (__atomic_load_n(seq, __ATOMIC_RELAXED) != seqs[i]) return 0;
+    }
+    return 1;
+}
+
+void process_transaction_occ(struct request *req) {
+    int balances[MAX_TRANS];
+    uint32_t seqs[MAX_TRANS];
+    int sorted_ids[MAX_TRANS];
+    unsigned seed = (unsigned)req->request_id;
+    sort_stripes(req, sorted_ids);
+
+    for (int attempt = 0; attempt < OCC_MAX_RETRIES; attempt++) {
+        if (attempt > 0) {
+            usleep(rand_r(&seed) % ((unsigned)OCC_BACKOFF_US << attempt));
+        }
+
+        int num_read;
+        int insufficient_acc_id = occ_read(req, balances, seqs, &num_read);
+        if (insufficient_acc_id != -1) {
+            if (occ_validate(req, seqs, num_read)) {
+                wal_note_read(req);
+                __atomic_add_fetch(&occ_isf, 1, __ATOMIC_RELAXED);
+                report_transaction(req, insufficient_acc_id);
+                return;
+            }
+        } else {
+            lock_stripes(sorted_ids, req->num_trans);
+            int valid = occ_validate(req, seqs, req->num_trans);
+            if (valid) install_transaction(req, balances);
+            unlock_stripes(sorted_ids, req->num_trans);
+            if (valid) {
+                __atomic_add_fetch(&occ_commits, 1, __ATOMIC_RELAXED);
+                report_transaction(req, -1);
+                return;
+            }
+        }
+        __atomic_add_fetch(&occ_aborts, 1, __ATOMIC_RELAXED);
+    }
+
+    // Still conflicting: hold the locks across the reads like EXEC_LOCK
+    __atomic_add_fetch(&occ_fallbacks, 1, __ATOMIC_RELAXED);
+    lock_stripes(sorted_ids, req->num_trans);
+    int insufficient_acc_id = apply_transaction(req);
+    unlock_stripes(sorted_ids, req->num_trans);
+    report_transaction(req, insufficient_acc_id);
+}
+
+void report_occ_stats() {
+    long attempts = occ_commits + occ_isf + occ_aborts;
+    fprintf(stderr, "OCC: %ld committed, %ld ISF, %ld aborts (%.1f%% of optimistic attempts), %ld fell back to locks\n",
+            occ_commits, occ_isf, occ_aborts, attempts ? 100.0 * occ_aborts / attempts : 0.0, occ_fallbacks);
+}
+
+
+// --- Coroutine Executor (EXEC_CORO) ---
+// Each worker runs up to coroutines_per_worker requests at once, each on its
+// own ucontext stack. A request runs the EXEC_LOCK code unchanged; the two
+// places it would block the thread instead suspend it:
+//   Bank.c calls   go to the --async-io threads; the coroutine resumes once
+//                  its group is done (bank_io_many)
+//   account locks  are tried; a coroutine that finds one held yields and
+//                  tries again once a request of its worker has finished
+//                  (and so unlocked), or CORO_LOCK_POLL_NS later in case
+//                  another worker holds it (lock_stripe_mutex)
+// A coroutine never moves to another thread, so it unlocks on the thread that
+// locked, and the thread-locals it uses stay its worker's. Only the phase_*_ns
+// latency counters are per request; they are swapped on every switch.
+
+// Runs on a coroutine stack for the life of the worker, one request per turn
+void coro_main() {
+    while (1) {
+        struct coroutine *self = current_coro;
+        struct request *req = self->req;
+
+        latency_start();
+        if (drop_expired(req)) {
+            // answered EXPIRED
+        } else if (req->request_type == 'C') {
+            process_check(req);
+        } else if (req->request_type == 'T') {
+            process_transaction(req);
+        } else if (req->request_type == 'Q') {
+            process_stats(req);
+        }
+        request_free(req);
+
+        self->req = NULL;
+        self->state = CORO_FREE;
+        swapcontext(&self->context, &coro_scheduler);
+    }
+}
+
+// Back to the scheduler; the caller has set its state
+void coro_yield() {
+    swapcontext(&current_coro->context, &coro_scheduler);
+}
+
+int coro_lock_stripe(int stripe) {
+    pthread_mutex_t *mutex = &account_locks[stripe].mutex;
+    struct lock_profile *prof = lockprof_enabled ? &account_lock_profiles[stripe] : NULL;
+
+    if (pthread_mutex_trylock(mutex) == 0) {
+        if (prof) prof->acquisitions++;
+        return 0;
+    }
+    uint64_t start = monotonic_ns();
+    do {
+        current_coro->state = CORO_LOCK;
+        coro_yield();
+    } while (pthread_mutex_trylock(mutex) != 0);
+
+    uint64_t waited = monotonic_ns() - start;
+    if (prof) {
+        prof->acquisitions++;
+        prof->contended++;
+        prof->wait_ns += waited;
+        if (waited > prof->max_wait_ns) prof->max_wait_ns = waited;
+    }
+    phase_lock_ns += waited;
+    return 1;
+}
+
+// group was submitted with wake = this worker's coro_events
+void coro_wait_io(struct bank_io_group *group) {
+    current_coro->io = group;
+    current_coro->state = CORO_IO;
+    coro_yield();
+}
+
+// Producer: a request was queued; wake one worker parked with a free coroutine
+void coro_notify_arrival() {
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        if (__atomic_load_n(&workers[i].coro_parked, __ATOMIC_SEQ_CST)) {
+            __atomic_add_fetch(&workers[i].coro_events, 1, __ATOMIC_SEQ_CST);
+            futex_wake(&workers[i].coro_events, 1);
+            return;
+        }
+    }
+}
+
+struct request *coro_try_dequeue() {
+    lock_queue();
+    struct request *req = queue_pop();
+    pthread_mutex_unlock(&queue_mutex);
+    return req;
+}
+
+// Stacks are mapped with a guard page below them, and only the pages a
+// request touches are ever backed by memory
+int coro_alloc(struct worker *w) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    w->coros = (struct coroutine *)calloc(coroutines_per_worker, sizeof(struct coroutine));
+    if (w->coros == NULL) return 0;
+
+    for (int i = 0; i < coroutines_per_worker; i++) {
+        struct coroutine *c = &w->coros[i];
+        char *stack = mmap(NULL, page + CORO_STACK_SIZE, PROT_READ | PROT_WRITE,
+                           MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (stack == MAP_FAILED) return 0;
+        mprotect(stack, page, PROT_NONE);
+        c->stack = stack;
+        getcontext(&c->context);
+        c->context.uc_stack.ss_sp = stack + page;
+        c->context.uc_stack.ss_size = CORO_STACK_SIZE;
+        c->context.uc_link = NULL;
+        makecontext(&c->context, coro_main, 0);
+    }
+    return 1;
+}
+
+void coro_free(struct worker *w) {
+    size_t page = (size_t)sysconf(_SC_PAGESIZE);
+    for (int i = 0; i < coroutines_per_worker; i++) {
+        munmap(w->coros[i].stack, page + CORO_STACK_SIZE);
+    }
+    free(w->coros);
+}
+
+void coro_resume(struct worker *self, struct coroutine *c) {
+    current_coro = c;
+    phase_started_ns = c->started_ns;
+    phase_lock_ns = c->lock_ns;
+    phase_bank_ns = c->bank_ns;
+    c->state = CORO_RUNNING;
+    swapcontext(&coro_scheduler, &c->context);
+    c->started_ns = phase_started_ns;
+    c->lock_ns = phase_lock_ns;
+    c->bank_ns = phase_bank_ns;
+    current_coro = NULL;
+    self->coro_switches++;
+}
+
+// Nothing could run: sleep until a Bank.c group finishes or, with a
+// coroutine free, a request arrives; with lock waiters, at most
+// CORO_LOCK_POLL_NS.
+void coro_park(struct worker *self, uint32_t seen, int active, int lock_waiters) {
+    int open = active < coroutines_per_worker;
+    __atomic_store_n(&self->coro_parked, open, __ATOMIC_SEQ_CST);
+    if (open) {
+        lock_queue();
+        int queued = request_queue.num_jobs > 0;
+        pthread_mutex_unlock(&queue_mutex);
+        if (queued) {
+            __atomic_store_n(&self->coro_parked, 0, __ATOMIC_RELAXED);
+            return;
+        }
+    }
+
+    self->coro_parks++;
+    if (lock_waiters) {
+        struct timespec poll = {0, CORO_LOCK_POLL_NS};
+        futex_wait_timeout(&self->coro_events, seen, &poll);
+    } else {
+        futex_wait(&self->coro_events, seen);
+    }
+    __atomic_store_n(&self->coro_parked, 0, __ATOMIC_RELAXED);
+}
+
+void coro_worker_loop(struct worker *self) {
+    int active = 0;
+    int finished = 0;               // requests completed by the last pass
+    uint64_t lock_retried_ns = 0;
+
+    while (1) {
+        int progress = 0;
+
+        // 1. Give every free coroutine a request; with none in flight, block
+        //    for the next one like any other worker
+        for (int i = 0; i < coroutines_per_worker && active < coroutines_per_worker; i++) {
+            struct coroutine *c = &self->coros[i];
+            if (c->state != CORO_FREE) continue;
+            c->req = active == 0 ? dequeue_request(self) : coro_try_dequeue();
+            if (c->req == NULL) break;
+            c->state = CORO_READY;
+            active++;
+            self->processed++;
+            progress = 1;
+        }
+        if (active == 0) break;     // queue closed and drained
+        if (active > self->coro_peak) self->coro_peak = active;
+
+        // 2. Run every coroutine that can move
+        uint32_t seen = __atomic_load_n(&self->coro_events, __ATOMIC_SEQ_CST);
+        uint64_t now = monotonic_ns();
+        int retry_locks = finished || now - lock_retried_ns >= CORO_LOCK_POLL_NS;
+        if (retry_locks) lock_retried_ns = now;
+        int lock_waiters = 0;
+        finished = 0;
+        for (int i = 0; i < coroutines_per_worker; i++) {
+            struct coroutine *c = &self->coros[i];
+            enum coro_state was = c->state;
+            if (was == CORO_FREE) continue;
+            if (was == CORO_IO && __atomic_load_n(&c->io->pending, __ATOMIC_ACQUIRE) != 0) continue;
+            if (was == CORO_LOCK && !retry_locks) {
+                lock_waiters++;
+                continue;
+            }
+
+            coro_resume(self, c);
+            if (c->state == CORO_FREE) {
+                active--;
+                finished++;
+            }
+            if (c->state == CORO_LOCK) lock_waiters++;
+            if (was != CORO_LOCK || c->state != CORO_LOCK) progress = 1;
+        }
+
+        // 3. Everything is waiting
+        if (!progress) coro_park(self, seen, active, lock_waiters);
+    }
+}
+
+void report_coro_stats() {
+    long switches = 0, parks = 0;
+    int peak = 0;
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        switches += workers[i].coro_switches;
+        parks += workers[i].coro_parks;
+        if (workers[i].coro_peak > peak) peak = workers[i].coro_peak;
+    }
+    const char *unit;
+    double stacks = display_size((double)NUM_WORKERS * coroutines_per_worker * CORO_STACK_SIZE, &unit);
+    fprintf(stderr, "Coroutines: %d workers x %d (%.1f %s of stack reserved), at most %d requests in flight on one, %ld switches, %ld parks\n",
+            NUM_WORKERS, coroutines_per_worker, stacks, unit, peak, switches, parks);
+}
+
+
+// --- Worker Thread Routine ---
+
+void *worker_thread(void *arg) {
+    struct worker *self = (struct worker *)arg;
+    struct request *req;
+
+    worker_output = &self->output;
+    worker_slot = self->id;
+    if (exec_mode == EXEC_BATCH) {
+        batch_worker_loop(self);
+        return NULL;
+    }
+    if (exec_mode == EXEC_CORO) {
+        coro_worker_loop(self);
+        return NULL;
+    }
+
+    while (1) {
+        req = dequeue_request(self); 
+        
+        if (worker_retired) {
+            return NULL;
+        }
+        if (req == NULL && request_queue.end_flag == 1) {
+            pthread_cond_broadcast(&queue_cond); 
+            break;
+        } 
+        
+        if (req != NULL) {
+            self->processed++;
+            latency_start();
+            if (drop_expired(req)) {
+                // answered EXPIRED
+            } else if (exec_mode == EXEC_PARTITION) {
+                if (!process_partitioned(req)) continue;
+            } else if (exec_mode == EXEC_ORDERED) {
+                process_ordered(req);
+            } else if (req->request_type == 'C') {
+                process_check(req);
+            } else if (req->request_type == 'T' && exec_mode == EXEC_OCC) {
+                process_transaction_occ(req);
+            } else if (req->request_type == 'T') {
+                process_transaction(req);
+            } else if (req->request_type == 'S') {
+                process_snapshot(req);
+            } else if (req->request_type == 'Q') {
+                process_stats(req);
+            }
+            
+            request_free(req);
+        }
+    }
+    if (pool_max_workers) {
+        lock_queue();
+        pool_running--;
+        pthread_cond_signal(&pool_exit_cond);
+        pthread_mutex_unlock(&queue_mutex);
+    }
+    return NULL;
+}
+
+
+// --- Elastic Worker Pool (--max-workers) ---
+// The worker table is sized for the ceiling, and the command-line worker
+// count is a floor that always runs. Every POOL_INTERVAL_MS the pool thread
+// estimates how long the queued requests would keep the pool busy (queue
+// length x smoothed service time) and starts enough workers to drain them
+// within POOL_DRAIN_TARGET_MS. A worker above the floor that waits
+// idle_timeout_ms without a request retires. A slot keeps its output ring,
+// histograms and MVCC slot from one thread to the next; a new thread only
+// starts in it once the previous one has been joined.
+
+// Wait for a request until *deadline; the caller holds queue_mutex. Returns 1
+// if the worker retired: it timed out above the floor with nothing queued.
+int pool_idle_wait(struct worker *self, struct timespec *deadline) {
+    if (pthread_cond_timedwait(&queue_cond, &queue_mutex, deadline) != ETIMEDOUT || request_queue.num_jobs > 0) {
+        return 0;
+    }
+    if (pool_running > pool_min_workers) {
+        pool_running--;
+        pool_retired++;
+        self->state = WORKER_RETIRED;
+        worker_retired = 1;
+        return 1;
+    }
+    clock_gettime(CLOCK_REALTIME, deadline);
+    deadline->tv_nsec += idle_timeout_ms * 1000000L;
+    deadline->tv_sec += deadline->tv_nsec / 1000000000L;
+    deadline->tv_nsec %= 1000000000L;
+    return 0;
+}
+
+double pool_elapsed() {
+    return (monotonic_ns() - server_start_ns) / 1e9;
+}
+
+// Start workers until the backlog would drain within POOL_DRAIN_TARGET_MS,
+// and log every change of the pool size since the last check
+void pool_adjust() {
+    uint64_t service_ns = __atomic_load_n(&pool_service_ns, __ATOMIC_RELAXED);
+    uint64_t served = __atomic_load_n(&pool_served, __ATOMIC_RELAXED);
+    if (served > pool_last_served) {
+        uint64_t sample = (service_ns - pool_last_service_ns) / (served - pool_last_served);
+        pool_service_avg_ns = pool_service_avg_ns ? (3 * pool_service_avg_ns + sample) / 4 : sample;
+    }
+    pool_last_service_ns = service_ns;
+    pool_last_served = served;
+
+    int slots[NUM_WORKERS];
+    int count = 0;
+    lock_queue();
+    long backlog = request_queue.num_jobs;
+    // Before the first result there is no service time yet: one worker per request
+    long want = pool_service_avg_ns
+        ? (long)((backlog * pool_service_avg_ns + POOL_DRAIN_TARGET_MS * 1000000ULL - 1) / (POOL_DRAIN_TARGET_MS * 1000000ULL))
+        : backlog;
+    int retired = pool_logged_running - pool_running;
+    int before = pool_running;
+    for (int i = 0; i < NUM_WORKERS && pool_running < want; i++) {
+        if (workers[i].state == WORKER_RUNNING) continue;
+        workers[i].state = WORKER_RUNNING;
+        pool_running++;
+        slots[count++] = i;
+    }
+    int after = pool_running;
+    if (after > pool_peak) pool_peak = after;
+    pool_logged_running = after;
+    pthread_mutex_unlock(&queue_mutex);
+
+    if (retired > 0) {
+        fprintf(stderr, "Pool: %d -> %d workers at %.2f s (%d idle for %d ms)\n",
+                before + retired, before, pool_elapsed(), retired, idle_timeout_ms);
+    }
+
+    for (int k = 0; k < count; k++) {
+        struct worker *w = &workers[slots[k]];
+        if (w->joinable) pthread_join(w->thread, NULL);
+        pthread_create(&w->thread, NULL, worker_thread, w);
+        w->joinable = 1;
+        pool_started++;
+    }
+    if (count > 0) {
+        fprintf(stderr, "Pool: %d -> %d workers at %.2f s (%ld queued, %.1f ms per request)\n",
+                before, after, pool_elapsed(), backlog, pool_service_avg_ns / 1e6);
+    }
+}
+
+void *pool_thread_routine(void *arg) {
+    (void)arg;
+    pthread_mutex_lock(&pool_mutex);
+    while (!pool_stop) {
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += POOL_INTERVAL_MS * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&pool_cond, &pool_mutex, &deadline);
+        if (pool_stop) break;
+
+        pthread_mutex_unlock(&pool_mutex);
+        pool_adjust();
+        pthread_mutex_lock(&pool_mutex);
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return NULL;
+}
+
+// Called on END. The pool keeps growing while the last requests drain; it
+// stops once every worker has exited, so no more can be started.
+void pool_shutdown() {
+    lock_queue();
+    while (pool_running > 0) {
+        pthread_cond_wait(&pool_exit_cond, &queue_mutex);
+    }
+    pthread_mutex_unlock(&queue_mutex);
+
+    pthread_mutex_lock(&pool_mutex);
+    pool_stop = 1;
+    pthread_cond_signal(&pool_cond);
+    pthread_mutex_unlock(&pool_mutex);
+    pthread_join(pool_thread, NULL);
+
+    fprintf(stderr, "Pool: %d..%d workers, peak %d, %ld started, %ld retired\n",
+            pool_min_workers, NUM_WORKERS, pool_peak, pool_started, pool_retired);
+}
+
+
+// --- Queue Microbenchmark (--bench-queue) ---
+// Pushes BENCH_QUEUE_REQUESTS empty requests through enqueue_request() /
+// dequeue_request() with 1..64 consumers and no account work, so the numbers
+// reflect only the cost of the queue backend itself.
+
+void *bench_consumer(void *arg) {
+    struct worker *self = (struct worker *)arg;
+    while (dequeue_request(self) != NULL) {
+        self->processed++;
+    }
+    return NULL;
+}
+
+double bench_queue_backend(enum queue_backend backend, int num_consumers, struct request *reqs) {
+    queue_backend = backend;
+    request_queue.head = request_queue.tail = NULL;
+    request_queue.num_jobs = 0;
+    request_queue.end_flag = 0;
+    if (backend == QUEUE_RING) {
+        request_ring = ring_create(queue_capacity);
+        if (request_ring == NULL) return 0;
+    }
+
+    NUM_WORKERS = num_consumers;
+    for (int i = 0; i < num_consumers; i++) {
+        workers[i].id = i;
+        workers[i].processed = workers[i].steals = 0;
+        workers[i].deque.head = workers[i].deque.count = 0;
+    }
+    struct timespec start, end;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (int i = 0; i < num_consumers; i++) {
+        pthread_create(&workers[i].thread, NULL, bench_consumer, &workers[i]);
+    }
+    for (int i = 0; i < BENCH_QUEUE_REQUESTS; i++) {
+        enqueue_request(&reqs[i]);
+    }
+    request_queue.end_flag = 1;
+    close_request_queue();
+    long total = 0;
+    for (int i = 0; i < num_consumers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        total += workers[i].processed;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    if (backend == QUEUE_RING) {
+        ring_destroy(request_ring);
+        request_ring = NULL;
+    }
+    if (total != BENCH_QUEUE_REQUESTS) {
+        fprintf(stderr, "Error: queue benchmark lost requests (%ld of %d)\n", total, BENCH_QUEUE_REQUESTS);
+    }
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    return total / secs;
+}
+
+int run_queue_benchmark() {
+    struct request *reqs = (struct request *)calloc(BENCH_QUEUE_REQUESTS, sizeof(struct request));
+    workers = (struct worker *)aligned_alloc(CACHE_LINE, BENCH_QUEUE_MAX_WORKERS * sizeof(struct worker));
+    if (reqs == NULL || workers == NULL) { fprintf(stderr, "Memory error during benchmark.\n"); return 1; }
+    for (int i = 0; i < BENCH_QUEUE_MAX_WORKERS; i++) {
+        deque_init(&workers[i].deque);
+    }
+
+    printf("Queue benchmark: %d requests, 1 producer\n", BENCH_QUEUE_REQUESTS);
+    printf("%8s %16s %16s %16s\n", "workers", "list (req/s)", "ring (req/s)", "steal (req/s)");
+    for (int w = 1; w <= BENCH_QUEUE_MAX_WORKERS; w *= 2) {
+        double list_rate = bench_queue_backend(QUEUE_LIST, w, reqs);
+        double ring_rate = bench_queue_backend(QUEUE_RING, w, reqs);
+        double steal_rate = bench_queue_backend(QUEUE_STEAL, w, reqs);
+        printf("%8d %16.0f %16.0f %16.0f\n", w, list_rate, ring_rate, steal_rate);
+    }
+    free(reqs);
+    return 0;
+}
+
+
+// --- Command Line Options ---
+
+enum {
+    OPT_QUEUE = 256,
+    OPT_QUEUE_SIZE,
+    OPT_BENCH_QUEUE,
+    OPT_EXEC,
+    OPT_BATCH_SIZE,
+    OPT_BATCH_WAIT,
+    OPT_WINDOW,
+    OPT_HOT,
+    OPT_LOCKPROF,
+    OPT_CACHE,
+    OPT_FLUSH_INTERVAL,
+    OPT_CHECK,
+    OPT_LOCK_STRIPES,
+    OPT_ORDERED_OUTPUT,
+    OPT_INPUT,
+    OPT_INPUT_FILE,
+    OPT_LISTEN,
+    OPT_IO,
+    OPT_WAL,
+    OPT_STORE,
+    OPT_SNAPSHOT,
+    OPT_RESTORE,
+    OPT_TIMELINE,
+    OPT_MAX_WORKERS,
+    OPT_IDLE_TIMEOUT,
+    OPT_ASYNC_IO,
+    OPT_COROUTINES,
+    OPT_PRIORITY,
+    OPT_DEADLINE,
+    OPT_DEADLINE_MISS
+};
+
+static struct option long_options[] = {
+    {"queue",       required_argument, NULL, OPT_QUEUE},
+    {"queue-size",  required_argument, NULL, OPT_QUEUE_SIZE},
+    {"bench-queue", no_argument,       NULL, OPT_BENCH_QUEUE},
+    {"exec",        required_argument, NULL, OPT_EXEC},
+    {"batch-size",  required_argument, NULL, OPT_BATCH_SIZE},
+    {"batch-wait",  required_argument, NULL, OPT_BATCH_WAIT},
+    {"window",      required_argument, NULL, OPT_WINDOW},
+    {"hot",         required_argument, NULL, OPT_HOT},
+    {"lockprof",    required_argument, NULL, OPT_LOCKPROF},
+    {"cache",       required_argument, NULL, OPT_CACHE},
+    {"flush-interval", required_argument, NULL, OPT_FLUSH_INTERVAL},
+    {"check",       required_argument, NULL, OPT_CHECK},
+    {"lock-stripes", required_argument, NULL, OPT_LOCK_STRIPES},
+    {"ordered-output", no_argument,    NULL, OPT_ORDERED_OUTPUT},
+    {"input",       required_argument, NULL, OPT_INPUT},
+    {"input-file",  required_argument, NULL, OPT_INPUT_FILE},
+    {"listen",      required_argument, NULL, OPT_LISTEN},
+    {"io",          required_argument, NULL, OPT_IO},
+    {"wal",         required_argument, NULL, OPT_WAL},
+    {"store",       required_argument, NULL, OPT_STORE},
+    {"snapshot",    required_argument, NULL, OPT_SNAPSHOT},
+    {"restore",     required_argument, NULL, OPT_RESTORE},
+    {"timeline",    required_argument, NULL, OPT_TIMELINE},
+    {"max-workers", required_argument, NULL, OPT_MAX_WORKERS},
+    {"idle-timeout", required_argument, NULL, OPT_IDLE_TIMEOUT},
+    {"async-io",    required_argument, NULL, OPT_ASYNC_IO},
+    {"coroutines",  required_argument, NULL, OPT_COROUTINES},
+    {"priority",    required_argument, NULL, OPT_PRIORITY},
+    {"deadline",    required_argument, NULL, OPT_DEADLINE},
+    {"deadline-miss", required_argument, NULL, OPT_DEADLINE_MISS},
+    {NULL, 0, NULL, 0}
+};
+
+// "A,B,C": one value per priority class, each at least min
+int parse_class_list(const char *arg, int *values, int min) {
+    int v[NUM_PRIO];
+    char extra;
+    if (sscanf(arg, "%d,%d,%d%c", &v[0], &v[1], &v[2], &extra) != NUM_PRIO) return 0;
+    for (int c = 0; c < NUM_PRIO; c++) {
+        if (v[c] < min) return 0;
+    }
+    memcpy(values, v, sizeof(v));
+    return 1;
+}
+
+void print_usage() {
+    fprintf(stderr, "Usage: ./appserver [options] <# of worker threads> <# of accounts> <output file>\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  --queue=list|ring|steal  request queue backend (default list)\n");
+    fprintf(stderr, "  --queue-size=N       ring capacity, rounded up to a power of two (default %d)\n", DEFAULT_RING_SIZE);
+    fprintf(stderr, "  --bench-queue        run the queue microbenchmark and exit\n");
+    fprintf(stderr, "  --exec=MODE          lock (default): sorted per-account locks\n");
+    fprintf(stderr, "                       partition: lock-free per-worker account shards\n");
+    fprintf(stderr, "                       batch: commit many queued requests per pass over Bank.c\n");
+    fprintf(stderr, "                       occ: read without locks, validate and write under them, retry on conflict\n");
+    fprintf(stderr, "                       ordered: conflicting requests in arrival order, the rest in parallel;\n");
+    fprintf(stderr, "                       results identical to a serial run\n");
+    fprintf(stderr, "                       coro: lock, with many requests per worker as coroutines that\n");
+    fprintf(stderr, "                       suspend on Bank.c calls (needs --async-io) and held locks\n");
+    fprintf(stderr, "  --batch-size=K       max requests per batch (default %d)\n", DEFAULT_BATCH_SIZE);
+    fprintf(stderr, "  --batch-wait=MS      max wait for a batch to fill (default %d)\n", DEFAULT_BATCH_WAIT_MS);
+    fprintf(stderr, "  --coroutines=N       requests in flight per --exec=coro worker (default %d)\n", DEFAULT_COROUTINES);
+    fprintf(stderr, "  --window=N           max requests tracked by --exec=ordered at once (default %d)\n", DEFAULT_ORDER_WINDOW);
+    fprintf(stderr, "  --max-workers=N      start more workers, up to N, while requests queue up; the worker\n");
+    fprintf(stderr, "                       count given below is the floor (list queue; lock, occ or ordered)\n");
+    fprintf(stderr, "  --idle-timeout=MS    retire a worker above the floor after MS idle (default %d)\n", DEFAULT_IDLE_TIMEOUT_MS);
+    fprintf(stderr, "  --priority=H,N,L     one list queue per class (high: CHECK/STATS, normal: TRANS of up to %d\n", SMALL_TRANS_ACCOUNTS);
+    fprintf(stderr, "                       accounts, low: larger TRANS; or PRIO on the line), served by weight\n");
+    fprintf(stderr, "  --deadline=H,N,L     default deadline in ms per class (0: none); late results end in LATE\n");
+    fprintf(stderr, "  --deadline-miss=flag|drop  flag late results (default), or answer EXPIRED without running\n");
+    fprintf(stderr, "                       a request that can no longer make its deadline\n");
+    fprintf(stderr, "  --async-io=N         make the Bank.c reads, then the writes, of a TRANS (or batch) at\n");
+    fprintf(stderr, "                       once on N I/O threads (default 0: one by one on the worker)\n");
+    fprintf(stderr, "  --cache=MODE         off (default): every access goes to Bank.c\n");
+    fprintf(stderr, "                       writeback: serve from memory, flush dirty accounts in the background\n");
+    fprintf(stderr, "                       strict: serve reads from memory, write through before replying\n");
+    fprintf(stderr, "  --flush-interval=MS  writeback flush period (default %d)\n", DEFAULT_FLUSH_INTERVAL_MS);
+    fprintf(stderr, "  --check=MODE         lock (default): CHECK takes the account lock\n");
+    fprintf(stderr, "                       seqlock: read optimistically, retry if a TRANS wrote meanwhile\n");
+    fprintf(stderr, "                       mvcc: read the last committed version, never wait\n");
+    fprintf(stderr, "  --lock-stripes=N     share N account locks among all accounts (default one per account)\n");
+    fprintf(stderr, "  --hot=N              after N contended lock attempts on an account, take deposits to it\n");
+    fprintf(stderr, "                       without its lock through per-worker delta slots (default 0: off)\n");
+    fprintf(stderr, "  --lockprof=CSV       count acquisitions, contention and wait time of every account lock\n");
+    fprintf(stderr, "                       and queue_mutex; print the top %d at END and write all to CSV\n", LOCKPROF_TOP);
+    fprintf(stderr, "  --ordered-output     write results in request-ID order instead of completion order\n");
+    fprintf(stderr, "  --input=text|binary  request encoding: CHECK/TRANS lines (default) or frames from bankconv\n");
+    fprintf(stderr, "  --input-file=PATH    read requests from PATH instead of stdin\n");
+    fprintf(stderr, "  --listen=ADDR        serve clients on tcp:PORT (localhost) or unix:PATH instead of stdin;\n");
+    fprintf(stderr, "                       may be given up to %d times, stops on SIGINT/SIGTERM\n", MAX_LISTENERS);
+    fprintf(stderr, "  --io=stdio|uring     read input and write results with read()/writev() (default) or io_uring\n");
+    fprintf(stderr, "  --wal=PATH           log every TRANS to PATH and reply only once it is on disk;\n");
+    fprintf(stderr, "                       balances logged there by earlier runs are restored first\n");
+    fprintf(stderr, "  --store=mem|mmap:PATH  keep accounts in memory (default, zeroed on start) or in a\n");
+    fprintf(stderr, "                       memory-mapped file whose balances carry over to the next run\n");
+    fprintf(stderr, "  --snapshot=PATH      SNAPSHOT writes a consistent copy of every balance to PATH\n");
+    fprintf(stderr, "  --restore=PATH       start from the balances of a snapshot file\n");
+    fprintf(stderr, "  --timeline=CSV       write the results emitted in each second to CSV at END\n");
+}
+
+
+// --- Main Function (Producer) ---
+// FIX 3: Corrected the main function signature
+int main(int argc, char **argv) {
+    int bench_queue = 0;
+    char *input_filename = NULL;
+    char *wal_path = NULL;
+    char *store_path = NULL;
+    char *restore_path = NULL;
+    char *lockprof_path = NULL;
+    int opt;
+
+    while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+        switch (opt) {
+        case OPT_QUEUE:
+            if (strcmp(optarg, "list") == 0) queue_backend = QUEUE_LIST;
+            else if (strcmp(optarg, "ring") == 0) queue_backend = QUEUE_RING;
+            else if (strcmp(optarg, "steal") == 0) queue_backend = QUEUE_STEAL;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_QUEUE_SIZE:
+            queue_capacity = (unsigned)atoi(optarg);
+            if (queue_capacity < 2) { print_usage(); return 1; }
+            break;
+        case OPT_BENCH_QUEUE:
+            bench_queue = 1;
+            break;
+        case OPT_EXEC:
+            if (strcmp(optarg, "lock") == 0) exec_mode = EXEC_LOCK;
+            else if (strcmp(optarg, "partition") == 0) exec_mode = EXEC_PARTITION;
+            else if (strcmp(optarg, "batch") == 0) exec_mode = EXEC_BATCH;
+            else if (strcmp(optarg, "occ") == 0) exec_mode = EXEC_OCC;
+            else if (strcmp(optarg, "ordered") == 0) exec_mode = EXEC_ORDERED;
+            else if (strcmp(optarg, "coro") == 0) exec_mode = EXEC_CORO;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_BATCH_SIZE:
+            batch_size = atoi(optarg);
+            if (batch_size < 1) { print_usage(); return 1; }
+            break;
+        case OPT_BATCH_WAIT:
+            batch_wait_ms = atoi(optarg);
+            if (batch_wait_ms < 0) { print_usage(); return 1; }
+            break;
+        case OPT_WINDOW:
+            order_window = atoi(optarg);
+            if (order_window < 1) { print_usage(); return 1; }
+            break;
+        case OPT_HOT:
+            hot_threshold = atoi(optarg);
+            if (hot_threshold < 0) { print_usage(); return 1; }
+            break;
+        case OPT_LOCKPROF:
+            lockprof_path = optarg;
+            break;
+        case OPT_CACHE:
+            if (strcmp(optarg, "off") == 0) cache_mode = CACHE_OFF;
+            else if (strcmp(optarg, "writeback") == 0) cache_mode = CACHE_WRITEBACK;
+            else if (strcmp(optarg, "strict") == 0) cache_mode = CACHE_STRICT;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_FLUSH_INTERVAL:
+            flush_interval_ms = atoi(optarg);
+            if (flush_interval_ms < 1) { print_usage(); return 1; }
+            break;
+        case OPT_ORDERED_OUTPUT:
+            ordered_output = 1;
+            break;
+        case OPT_LOCK_STRIPES:
+            num_lock_stripes = atoi(optarg);
+            if (num_lock_stripes < 1) { print_usage(); return 1; }
+            break;
+        case OPT_CHECK:
+            if (strcmp(optarg, "lock") == 0) check_mode = CHECK_LOCK;
+            else if (strcmp(optarg, "seqlock") == 0) check_mode = CHECK_SEQLOCK;
+            else if (strcmp(optarg, "mvcc") == 0) check_mode = CHECK_MVCC;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_INPUT:
+            if (strcmp(optarg, "text") == 0) input_format = INPUT_TEXT;
+            else if (strcmp(optarg, "binary") == 0) input_format = INPUT_BINARY;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_INPUT_FILE:
+            input_filename = optarg;
+            break;
+        case OPT_IO:
+            if (strcmp(optarg, "stdio") == 0) io_backend = IO_STDIO;
+            else if (strcmp(optarg, "uring") == 0) io_backend = IO_URING;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_WAL:
+            wal_path = optarg;
+            break;
+        case OPT_STORE:
+            if (strcmp(optarg, "mem") == 0) store_path = NULL;
+            else if (strncmp(optarg, "mmap:", 5) == 0 && optarg[5] != '\0') store_path = optarg + 5;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_SNAPSHOT:
+            snapshot_path = optarg;
+            break;
+        case OPT_RESTORE:
+            restore_path = optarg;
+            break;
+        case OPT_TIMELINE:
+            timeline_path = optarg;
+            break;
+        case OPT_MAX_WORKERS:
+            pool_max_workers = atoi(optarg);
+            if (pool_max_workers < 1) { print_usage(); return 1; }
+            break;
+        case OPT_IDLE_TIMEOUT:
+            idle_timeout_ms = atoi(optarg);
+            if (idle_timeout_ms < 1) { print_usage(); return 1; }
+            break;
+        case OPT_ASYNC_IO:
+            async_io_threads = atoi(optarg);
+            if (async_io_threads < 0) { print_usage(); return 1; }
+            break;
+        case OPT_COROUTINES:
+            coroutines_per_worker = atoi(optarg);
+            if (coroutines_per_worker < 1) { print_usage(); return 1; }
+            break;
+        case OPT_PRIORITY:
+            if (!parse_class_list(optarg, prio_weight, 1)) { print_usage(); return 1; }
+            if (prio_weight[PRIO_HIGH] > PRIO_STRIDE || prio_weight[PRIO_NORMAL] > PRIO_STRIDE ||
+                prio_weight[PRIO_LOW] > PRIO_STRIDE) { print_usage(); return 1; }
+            priority_enabled = 1;
+            break;
+        case OPT_DEADLINE:
+            if (!parse_class_list(optarg, prio_deadline_ms, 0)) { print_usage(); return 1; }
+            break;
+        case OPT_DEADLINE_MISS:
+            if (strcmp(optarg, "flag") == 0) deadline_miss = MISS_FLAG;
+            else if (strcmp(optarg, "drop") == 0) deadline_miss = MISS_DROP;
+            else { print_usage(); return 1; }
+            break;
+        case OPT_LISTEN:
+            if (num_listeners == MAX_LISTENERS) { print_usage(); return 1; }
+            listen_specs[num_listeners++] = optarg;
+            break;
+        default:
+            print_usage();
+            return 1;
+        }
+    }
+
+    if (bench_queue) {
+        pthread_mutex_init(&queue_mutex, NULL);
+        pthread_cond_init(&queue_cond, NULL);
+        return run_queue_benchmark();
+    }
+
+    if (argc - optind != 3) {
+        print_usage();
+        return 1;
+    }
+
+    // 1. Parse Arguments
+    NUM_WORKERS = atoi(argv[optind]);
+    NUM_ACCOUNTS = atoi(argv[optind + 1]);
+    char *output_filename = argv[optind + 2];
+
+    if (NUM_WORKERS < 1 || NUM_ACCOUNTS < 1) {
+        fprintf(stderr, "Error: Need at least one worker thread and one account\n");
+        return 1;
+    }
+    if (pool_max_workers) {
+        if (pool_max_workers < NUM_WORKERS) {
+            fprintf(stderr, "Error: --max-workers is below the %d workers always running\n", NUM_WORKERS);
+            return 1;
+        }
+        if (queue_backend != QUEUE_LIST || exec_mode == EXEC_PARTITION || exec_mode == EXEC_BATCH) {
+            fprintf(stderr, "Error: --max-workers resizes the workers sharing the list queue; use --exec=lock, occ or ordered and no --queue\n");
+            return 1;
+        }
+        pool_min_workers = NUM_WORKERS;
+        NUM_WORKERS = pool_max_workers;     // every per-worker table is sized for the ceiling
+    }
+    if (num_lock_stripes == 0 || num_lock_stripes > NUM_ACCOUNTS) {
+        num_lock_stripes = NUM_ACCOUNTS;
+    }
+    if (exec_mode == EXEC_PARTITION && queue_backend != QUEUE_LIST) {
+        fprintf(stderr, "Error: --exec=partition uses its own per-worker queues; drop --queue\n");
+        return 1;
+    }
+    if (exec_mode == EXEC_BATCH && queue_backend != QUEUE_LIST) {
+        fprintf(stderr, "Error: --exec=batch drains contiguous runs of the list queue; drop --queue\n");
+        return 1;
+    }
+    if (exec_mode == EXEC_ORDERED && queue_backend != QUEUE_LIST) {
+        fprintf(stderr, "Error: --exec=ordered queues requests on the list once they are ready; drop --queue\n");
+        return 1;
+    }
+    if (exec_mode == EXEC_OCC && queue_backend == QUEUE_STEAL) {
+        fprintf(stderr, "Error: --exec=occ validates under the account locks, not arrival tickets; use the list or ring queue\n");
+        return 1;
+    }
+    int account_locked = (exec_mode == EXEC_LOCK || exec_mode == EXEC_OCC) && queue_backend != QUEUE_STEAL;
+    if (cache_mode != CACHE_OFF && !account_locked) {
+        fprintf(stderr, "Error: --cache relies on the per-account locks; use --exec=lock or occ with the list or ring queue\n");
+        return 1;
+    }
+    if (check_mode != CHECK_LOCK && !account_locked) {
+        fprintf(stderr, "Error: --check=seqlock|mvcc replaces the per-account CHECK lock; use --exec=lock or occ with the list or ring queue\n");
+        return 1;
+    }
+
+    if (hot_threshold && (exec_mode != EXEC_LOCK || queue_backend == QUEUE_STEAL ||
+                          check_mode != CHECK_LOCK || snapshot_path != NULL)) {
+        fprintf(stderr, "Error: --hot needs --exec=lock with the list or ring queue, --check=lock and no --snapshot\n");
+        return 1;
+    }
+    if (exec_mode == EXEC_CORO && async_io_threads == 0) {
+        fprintf(stderr, "Error: --exec=coro suspends requests on Bank.c calls made by the I/O threads; give --async-io=N\n");
+        return 1;
+    }
+    if (exec_mode == EXEC_CORO && (queue_backend != QUEUE_LIST || pool_max_workers || check_mode != CHECK_LOCK ||
+                                   hot_threshold || cache_mode != CACHE_OFF || wal_path != NULL || snapshot_path != NULL)) {
+        fprintf(stderr, "Error: --exec=coro needs the list queue and --check=lock, and cannot be combined with --max-workers,\n"
+                        "       --hot, --cache, --wal or --snapshot, which would block every coroutine of a worker\n");
+        return 1;
+    }
+    if (priority_enabled && (queue_backend != QUEUE_LIST || exec_mode == EXEC_PARTITION || exec_mode == EXEC_BATCH)) {
+        fprintf(stderr, "Error: --priority splits the list queue by class; drop --queue, and use an --exec other than\n"
+                        "       partition or batch, whose batches must be contiguous runs of arrival order\n");
+        return 1;
+    }
+    if (deadline_miss == MISS_DROP && (exec_mode == EXEC_PARTITION || exec_mode == EXEC_BATCH)) {
+        fprintf(stderr, "Error: --deadline-miss=drop checks each request as a worker takes it; use --exec=lock, occ, ordered or coro\n");
+        return 1;
+    }
+    if (async_io_threads && hot_threshold) {
+        fprintf(stderr, "Error: --async-io reads accounts straight from Bank.c; it cannot be combined with --hot\n");
+        return 1;
+    }
+
+    if (wal_path != NULL && (store_path != NULL || restore_path != NULL)) {
+        fprintf(stderr, "Error: --wal rebuilds balances from zero at startup; it cannot be combined with --store=mmap or --restore\n");
+        return 1;
+    }
+    if (snapshot_path != NULL && !account_locked) {
+        fprintf(stderr, "Error: --snapshot relies on the per-account locks; use --exec=lock or occ with the list or ring queue\n");
+        return 1;
+    }
+
+    if (num_listeners > 0 && (input_filename != NULL || ordered_output)) {
+        fprintf(stderr, "Error: --listen answers each client on its own connection; drop --input-file and --ordered-output\n");
+        return 1;
+    }
+    if (num_listeners > 0 && !net_start()) {
+        return 1;
+    }
+
+    if (input_filename != NULL) {
+        input_fd = open(input_filename, O_RDONLY | O_CLOEXEC);
+        if (input_fd < 0) {
+            perror("Error opening input file");
+            return 1;
+        }
+    }
+    if (num_listeners == 0) {
+        if (io_backend == IO_URING && !uring_input_open(input_fd)) {
+            fprintf(stderr, "io_uring unavailable (%s); using read() and writev()\n", strerror(errno));
+            io_backend = IO_STDIO;
+        }
+        input_reader = io_backend == IO_URING
+            ? proto_reader_new(uring_input_read, NULL, INPUT_BLOCK_SIZE)
+            : proto_reader_open(input_fd, INPUT_BLOCK_SIZE);
+        if (input_reader == NULL) {
+            fprintf(stderr, "Error: Failed to allocate the input buffer.\n");
+            return 1;
+        }
+        if (input_format == INPUT_BINARY && !proto_read_magic(input_reader)) {
+            fprintf(stderr, "Error: Input is not a binary request stream (run it through bankconv).\n");
+            return 1;
+        }
+    }
+
+    // 2. Initialization
+    if (initialize_accounts(NUM_ACCOUNTS) == 0) {
+        fprintf(stderr, "Error: Failed to initialize bank accounts.\n");
+        return 1;
+    }
+    if (store_path != NULL) {
+        int kept = mmap_accounts_open(store_path, NUM_ACCOUNTS);
+        if (kept < 0) return 1;
+        store_mapped = 1;
+        fprintf(stderr, "Store: %s mapped, %d of %d accounts kept from the last run\n", store_path, kept, NUM_ACCOUNTS);
+    }
+    if (restore_path != NULL && !snapshot_restore(restore_path)) {
         return 1;
     }
     
-    // Initialize Synchronization Primitives
-    pthread_mutex_init(&queue_mutex, NULL);
-    pthread_cond_init(&queue_cond, NULL);
-    // FIX 4: Initialized the global output mutex
-    pthread_mutex_init(&output_mutex, NULL); 
-    
-    for (int i = 0; i < NUM_ACCOUNTS; i++) {
-        pthread_mutex_init(&account_locks[i], NULL); 
+    // Open the global output file pointer
+    // FIX 2: output_file is declared globally and opened here
+    output_file = fopen(output_filename, "w");
+    if (output_file == NULL) {
+        perror("Error opening output file");
+        return 1;
+    }
+    if (io_backend == IO_URING) {
+        output_uring = uring_output_open(fileno(output_file));
+        if (!output_uring) fprintf(stderr, "io_uring unavailable for output (%s); using writev()\n", strerror(errno));
+    }
+    
+    // Initialize Synchronization Primitives
+    pthread_mutex_init(&queue_mutex, NULL);
+    pthread_cond_init(&queue_cond, NULL);
+    
+    account_locks = (struct account_lock *)aligned_alloc(CACHE_LINE, num_lock_stripes * sizeof(struct account_lock));
+    if (account_locks == NULL) {
+        fprintf(stderr, "Error: Failed to allocate the account lock table.\n");
+        return 1;
+    }
+    for (int i = 0; i < num_lock_stripes; i++) {
+        pthread_mutex_init(&account_locks[i].mutex, NULL); 
+    }
+    if (lockprof_path != NULL) {
+        account_lock_profiles = (struct lock_profile *)calloc(num_lock_stripes, sizeof(struct lock_profile));
+        if (account_lock_profiles == NULL) {
+            fprintf(stderr, "Error: Failed to allocate the lock profile.\n");
+            return 1;
+        }
+        lockprof_enabled = 1;
     }
 
     request_queue.next_request_id = 1;
@@ -325,40 +4796,264 @@ int main(int argc, char **argv) {
     request_queue.head = request_queue.tail = NULL;
     request_queue.end_flag = 0;
 
+    if (queue_backend == QUEUE_RING) {
+        request_ring = ring_create(queue_capacity);
+        if (request_ring == NULL) {
+            fprintf(stderr, "Error: Failed to allocate request ring.\n");
+            return 1;
+        }
+    }
+    if (queue_backend == QUEUE_STEAL || exec_mode == EXEC_BATCH) {
+        account_next_ticket = (unsigned *)calloc(NUM_ACCOUNTS, sizeof(unsigned));
+        account_now_serving = (uint32_t *)calloc(NUM_ACCOUNTS, sizeof(uint32_t));
+        if (account_next_ticket == NULL || account_now_serving == NULL) {
+            fprintf(stderr, "Error: Failed to allocate account tickets.\n");
+            return 1;
+        }
+    }
+
+    if (exec_mode == EXEC_ORDERED) {
+        account_last = (struct request **)calloc(NUM_ACCOUNTS, sizeof(struct request *));
+        if (account_last == NULL) {
+            fprintf(stderr, "Error: Failed to allocate the request graph.\n");
+            return 1;
+        }
+        pthread_cond_init(&order_window_cond, NULL);
+    }
+    if (hot_threshold) {
+        account_contention = (uint32_t *)calloc(NUM_ACCOUNTS, sizeof(uint32_t));
+        account_hot = (int *)calloc(NUM_ACCOUNTS, sizeof(int));
+        if (account_contention == NULL || account_hot == NULL) {
+            fprintf(stderr, "Error: Failed to allocate contention counters.\n");
+            return 1;
+        }
+        pthread_mutex_init(&hot_mutex, NULL);
+    }
+    if (check_mode == CHECK_SEQLOCK || exec_mode == EXEC_OCC) {
+        account_seq = (uint32_t *)calloc(NUM_ACCOUNTS, sizeof(uint32_t));
+        if (account_seq == NULL) {
+            fprintf(stderr, "Error: Failed to allocate account sequence numbers.\n");
+            return 1;
+        }
+    }
+    if (cache_mode != CACHE_OFF) {
+        cache_values = (int *)calloc(NUM_ACCOUNTS, sizeof(int));
+        cache_state = (unsigned char *)calloc(NUM_ACCOUNTS, sizeof(unsigned char));
+        if (cache_values == NULL || cache_state == NULL) {
+            fprintf(stderr, "Error: Failed to allocate account cache.\n");
+            return 1;
+        }
+        if (cache_mode == CACHE_WRITEBACK) {
+            pthread_mutex_init(&flush_mutex, NULL);
+            pthread_cond_init(&flush_cond, NULL);
+            pthread_create(&flush_thread, NULL, flush_thread_routine, NULL);
+        }
+    }
+
+    if (snapshot_path != NULL) {
+        account_snap_epoch = (uint32_t *)calloc(NUM_ACCOUNTS, sizeof(uint32_t));
+        snapshot_copy = (int *)calloc(NUM_ACCOUNTS, sizeof(int));
+        snapshot_values = (int *)calloc(NUM_ACCOUNTS, sizeof(int));
+        if (account_snap_epoch == NULL || snapshot_copy == NULL || snapshot_values == NULL) {
+            fprintf(stderr, "Error: Failed to allocate snapshot state.\n");
+            return 1;
+        }
+    }
+    if (wal_path != NULL && !wal_open(wal_path)) {
+        return 1;
+    }
+    if (check_mode == CHECK_MVCC) {
+        // Every recovery step above has run, so this is the starting state
+        account_versions = mvcc_create(NUM_ACCOUNTS, NUM_WORKERS, bank_snapshot_value);
+        if (account_versions == NULL) {
+            fprintf(stderr, "Error: Failed to allocate account versions.\n");
+            return 1;
+        }
+    }
+
+    if (async_io_threads && !bank_async_start(async_io_threads)) {
+        fprintf(stderr, "Error: Failed to start the I/O threads.\n");
+        return 1;
+    }
+
+    report_footprint();
+
     // 3. Create Worker Threads
-    pthread_t workers[NUM_WORKERS];
+    workers = (struct worker *)aligned_alloc(CACHE_LINE, NUM_WORKERS * sizeof(struct worker));
+    if (workers == NULL) {
+        fprintf(stderr, "Error: Failed to allocate worker state.\n");
+        return 1;
+    }
+    if (!start_result_writer()) {
+        fprintf(stderr, "Error: Failed to allocate output buffers.\n");
+        return 1;
+    }
+    shard_size = (NUM_ACCOUNTS + NUM_WORKERS - 1) / NUM_WORKERS;
+    server_start_ns = monotonic_ns();
     for (int i = 0; i < NUM_WORKERS; i++) {
-        pthread_create(&workers[i], NULL, worker_thread, NULL);
+        deque_init(&workers[i].deque);
+        workers[i].inbox = NULL;
+        if (exec_mode == EXEC_PARTITION && (workers[i].inbox = ring_create(queue_capacity)) == NULL) {
+            fprintf(stderr, "Error: Failed to allocate worker queue.\n");
+            return 1;
+        }
+        workers[i].id = i;
+        workers[i].processed = workers[i].steals = 0;
+        workers[i].state = WORKER_UNUSED;
+        workers[i].joinable = 0;
+        pthread_mutex_init(&workers[i].latency_mutex, NULL);
+        memset(workers[i].latency, 0, sizeof(workers[i].latency));
+        memset(workers[i].class_latency, 0, sizeof(workers[i].class_latency));
+        workers[i].batches = workers[i].batch_reads = workers[i].batch_writes = workers[i].unbatched_calls = 0;
+        workers[i].batch = NULL;
+        workers[i].batch_refs = NULL;
+        workers[i].batch_accts = NULL;
+        workers[i].coros = NULL;
+        workers[i].coro_events = workers[i].coro_parked = 0;
+        workers[i].coro_peak = 0;
+        workers[i].coro_switches = workers[i].coro_parks = 0;
+        if (exec_mode == EXEC_CORO && !coro_alloc(&workers[i])) {
+            fprintf(stderr, "Error: Failed to allocate coroutine stacks.\n");
+            return 1;
+        }
+        if (exec_mode == EXEC_BATCH) {
+            workers[i].batch = (struct request **)malloc(batch_size * sizeof(struct request *));
+            workers[i].batch_refs = (struct trans *)malloc(batch_size * MAX_TRANS * sizeof(struct trans));
+            workers[i].batch_accts = (struct batch_account *)malloc(batch_size * MAX_TRANS * sizeof(struct batch_account));
+            if (!workers[i].batch || !workers[i].batch_refs || !workers[i].batch_accts) {
+                fprintf(stderr, "Error: Failed to allocate batch buffers.\n");
+                return 1;
+            }
+        }
+    }
+    int initial_workers = pool_max_workers ? pool_min_workers : NUM_WORKERS;
+    pool_running = pool_peak = pool_logged_running = initial_workers;
+    for (int i = 0; i < initial_workers; i++) {
+        workers[i].state = WORKER_RUNNING;
+        workers[i].joinable = 1;
+        pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+    }
+    if (pool_max_workers) {
+        pthread_mutex_init(&pool_mutex, NULL);
+        pthread_cond_init(&pool_cond, NULL);
+        pthread_cond_init(&pool_exit_cond, NULL);
+        pthread_create(&pool_thread, NULL, pool_thread_routine, NULL);
     }
 
     // 4. Input Loop (Producer)
-    char input_line[1024];
-    while (request_queue.end_flag == 0 && fgets(input_line, sizeof(input_line), stdin) != NULL) {
-        struct request *req = parse_input(input_line, request_queue.next_request_id);
-        
-        if (req != NULL) {
-            gettimeofday(&req->starttime, NULL); 
-            
-            if (req->request_type == 'E') {
-                enqueue_request(req); 
-                break;
-            } else {
-                enqueue_request(req);
-                printf("< ID %d\n", req->request_id);
-                request_queue.next_request_id++;
-            }
-        }
+    if (num_listeners > 0) {
+        run_listener();
+    } else {
+        run_input_loop();
     }
     
     // 5. Final Cleanup and Exit
     request_queue.end_flag = 1; 
-    pthread_cond_broadcast(&queue_cond); 
+    close_request_queue();
     
+    if (pool_max_workers) {
+        pool_shutdown();
+    }
     for (int i = 0; i < NUM_WORKERS; i++) {
-        pthread_join(workers[i], NULL);
+        if (workers[i].joinable) pthread_join(workers[i].thread, NULL);
+    }
+    stop_result_writer();
+    if (hot_threshold) {
+        hot_finish();
+    }
+    if (num_listeners > 0) {
+        net_shutdown();
+    } else {
+        report_io_syscalls();
     }
+    report_request_pool();
+    report_latency();
     
+    if (wal_fd >= 0) {
+        wal_shutdown();
+    }
+    if (cache_mode != CACHE_OFF) {
+        cache_shutdown();
+    }
+    if (async_io_threads) {
+        bank_async_stop();
+        report_async_io();
+    }
+    if (check_mode == CHECK_SEQLOCK) {
+        report_seqlock_stats();
+    }
+    if (check_mode == CHECK_MVCC) {
+        report_mvcc_stats();
+    }
+    if (snapshot_path != NULL) {
+        report_snapshot_stats();
+    }
+    if (queue_backend == QUEUE_STEAL) {
+        report_worker_stats();
+    }
+    if (exec_mode == EXEC_BATCH) {
+        report_batch_stats();
+    }
+    if (exec_mode == EXEC_OCC) {
+        report_occ_stats();
+    }
+    if (exec_mode == EXEC_ORDERED) {
+        report_order_stats();
+    }
+    if (exec_mode == EXEC_CORO) {
+        report_coro_stats();
+    }
+    if (hot_threshold) {
+        report_hot_stats();
+    }
+    if (priority_enabled || deadline_requests > 0) {
+        report_priority();
+    }
+    if (lockprof_enabled) {
+        report_lock_profile(lockprof_path);
+    }
+    if (exec_mode == EXEC_PARTITION) {
+        long total = single_shard_requests + multi_shard_requests;
+        fprintf(stderr, "Partitioned: %ld single-shard (lock-free), %ld multi-shard (%.1f%% coordinated)\n",
+                single_shard_requests, multi_shard_requests,
+                total ? 100.0 * multi_shard_requests / total : 0.0);
+    }
+
     // Final resource cleanup
+    for (int i = 0; i < NUM_WORKERS; i++) {
+        free(workers[i].deque.items);
+        ring_destroy(workers[i].inbox);
+        free(workers[i].batch);
+        free(workers[i].batch_refs);
+        free(workers[i].batch_accts);
+        if (workers[i].coros) coro_free(&workers[i]);
+    }
+    free(workers);
+    free(account_next_ticket);
+    free(account_now_serving);
+    free(cache_values);
+    free(cache_state);
+    free(account_seq);
+    free(account_last);
+    for (int k = 0; k < num_hot_accounts; k++) {
+        free(hot_accounts[k].slots);
+    }
+    free(account_contention);
+    free(account_hot);
+    mvcc_destroy(account_versions);
+    free(account_snap_epoch);
+    free(snapshot_copy);
+    free(snapshot_values);
+    free(account_locks);
+    free(account_lock_profiles);
+    proto_reader_close(input_reader);
+    if (uring_in.ring != NULL) uring_input_close();
+    if (input_fd != STDIN_FILENO) close(input_fd);
+    ring_destroy(request_ring);
+    free_request_pool();
+    if (store_path != NULL) {
+        mmap_accounts_close();
+    }
     free_accounts();
     fclose(output_file);
     return 0;
@@ -0,0 +1,696 @@
+/**
+ * Bank server benchmark driver.
+ *
+ * Generates a request workload, pipes it into one or more bank server
+ * command lines as fast as they accept it, waits for END, and summarizes the
+ * output file of each run. Unlike Project2Test there are no fixed waits
+ * (only the gaps between bursts of the bursty workload), so the wall time is
+ * the time the server needed.
+ *
+ *   $ ./bankbench "./appserver" "./appserver --exec=partition"
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+
+// generate a random number between lower (inclusive) and upper (exclusive)
+#define RAND(lower, upper) ( (rand() % (upper - lower)) + lower )
+
+#define MAX(A, B) (A > B? A : B)
+#define MIN(A, B) (A < B? A : B)
+
+/* same constants as Project2Test.c */
+#define AMOUNT_INITIAL_DEPOSIT 10000
+#define MIN_RANDOM_TRANS 300
+#define MAX_RANDOM_TRANS 1000
+#define RNG_SEED 5
+
+#define MAX_LINE 300
+#define PAUSE_PREFIX "#PAUSE "	/* workload line: stop feeding the server for N ms */
+#define BURST_SIZE 100
+#define BURST_GAP_MS 1000
+
+struct workload {
+	char **lines;
+	int count, capacity;
+	long expected_sum;	// sum of balances if run serially
+	int sum_from_id;	// only CHECKs with this request ID or later are summed
+	int num_trans, num_check;
+	int num_pauses;		// PAUSE_PREFIX lines, which are not requests
+};
+
+struct run_result {
+	double wall;
+	int num_results, num_ok, num_isf, num_bal;
+	int num_expired;	/* answered EXPIRED (--deadline-miss=drop), no latency kept */
+	long balance_sum;
+	double *trans_latency, *check_latency;
+	int num_trans_latency, num_check_latency;
+};
+
+/* benchmark parameters */
+int num_workers = 10;
+int server_workers = 0;		/* passed to the servers instead of num_workers if set */
+int num_accounts = 1000;
+char *output_path = "bench_out.txt";
+char *workload_name = "p2test";
+
+void add_line(struct workload *w, char *line)
+{
+	if (w->count == w->capacity) {
+		w->capacity = w->capacity ? w->capacity * 2 : 1024;
+		w->lines = (char **) realloc(w->lines, w->capacity * sizeof(char *));
+	}
+	w->lines[w->count++] = strdup(line);
+}
+
+void add_pause(struct workload *w, int ms)
+{
+	char line[MAX_LINE];
+	sprintf(line, PAUSE_PREFIX "%d", ms);
+	add_line(w, line);
+	w->num_pauses++;
+}
+
+/*
+ * Project2Test's workload: initial deposits in groups of 10 accounts, then
+ * 300..1000 random TRANS of 1..6 accounts (1% forced ISF), then one CHECK
+ * per account. Uses the same seed, so the requests are the same.
+ */
+void gen_p2test(struct workload *w)
+{
+	char request[MAX_LINE], part[25];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	int i, j;
+
+	for (i = 0; i < num_accounts; i += 10) {
+		sprintf(request, "TRANS");
+		for (j = i; j < i + 10 && j < num_accounts; j++) {
+			sprintf(part, " %d %d", j + 1, AMOUNT_INITIAL_DEPOSIT);
+			strcat(request, part);
+			balances[j] = AMOUNT_INITIAL_DEPOSIT;
+		}
+		add_line(w, request);
+		w->num_trans++;
+	}
+
+	int num_trans = MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3);
+	num_trans = MIN(MAX_RANDOM_TRANS, num_trans);
+	srand(RNG_SEED);
+
+	int num_isf = num_trans / 100;
+	if (num_trans > 1 && num_isf == 0)
+		num_isf = 1;
+	char *should_isf = (char *) calloc(num_trans, sizeof(char));
+	while (num_isf > 0) {
+		i = RAND(0, num_trans);
+		if (!should_isf[i]) {
+			should_isf[i] = 1;
+			num_isf--;
+		}
+	}
+
+	char *acc_included = (char *) calloc(num_accounts, sizeof(char));
+	for (i = 0; i < num_trans; i++) {
+		int num_pairs = should_isf[i] ? 6 : RAND(1, 7);
+		int acc_ids[6];
+		sprintf(request, "TRANS");
+		for (j = 0; j < num_pairs; j++) {
+			int acc_id = RAND(0, num_accounts);
+			if (acc_included[acc_id]) {
+				j--;
+				continue;
+			}
+			acc_included[acc_id] = 1;
+			acc_ids[j] = acc_id;
+
+			int amount = balances[acc_id] - 2 * RAND(0, balances[acc_id] + 1);
+			if (amount == 0)
+				amount += RAND(1, AMOUNT_INITIAL_DEPOSIT / 2);
+			if (!should_isf[i])
+				balances[acc_id] += amount;
+			else if (j == 2)
+				amount -= 10 * balances[acc_id];
+			sprintf(part, " %d %d", acc_id + 1, amount);
+			strcat(request, part);
+		}
+		add_line(w, request);
+		w->num_trans++;
+		for (j = 0; j < num_pairs; j++)
+			acc_included[acc_ids[j]] = 0;
+	}
+
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+
+	free(balances);
+	free(should_isf);
+	free(acc_included);
+}
+
+/*
+ * Mostly single-shard traffic: deposits and final CHECKs as in p2test, but
+ * 90% of the random TRANS only touch accounts within one block of
+ * accounts/workers consecutive IDs (one appserver --exec=partition shard).
+ */
+void gen_local(struct workload *w)
+{
+	char request[MAX_LINE], part[25];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	char *acc_included = (char *) calloc(num_accounts, sizeof(char));
+	int block = (num_accounts + num_workers - 1) / num_workers;
+	int i, j;
+
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "TRANS %d %d", i + 1, AMOUNT_INITIAL_DEPOSIT);
+		add_line(w, request);
+		w->num_trans++;
+		balances[i] = AMOUNT_INITIAL_DEPOSIT;
+	}
+
+	srand(RNG_SEED);
+	int num_trans = MIN(MAX_RANDOM_TRANS, MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3));
+	for (i = 0; i < num_trans; i++) {
+		int local = RAND(0, 10) != 0;
+		int first = local ? RAND(0, num_workers) * block : 0;
+		int range = local ? MIN(block, num_accounts - first) : num_accounts;
+		int num_pairs = MIN(RAND(1, 7), range);
+		int acc_ids[6];
+
+		sprintf(request, "TRANS");
+		for (j = 0; j < num_pairs; j++) {
+			int acc_id = first + RAND(0, range);
+			if (acc_included[acc_id]) {
+				j--;
+				continue;
+			}
+			acc_included[acc_id] = 1;
+			acc_ids[j] = acc_id;
+			int amount = balances[acc_id] - 2 * RAND(0, balances[acc_id] + 1);
+			if (amount == 0)
+				amount = 1;
+			balances[acc_id] += amount;
+			sprintf(part, " %d %d", acc_id + 1, amount);
+			strcat(request, part);
+		}
+		add_line(w, request);
+		w->num_trans++;
+		for (j = 0; j < num_pairs; j++)
+			acc_included[acc_ids[j]] = 0;
+	}
+
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+	free(balances);
+	free(acc_included);
+}
+
+/*
+ * CHECK-heavy traffic on a few hot accounts: after the deposits, every
+ * transfer between two of the hottest 10% of accounts is followed by three
+ * CHECKs of hot accounts, so reads keep meeting in-flight writes. Ends with
+ * one CHECK per account; only that sweep is compared against the serial sum.
+ */
+void gen_mixed(struct workload *w)
+{
+	char request[MAX_LINE], part[25];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	int hot = MAX(2, num_accounts / 10);
+	int i, j;
+
+	for (i = 0; i < num_accounts; i += 10) {
+		sprintf(request, "TRANS");
+		for (j = i; j < i + 10 && j < num_accounts; j++) {
+			sprintf(part, " %d %d", j + 1, AMOUNT_INITIAL_DEPOSIT);
+			strcat(request, part);
+			balances[j] = AMOUNT_INITIAL_DEPOSIT;
+		}
+		add_line(w, request);
+		w->num_trans++;
+	}
+
+	srand(RNG_SEED);
+	int num_trans = MIN(MAX_RANDOM_TRANS, MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3));
+	for (i = 0; i < num_trans; i++) {
+		int from = RAND(0, hot), to = RAND(0, hot - 1);
+		if (to >= from)
+			to++;
+		int amount = RAND(0, balances[from] / 2 + 1);
+		balances[from] -= amount;
+		balances[to] += amount;
+		sprintf(request, "TRANS %d %d %d %d", from + 1, -amount, to + 1, amount);
+		add_line(w, request);
+		w->num_trans++;
+
+		for (j = 0; j < 3; j++) {
+			sprintf(request, "CHECK %d", RAND(0, hot) + 1);
+			add_line(w, request);
+			w->num_check++;
+		}
+	}
+
+	w->sum_from_id = w->count + 1;
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+	free(balances);
+}
+
+/*
+ * Transfers of 2..4 accounts: each of the first accounts pays part of its
+ * balance into the last one. With hot_pct > 0, that percentage of transfers
+ * only touches the hottest 1% of accounts (at least 4), so their TRANS keep
+ * conflicting. Ends with one CHECK per account, compared against the serial sum.
+ */
+void gen_transfers(struct workload *w, int hot_pct)
+{
+	char request[MAX_LINE], part[25];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	char *acc_included = (char *) calloc(num_accounts, sizeof(char));
+	int hot = MIN(num_accounts, MAX(4, num_accounts / 100));
+	int i, j;
+
+	for (i = 0; i < num_accounts; i += 10) {
+		sprintf(request, "TRANS");
+		for (j = i; j < i + 10 && j < num_accounts; j++) {
+			sprintf(part, " %d %d", j + 1, AMOUNT_INITIAL_DEPOSIT);
+			strcat(request, part);
+			balances[j] = AMOUNT_INITIAL_DEPOSIT;
+		}
+		add_line(w, request);
+		w->num_trans++;
+	}
+
+	srand(RNG_SEED);
+	int num_trans = MIN(MAX_RANDOM_TRANS, MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3));
+	for (i = 0; i < num_trans; i++) {
+		int range = RAND(0, 100) < hot_pct ? hot : num_accounts;
+		int num_pairs = MIN(RAND(2, 5), range);
+		int acc_ids[4], moved = 0;
+
+		sprintf(request, "TRANS");
+		for (j = 0; j < num_pairs; j++) {
+			int acc_id = RAND(0, range);
+			if (acc_included[acc_id]) {
+				j--;
+				continue;
+			}
+			acc_included[acc_id] = 1;
+			acc_ids[j] = acc_id;
+			int amount = j < num_pairs - 1 ? -RAND(1, balances[acc_id] / 4 + 2) : moved;
+			if (balances[acc_id] + amount < 0)
+				amount = 0;
+			balances[acc_id] += amount;
+			moved -= amount;
+			sprintf(part, " %d %d", acc_id + 1, amount);
+			strcat(request, part);
+		}
+		add_line(w, request);
+		w->num_trans++;
+		for (j = 0; j < num_pairs; j++)
+			acc_included[acc_ids[j]] = 0;
+	}
+
+	w->sum_from_id = w->count + 1;
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+	free(balances);
+	free(acc_included);
+}
+
+void gen_uniform(struct workload *w)
+{
+	gen_transfers(w, 0);
+}
+
+void gen_hot(struct workload *w)
+{
+	gen_transfers(w, 90);
+}
+
+/*
+ * The uniform transfers in bursts of BURST_SIZE requests, BURST_GAP_MS apart,
+ * so the server sees floods of work with idle stretches in between. The
+ * final CHECKs arrive as one burst after the last gap.
+ */
+void gen_bursty(struct workload *w)
+{
+	struct workload all;
+	memset(&all, 0, sizeof(all));
+	gen_transfers(&all, 0);
+
+	int first_check = all.sum_from_id - 1;	/* line index of the first CHECK */
+	for (int i = 0; i < all.count; i++) {
+		if (i == first_check || (i > 0 && i < first_check && i % BURST_SIZE == 0))
+			add_pause(w, BURST_GAP_MS);
+		add_line(w, all.lines[i]);
+		free(all.lines[i]);
+	}
+	w->num_trans = all.num_trans;
+	w->num_check = all.num_check;
+	w->expected_sum = all.expected_sum;
+	w->sum_from_id = all.sum_from_id;
+	free(all.lines);
+}
+
+/*
+ * Payments into a handful of treasury accounts (IDs 1..4): each TRANS moves a
+ * small amount from a random account into one of them, and one in twenty has
+ * a treasury pay out instead. No TRANS can run short, so the final balances
+ * do not depend on the execution order.
+ */
+void gen_treasury(struct workload *w)
+{
+	char request[MAX_LINE];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	int treasuries = MIN(4, num_accounts - 1);
+	int i;
+
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "TRANS %d %d", i + 1, AMOUNT_INITIAL_DEPOSIT);
+		add_line(w, request);
+		w->num_trans++;
+		balances[i] = AMOUNT_INITIAL_DEPOSIT;
+	}
+
+	srand(RNG_SEED);
+	int num_trans = MIN(MAX_RANDOM_TRANS, MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3));
+	for (i = 0; i < num_trans; i++) {
+		int treasury = RAND(0, treasuries);
+		int other = RAND(treasuries, num_accounts);
+		int payout = RAND(0, 20) == 0;
+		int amount = payout ? RAND(1, 101) : RAND(1, 21);
+		int from = payout ? treasury : other, to = payout ? other : treasury;
+		balances[from] -= amount;
+		balances[to] += amount;
+		sprintf(request, "TRANS %d %d %d %d", from + 1, -amount, to + 1, amount);
+		add_line(w, request);
+		w->num_trans++;
+	}
+
+	w->sum_from_id = w->count + 1;
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+	free(balances);
+}
+
+/*
+ * Large transfers with CHECKs in between: each TRANS moves money from 4..7
+ * accounts into one more, and is followed by a CHECK of a random account, so
+ * short reads queue up behind long writes. Ends with one CHECK per account,
+ * compared against the serial sum.
+ */
+void gen_rush(struct workload *w)
+{
+	char request[MAX_LINE], part[25];
+	int *balances = (int *) calloc(num_accounts, sizeof(int));
+	char *acc_included = (char *) calloc(num_accounts, sizeof(char));
+	int i, j;
+
+	for (i = 0; i < num_accounts; i += 10) {
+		sprintf(request, "TRANS");
+		for (j = i; j < i + 10 && j < num_accounts; j++) {
+			sprintf(part, " %d %d", j + 1, AMOUNT_INITIAL_DEPOSIT);
+			strcat(request, part);
+			balances[j] = AMOUNT_INITIAL_DEPOSIT;
+		}
+		add_line(w, request);
+		w->num_trans++;
+	}
+
+	srand(RNG_SEED);
+	int num_trans = MIN(MAX_RANDOM_TRANS, MAX(MIN_RANDOM_TRANS, num_accounts / num_workers * 3));
+	for (i = 0; i < num_trans; i++) {
+		int num_pairs = MIN(RAND(5, 9), num_accounts);
+		int acc_ids[8], moved = 0;
+
+		sprintf(request, "TRANS");
+		for (j = 0; j < num_pairs; j++) {
+			int acc_id = RAND(0, num_accounts);
+			if (acc_included[acc_id]) {
+				j--;
+				continue;
+			}
+			acc_included[acc_id] = 1;
+			acc_ids[j] = acc_id;
+			int amount = j < num_pairs - 1 ? -RAND(1, balances[acc_id] / 8 + 2) : moved;
+			if (balances[acc_id] + amount < 0)
+				amount = 0;
+			balances[acc_id] += amount;
+			moved -= amount;
+			sprintf(part, " %d %d", acc_id + 1, amount);
+			strcat(request, part);
+		}
+		add_line(w, request);
+		w->num_trans++;
+		for (j = 0; j < num_pairs; j++)
+			acc_included[acc_ids[j]] = 0;
+
+		sprintf(request, "CHECK %d", RAND(0, num_accounts) + 1);
+		add_line(w, request);
+		w->num_check++;
+	}
+
+	w->sum_from_id = w->count + 1;
+	for (i = 0; i < num_accounts; i++) {
+		sprintf(request, "CHECK %d", i + 1);
+		add_line(w, request);
+		w->num_check++;
+		w->expected_sum += balances[i];
+	}
+	free(balances);
+	free(acc_included);
+}
+
+struct generator {
+	char *name;
+	void (*generate)(struct workload *);
+	char *description;
+};
+
+struct generator generators[] = {
+	{"p2test", gen_p2test, "Project2Test: deposits, random TRANS, CHECK every account"},
+	{"local",  gen_local,  "like p2test, but 90% of TRANS stay within one account shard"},
+	{"mixed",  gen_mixed,  "hot-account transfers, each followed by three CHECKs"},
+	{"uniform", gen_uniform, "2..4 account transfers spread over every account (few conflicts)"},
+	{"hot",    gen_hot,    "the same transfers, 90% of them within the hottest 1% of accounts"},
+	{"treasury", gen_treasury, "small payments into 4 treasury accounts, 5% paid back out"},
+	{"bursty", gen_bursty, "uniform, in bursts of 100 requests 1 s apart"},
+	{"rush",   gen_rush,   "5..8 account transfers, each followed by a CHECK (priority classes)"},
+	{NULL, NULL, NULL}
+};
+
+double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int compare_double(const void *a, const void *b)
+{
+	double x = *(double *) a, y = *(double *) b;
+	return (x > y) - (x < y);
+}
+
+double percentile(double *values, int count, double p)
+{
+	if (count == 0)
+		return 0;
+	int index = (int) (p / 100.0 * (count - 1) + 0.5);
+	return values[index];
+}
+
+/* Parse "<id> OK|ISF <acc>|BAL <bal>|EXPIRED TIME <start> <end> [LATE]" lines */
+int read_results(struct run_result *r, struct workload *w)
+{
+	int max_results = w->count - w->num_pauses;
+	FILE *out = fopen(output_path, "r");
+	if (out == NULL) {
+		printf("[Error] Cannot open output file %s\n", output_path);
+		return 0;
+	}
+	r->trans_latency = (double *) malloc(max_results * sizeof(double));
+	r->check_latency = (double *) malloc(max_results * sizeof(double));
+
+	char line[MAX_LINE], keyword[16];
+	while (fgets(line, sizeof(line), out) != NULL) {
+		int id, value = 0;
+		double start, end;
+		if (sscanf(line, "%d %15s", &id, keyword) != 2)
+			continue;
+		char *time = strstr(line, "TIME ");
+		if (time == NULL || sscanf(time + 5, "%lf %lf", &start, &end) != 2)
+			continue;
+		if (strcmp(keyword, "OK") != 0)
+			sscanf(line, "%*d %*s %d", &value);
+
+		r->num_results++;
+		if (strcmp(keyword, "BAL") == 0) {
+			r->num_bal++;
+			if (id >= w->sum_from_id)
+				r->balance_sum += value;
+			if (r->num_check_latency < max_results)
+				r->check_latency[r->num_check_latency++] = end - start;
+		} else if (strcmp(keyword, "EXPIRED") == 0) {
+			r->num_expired++;
+		} else {
+			if (strcmp(keyword, "OK") == 0)
+				r->num_ok++;
+			else if (strcmp(keyword, "ISF") == 0)
+				r->num_isf++;
+			if (r->num_trans_latency < max_results)
+				r->trans_latency[r->num_trans_latency++] = end - start;
+		}
+	}
+	fclose(out);
+	qsort(r->trans_latency, r->num_trans_latency, sizeof(double), compare_double);
+	qsort(r->check_latency, r->num_check_latency, sizeof(double), compare_double);
+	return 1;
+}
+
+int run_server(char *server, struct workload *w, struct run_result *r)
+{
+	char command[1024];
+	memset(r, 0, sizeof(*r));
+	remove(output_path);
+	snprintf(command, sizeof(command), "%s %d %d %s > /dev/null",
+		server, server_workers ? server_workers : num_workers, num_accounts, output_path);
+
+	double start = now();
+	FILE *pipe = popen(command, "w");
+	if (pipe == NULL) {
+		printf("Error: popen(%s) failed.\n", command);
+		return 0;
+	}
+	for (int i = 0; i < w->count; i++) {
+		if (strncmp(w->lines[i], PAUSE_PREFIX, strlen(PAUSE_PREFIX)) == 0) {
+			fflush(pipe);
+			usleep(atoi(w->lines[i] + strlen(PAUSE_PREFIX)) * 1000);
+			continue;
+		}
+		fputs(w->lines[i], pipe);
+		fputc('\n', pipe);
+	}
+	fputs("END\n", pipe);
+	int status = pclose(pipe);
+	r->wall = now() - start;
+
+	if (status != 0) {
+		printf("Error: '%s' exited with status %d\n", server, status);
+		return 0;
+	}
+	return read_results(r, w);
+}
+
+void print_result(char *server, struct workload *w, struct run_result *r)
+{
+	printf("%-40s %8.2f %9.0f %8.1f %8.1f %8.1f %8.1f %5d %s",
+		server, r->wall, r->num_results / r->wall,
+		1000 * percentile(r->trans_latency, r->num_trans_latency, 50),
+		1000 * percentile(r->trans_latency, r->num_trans_latency, 99),
+		1000 * percentile(r->check_latency, r->num_check_latency, 50),
+		1000 * percentile(r->check_latency, r->num_check_latency, 99),
+		r->num_isf,
+		r->num_results != w->count - w->num_pauses ? "MISSING" :
+		r->balance_sum == w->expected_sum ? "match" : "differs");
+	if (r->num_expired > 0)
+		printf(" (%d expired)", r->num_expired);
+	printf("\n");
+}
+
+void print_usage()
+{
+	printf("Usage: ./bankbench [options] \"<server command>\" [\"<server command>\" ...]\n");
+	printf("Each server command is run as: <server command> <workers> <accounts> <output file>\n");
+	printf("Options:\n");
+	printf("  %-18s: %s\n", "--workers=N", "worker threads passed to the server (default 10)");
+	printf("  %-18s: %s\n", "--server-workers=N", "pass N workers to the server instead; --workers then only");
+	printf("  %-18s  %s\n", "", "sizes the workload");
+	printf("  %-18s: %s\n", "--accounts=N", "bank accounts passed to the server (default 1000)");
+	printf("  %-18s: %s\n", "--output=FILE", "server output file (default bench_out.txt)");
+	printf("  %-18s: %s\n", "--workload=NAME", "request mix (default p2test):");
+	for (int i = 0; generators[i].name != NULL; i++)
+		printf("  %18s  %-8s %s\n", "", generators[i].name, generators[i].description);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"workers",  required_argument, NULL, 'w'},
+		{"server-workers", required_argument, NULL, 's'},
+		{"accounts", required_argument, NULL, 'a'},
+		{"output",   required_argument, NULL, 'o'},
+		{"workload", required_argument, NULL, 'l'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'w': num_workers = atoi(optarg); break;
+		case 's': server_workers = atoi(optarg); break;
+		case 'a': num_accounts = atoi(optarg); break;
+		case 'o': output_path = optarg; break;
+		case 'l': workload_name = optarg; break;
+		default: print_usage(); return 1;
+		}
+	}
+	if (optind == argc || num_workers < 1 || server_workers < 0 || num_accounts < 1) {
+		print_usage();
+		return 1;
+	}
+
+	struct generator *gen = NULL;
+	for (int i = 0; generators[i].name != NULL; i++)
+		if (strcmp(generators[i].name, workload_name) == 0)
+			gen = &generators[i];
+	if (gen == NULL) {
+		print_usage();
+		return 1;
+	}
+
+	struct workload w;
+	memset(&w, 0, sizeof(w));
+	gen->generate(&w);
+	printf("Workload %s: %d TRANS, %d CHECK, %d workers, %d accounts\n\n",
+		gen->name, w.num_trans, w.num_check, server_workers ? server_workers : num_workers, num_accounts);
+	printf("%-40s %8s %9s %8s %8s %8s %8s %5s %s\n", "server", "wall(s)", "req/s",
+		"T p50ms", "T p99ms", "C p50ms", "C p99ms", "ISF", "balances");
+
+	for (int i = optind; i < argc; i++) {
+		struct run_result r;
+		if (run_server(argv[i], &w, &r))
+			print_result(argv[i], &w, &r);
+		free(r.trans_latency);
+		free(r.check_latency);
+	}
+
+	for (int i = 0; i < w.count; i++)
+		free(w.lines[i]);
+	free(w.lines);
+	return 0;
+}
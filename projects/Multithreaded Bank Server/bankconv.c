@@ -0,0 +1,105 @@
+/**
+ * Request trace converter.
+ *
+ * Turns a text trace (the CHECK/TRANS/END lines Project2Test and bankbench
+ * send to the server) into the binary framing of protocol.h, or back again,
+ * so large traces can be replayed with ./appserver --input=binary.
+ *
+ *   $ ./bankconv < trace.txt > trace.bin
+ *   $ ./appserver --input=binary --input-file=trace.bin 10 1000 out.txt
+ *   $ ./bankconv --to-text < trace.bin
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include "protocol.h"
+
+#define BLOCK_SIZE (1 << 20)
+
+int text_to_binary(FILE *in, FILE *out)
+{
+	char line[1024];
+	unsigned char frame_buf[PROTO_MAX_FRAME];
+	struct proto_frame frame;
+	long line_no = 0, frames = 0, skipped = 0;
+
+	fwrite(PROTO_MAGIC, 1, PROTO_MAGIC_LEN, out);
+	while (fgets(line, sizeof(line), in) != NULL) {
+		line_no++;
+		int status = proto_parse_text(line, &frame);
+		if (status == 0) continue;
+		if (status < 0) {
+			fprintf(stderr, "bankconv: line %ld is not a request, skipped\n", line_no);
+			skipped++;
+			continue;
+		}
+		fwrite(frame_buf, 1, proto_encode(&frame, frame_buf), out);
+		frames++;
+	}
+	fprintf(stderr, "bankconv: %ld frames written, %ld lines skipped\n", frames, skipped);
+	return 0;
+}
+
+int binary_to_text(FILE *in, FILE *out)
+{
+	struct proto_frame frame;
+	int status;
+
+	struct proto_reader *reader = proto_reader_open(fileno(in), BLOCK_SIZE);
+	if (reader == NULL) {
+		perror("bankconv");
+		return 1;
+	}
+	if (!proto_read_magic(reader)) {
+		fprintf(stderr, "bankconv: input is not a binary request stream\n");
+		proto_reader_close(reader);
+		return 1;
+	}
+	while ((status = proto_read_frame(reader, &frame)) > 0) {
+		proto_print_text(out, &frame);
+		fputc('\n', out);
+	}
+	proto_reader_close(reader);
+	if (status < 0) {
+		fprintf(stderr, "bankconv: corrupt frame, output truncated\n");
+		return 1;
+	}
+	return 0;
+}
+
+void print_usage()
+{
+	fprintf(stderr, "Usage: ./bankconv [--to-text] < input > output\n");
+	fprintf(stderr, "  default    text CHECK/TRANS lines to binary frames\n");
+	fprintf(stderr, "  --to-text  binary frames back to text lines\n");
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"to-text", no_argument, NULL, 't'},
+		{"help",    no_argument, NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int to_text = 0, opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 't': to_text = 1; break;
+		default: print_usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc) {
+		print_usage();
+		return 1;
+	}
+
+	setvbuf(stdout, NULL, _IOFBF, BLOCK_SIZE);
+	if (to_text) return binary_to_text(stdin, stdout);
+	setvbuf(stdin, NULL, _IOFBF, BLOCK_SIZE);
+	return text_to_binary(stdin, stdout);
+}
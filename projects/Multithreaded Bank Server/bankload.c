@@ -0,0 +1,331 @@
+/**
+ * Load generator for ./appserver --listen.
+ *
+ * Opens many client connections from one thread (epoll), keeps a fixed number
+ * of requests in flight on each, and reports throughput and the latency from
+ * sending a request to receiving its result line.
+ *
+ *   $ ./appserver --listen=tcp:7070 10 1000 out.txt &
+ *   $ ./bankload --connect=tcp:7070 --connections=200 --requests=20
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+// generate a random number between lower (inclusive) and upper (exclusive)
+#define RAND(lower, upper) ( (rand() % (upper - lower)) + lower )
+
+#define IN_SIZE 65536
+#define MAX_EVENTS 256
+
+struct pending {
+	int id;			/* request ID from the ack, -1 until acked */
+	double sent;
+};
+
+struct client {
+	int fd;
+	int sent, acked, answered;
+	int done;		/* END sent; waiting for the server to close */
+	struct pending *window;	/* requests in flight, in send order */
+	int window_len;
+	char *out;
+	size_t out_len, out_cap;
+	char in[IN_SIZE];
+	size_t in_len;
+};
+
+/* load parameters */
+char *connect_spec = "tcp:7070";
+int num_connections = 100;
+int requests_per_connection = 100;
+int pipeline_depth = 4;
+int num_accounts = 1000;
+int check_percent = 20;
+
+double *latencies;
+int num_latencies;
+long num_ok, num_isf, num_bal, num_err;
+
+double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int open_connection(const char *spec)
+{
+	int fd;
+	if (strncmp(spec, "tcp:", 4) == 0) {
+		struct sockaddr_in addr;
+		int one = 1;
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(atoi(spec + 4));
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	} else if (strncmp(spec, "unix:", 5) == 0) {
+		struct sockaddr_un addr;
+		if (strlen(spec + 5) >= sizeof(addr.sun_path)) { errno = EINVAL; return -1; }
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		if (fd < 0) return -1;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		strcpy(addr.sun_path, spec + 5);
+		if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) { close(fd); return -1; }
+	} else {
+		errno = EINVAL;
+		return -1;
+	}
+	return fd;
+}
+
+void append(struct client *c, const char *text, int len)
+{
+	if (c->out_len + len > c->out_cap) {
+		c->out_cap = c->out_cap ? c->out_cap * 2 : 4096;
+		c->out = (char *) realloc(c->out, c->out_cap);
+	}
+	memcpy(c->out + c->out_len, text, len);
+	c->out_len += len;
+}
+
+/* queue requests until the pipeline is full, then END after the last one */
+void refill(struct client *c)
+{
+	char line[128];
+	int len;
+
+	while (c->window_len < pipeline_depth && c->sent < requests_per_connection) {
+		if (RAND(0, 100) < check_percent) {
+			len = sprintf(line, "CHECK %d\n", RAND(1, num_accounts + 1));
+		} else {
+			int pairs = RAND(1, 4);
+			len = sprintf(line, "TRANS");
+			for (int i = 0; i < pairs; i++)
+				len += sprintf(line + len, " %d %d", RAND(1, num_accounts + 1), RAND(-100, 101));
+			len += sprintf(line + len, "\n");
+		}
+		append(c, line, len);
+		c->window[c->window_len].id = -1;
+		c->window[c->window_len].sent = now();
+		c->window_len++;
+		c->sent++;
+	}
+	if (!c->done && c->answered == requests_per_connection) {
+		append(c, "END\n", 4);
+		c->done = 1;
+	}
+}
+
+int flush_output(struct client *c)
+{
+	while (c->out_len > 0) {
+		ssize_t n = send(c->fd, c->out, c->out_len, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+		memmove(c->out, c->out + n, c->out_len - n);
+		c->out_len -= n;
+	}
+	return 1;
+}
+
+/* "< ID n" names the oldest unacked request; "n <result> ..." answers one */
+void handle_line(struct client *c, char *line)
+{
+	if (strncmp(line, "< ID ", 5) == 0) {
+		for (int i = 0; i < c->window_len; i++) {
+			if (c->window[i].id == -1) {
+				c->window[i].id = atoi(line + 5);
+				break;
+			}
+		}
+		c->acked++;
+		return;
+	}
+	if (strncmp(line, "ERR", 3) == 0) {
+		fprintf(stderr, "bankload: server said %s\n", line);
+		num_err++;
+		return;
+	}
+
+	int id = atoi(line);
+	char *result = strchr(line, ' ');
+	if (result == NULL) return;
+	result++;
+	if (strncmp(result, "OK", 2) == 0) num_ok++;
+	else if (strncmp(result, "ISF", 3) == 0) num_isf++;
+	else if (strncmp(result, "BAL", 3) == 0) num_bal++;
+
+	for (int i = 0; i < c->window_len; i++) {
+		if (c->window[i].id == id) {
+			latencies[num_latencies++] = now() - c->window[i].sent;
+			c->window[i] = c->window[--c->window_len];
+			c->answered++;
+			return;
+		}
+	}
+}
+
+/* Return 0 once the server has closed the connection */
+int read_input(struct client *c)
+{
+	ssize_t n = recv(c->fd, c->in + c->in_len, IN_SIZE - c->in_len, MSG_DONTWAIT);
+	if (n == 0) return 0;
+	if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK;
+	c->in_len += n;
+
+	char *start = c->in, *eol;
+	while ((eol = memchr(start, '\n', c->in + c->in_len - start)) != NULL) {
+		*eol = '\0';
+		handle_line(c, start);
+		start = eol + 1;
+	}
+	c->in_len -= start - c->in;
+	memmove(c->in, start, c->in_len);
+	return 1;
+}
+
+int compare_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+double percentile(double *sorted, int count, double p)
+{
+	if (count == 0) return 0.0;
+	int i = (int)(p * (count - 1));
+	return sorted[i];
+}
+
+void print_usage()
+{
+	printf("Usage: ./bankload [options]\n");
+	printf("Options:\n");
+	printf("  %-20s: %s\n", "--connect=ADDR", "tcp:PORT (localhost) or unix:PATH (default tcp:7070)");
+	printf("  %-20s: %s\n", "--connections=N", "concurrent client connections (default 100)");
+	printf("  %-20s: %s\n", "--requests=N", "requests sent on each connection (default 100)");
+	printf("  %-20s: %s\n", "--pipeline=N", "requests in flight per connection (default 4)");
+	printf("  %-20s: %s\n", "--accounts=N", "accounts to pick from; match the server (default 1000)");
+	printf("  %-20s: %s\n", "--check-percent=P", "share of CHECK requests (default 20)");
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"connect",       required_argument, NULL, 'c'},
+		{"connections",   required_argument, NULL, 'n'},
+		{"requests",      required_argument, NULL, 'r'},
+		{"pipeline",      required_argument, NULL, 'p'},
+		{"accounts",      required_argument, NULL, 'a'},
+		{"check-percent", required_argument, NULL, 'k'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'c': connect_spec = optarg; break;
+		case 'n': num_connections = atoi(optarg); break;
+		case 'r': requests_per_connection = atoi(optarg); break;
+		case 'p': pipeline_depth = atoi(optarg); break;
+		case 'a': num_accounts = atoi(optarg); break;
+		case 'k': check_percent = atoi(optarg); break;
+		default: print_usage(); return 1;
+		}
+	}
+	if (optind != argc || num_connections < 1 || requests_per_connection < 1 ||
+	    pipeline_depth < 1 || num_accounts < 1) {
+		print_usage();
+		return 1;
+	}
+
+	srand(5);
+	int epfd = epoll_create1(0);
+	struct client *clients = (struct client *) calloc(num_connections, sizeof(struct client));
+	latencies = (double *) malloc((size_t)num_connections * requests_per_connection * sizeof(double));
+	if (epfd < 0 || clients == NULL || latencies == NULL) {
+		perror("bankload");
+		return 1;
+	}
+
+	double start = now();
+	for (int i = 0; i < num_connections; i++) {
+		struct client *c = &clients[i];
+		c->fd = open_connection(connect_spec);
+		if (c->fd < 0) {
+			fprintf(stderr, "bankload: cannot connect to %s: %s\n", connect_spec, strerror(errno));
+			return 1;
+		}
+		c->window = (struct pending *) malloc(pipeline_depth * sizeof(struct pending));
+		struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT, .data.ptr = c };
+		epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+		refill(c);
+		flush_output(c);
+	}
+
+	int open_clients = num_connections;
+	struct epoll_event events[MAX_EVENTS];
+	while (open_clients > 0) {
+		int n = epoll_wait(epfd, events, MAX_EVENTS, -1);
+		if (n < 0 && errno == EINTR) continue;
+		if (n < 0) { perror("epoll_wait"); return 1; }
+		for (int i = 0; i < n; i++) {
+			struct client *c = (struct client *) events[i].data.ptr;
+			int alive = 1;
+			if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+				alive = read_input(c);
+			if (alive) {
+				refill(c);
+				alive = flush_output(c);
+			}
+			if (!alive) {
+				if (c->answered < c->sent)
+					fprintf(stderr, "bankload: connection closed with %d replies missing\n",
+						c->sent - c->answered);
+				epoll_ctl(epfd, EPOLL_CTL_DEL, c->fd, NULL);
+				close(c->fd);
+				open_clients--;
+				continue;
+			}
+			struct epoll_event ev = { .events = EPOLLIN | (c->out_len ? EPOLLOUT : 0), .data.ptr = c };
+			epoll_ctl(epfd, EPOLL_CTL_MOD, c->fd, &ev);
+		}
+	}
+	double wall = now() - start;
+
+	qsort(latencies, num_latencies, sizeof(double), compare_double);
+	printf("%d connections x %d requests (pipeline %d) to %s\n",
+		num_connections, requests_per_connection, pipeline_depth, connect_spec);
+	printf("%d replies in %.2f s: %.0f req/s\n", num_latencies, wall, num_latencies / wall);
+	printf("latency ms: p50 %.1f  p90 %.1f  p99 %.1f  max %.1f\n",
+		1000 * percentile(latencies, num_latencies, 0.50),
+		1000 * percentile(latencies, num_latencies, 0.90),
+		1000 * percentile(latencies, num_latencies, 0.99),
+		1000 * percentile(latencies, num_latencies, 1.0));
+	printf("results: %ld OK, %ld ISF, %ld BAL, %ld ERR\n", num_ok, num_isf, num_bal, num_err);
+
+	for (int i = 0; i < num_connections; i++) {
+		free(clients[i].window);
+		free(clients[i].out);
+	}
+	free(clients);
+	free(latencies);
+	close(epfd);
+	return num_latencies == num_connections * requests_per_connection ? 0 : 1;
+}
@@ -0,0 +1,214 @@
+/**
+ * Executor agreement test.
+ *
+ * Sends the same requests to ./appserver once per --exec mode and checks
+ * every OK, ISF and BAL against a serial model of the baseline server: a
+ * TRANS reads all its accounts first, fails on the first entry that would go
+ * negative, and otherwise writes each entry's original balance plus its
+ * amount, so an account named twice keeps only its last write. Many TRANS
+ * name an account more than once. The server runs with one worker, so every
+ * mode must reproduce the serial results exactly. Exits 1 on any mismatch,
+ * so it can gate a build.
+ *
+ *   $ ./exectest
+ *   $ ./exectest --server="./appserver --async-io=4"
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#define NUM_ACCOUNTS 8
+#define NUM_RANDOM 40		/* random TRANS after the fixed ones */
+#define MAX_PARTS 4		/* entries per random TRANS */
+#define MAX_LINE 256
+#define RNG_SEED 11
+
+char *server = "./appserver";
+char *output_path = "exectest_out.txt";
+
+struct request {
+	char line[MAX_LINE];
+	char expected[32];	/* "OK", "ISF <acc>" or "BAL <balance>" */
+};
+
+struct request *requests;
+int num_requests;
+
+/* TRANS that repeat an account, run first (account 1 starts at 0) */
+const char *fixed[] = {
+	"TRANS 1 100",
+	"TRANS 1 10 1 -20",		/* 80, not 90 */
+	"CHECK 1",
+	"TRANS 1 -90 1 5",		/* ISF 1: the first entry is checked against 80 */
+	"TRANS 2 50 2 -60",		/* ISF 2 */
+	"TRANS 3 30 3 -10 3 20",	/* 20 */
+	"TRANS 1 -80 2 40 1 -30",	/* ISF 1 on the third entry; nothing written */
+	"TRANS 1 -50 2 40 1 5",		/* 85, 40 */
+	"CHECK 1",
+	"CHECK 2",
+	"CHECK 3",
+};
+
+void add_request(const char *line)
+{
+	requests = realloc(requests, (num_requests + 1) * sizeof(struct request));
+	snprintf(requests[num_requests++].line, MAX_LINE, "%s", line);
+}
+
+/* Fill in the expected result of every request */
+void run_model()
+{
+	int balances[NUM_ACCOUNTS + 1] = {0};
+
+	for (int r = 0; r < num_requests; r++) {
+		struct request *req = &requests[r];
+		int ids[MAX_LINE / 4], amounts[MAX_LINE / 4], n = 0, offset = 0, used;
+		char *args = req->line + 6;
+
+		if (strncmp(req->line, "CHECK", 5) == 0) {
+			sprintf(req->expected, "BAL %d", balances[atoi(args)]);
+			continue;
+		}
+		while (sscanf(args + offset, "%d %d%n", &ids[n], &amounts[n], &used) == 2) {
+			offset += used;
+			n++;
+		}
+		int original[MAX_LINE / 4], isf = -1;
+		for (int i = 0; i < n; i++)
+			original[i] = balances[ids[i]];
+		for (int i = 0; i < n && isf < 0; i++) {
+			if (original[i] + amounts[i] < 0) isf = ids[i];
+		}
+		if (isf >= 0) {
+			sprintf(req->expected, "ISF %d", isf);
+			continue;
+		}
+		for (int i = 0; i < n; i++)
+			balances[ids[i]] = original[i] + amounts[i];
+		sprintf(req->expected, "OK");
+	}
+}
+
+/* Random TRANS over a few accounts, most of them naming one account twice */
+void generate()
+{
+	char line[MAX_LINE], part[32];
+
+	for (size_t i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++)
+		add_request(fixed[i]);
+	srand(RNG_SEED);
+	for (int r = 0; r < NUM_RANDOM; r++) {
+		int parts = 1 + rand() % MAX_PARTS;
+		sprintf(line, "TRANS");
+		for (int i = 0; i < parts; i++) {
+			sprintf(part, " %d %d", 1 + rand() % 3, rand() % 200 - 80);
+			strcat(line, part);
+		}
+		add_request(line);
+		if (r % 4 == 3) {
+			sprintf(line, "CHECK %d", 1 + rand() % 3);
+			add_request(line);
+		}
+	}
+	for (int id = 1; id <= NUM_ACCOUNTS; id++) {
+		sprintf(line, "CHECK %d", id);
+		add_request(line);
+	}
+}
+
+/* Run one server command and count the results that differ from the model */
+int run_mode(const char *options, int workers)
+{
+	char command[1024];
+	snprintf(command, sizeof(command), "%s %s %d %d %s > /dev/null 2>&1",
+		 server, options, workers, NUM_ACCOUNTS, output_path);
+	remove(output_path);
+
+	FILE *pipe = popen(command, "w");
+	if (pipe == NULL) {
+		printf("  FAILED: cannot run %s\n", command);
+		return 1;
+	}
+	for (int r = 0; r < num_requests; r++)
+		fprintf(pipe, "%s\n", requests[r].line);
+	fprintf(pipe, "END\n");
+	if (pclose(pipe) != 0) {
+		printf("  FAILED: %s exited with an error\n", command);
+		return 1;
+	}
+
+	FILE *out = fopen(output_path, "r");
+	if (out == NULL) {
+		printf("  FAILED: %s wrote no output\n", command);
+		return 1;
+	}
+	char line[MAX_LINE], result[32];
+	int seen = 0, wrong = 0, id, value;
+	while (fgets(line, sizeof(line), out) != NULL) {
+		if (sscanf(line, "%d %31s", &id, result) != 2 || id < 1 || id > num_requests)
+			continue;
+		if (sscanf(line, "%*d %*s %d", &value) == 1)
+			sprintf(result + strlen(result), " %d", value);
+		seen++;
+		if (strcmp(result, requests[id - 1].expected) != 0) {
+			if (wrong++ == 0)
+				printf("  %s: request %d \"%s\" gave %s, expected %s\n", options,
+				       id, requests[id - 1].line, result, requests[id - 1].expected);
+		}
+	}
+	fclose(out);
+	remove(output_path);
+	if (seen != num_requests) {
+		printf("  %s: %d of %d results\n", options, seen, num_requests);
+		wrong += num_requests - seen;
+	}
+	printf("  %-32s %s\n", options, wrong ? "FAILED" : "ok");
+	return wrong;
+}
+
+void print_usage()
+{
+	fprintf(stderr, "Usage: ./exectest [options]\n");
+	fprintf(stderr, "  --server=CMD  server command, before the mode options (default %s)\n", server);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"server", required_argument, NULL, 's'},
+		{"help",   no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 's': server = optarg; break;
+		default: print_usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+
+	generate();
+	run_model();
+	printf("exectest: %d requests over %d accounts, one worker\n", num_requests, NUM_ACCOUNTS);
+
+	const char *modes[] = {
+		"--exec=lock",
+		"--exec=batch",
+		"--exec=occ",
+		"--exec=ordered",
+		"--exec=partition",
+		"--queue=steal",
+	};
+	int failures = 0;
+	for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++)
+		failures += run_mode(modes[m], 1) != 0;
+
+	if (failures == 0)
+		printf("  OK: every mode matched the serial results\n");
+	free(requests);
+	return failures == 0 ? 0 : 1;
+}
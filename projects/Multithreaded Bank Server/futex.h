@@ -0,0 +1,41 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+/*
+ *  Thin wrappers around the Linux futex system call.
+ *  Callers are expected to pair these with __atomic operations on the
+ *  same 32-bit word; see ringqueue.c for the wait/wake protocol.
+ */
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+/*
+ *  Sleep while *addr still equals expected.
+ *  Returns immediately (EAGAIN) if the value already changed.
+ */
+static inline void futex_wait(uint32_t *addr, uint32_t expected)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, NULL, NULL, 0);
+}
+
+/*
+ *  futex_wait(), giving up after timeout (relative).
+ */
+static inline void futex_wait_timeout(uint32_t *addr, uint32_t expected, const struct timespec *timeout)
+{
+	syscall(SYS_futex, addr, FUTEX_WAIT_PRIVATE, expected, timeout, NULL, 0);
+}
+
+/*
+ *  Wake up to count threads sleeping on addr.
+ */
+static inline void futex_wake(uint32_t *addr, int count)
+{
+	syscall(SYS_futex, addr, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#include "histogram.h"
+
+/*
+ *  Values below HIST_SUB_BUCKETS get a bucket each. Above that, a value with
+ *  its highest bit at position e lands in group (e - HIST_SUB_BITS + 1), at
+ *  the sub-bucket given by the HIST_SUB_BITS bits below the highest one.
+ */
+static int bucket_of(uint64_t v)
+{
+	if (v < HIST_SUB_BUCKETS) return (int)v;
+	int e = 63 - __builtin_clzll(v);
+	int sub = (int)((v >> (e - HIST_SUB_BITS)) & (HIST_SUB_BUCKETS - 1));
+	return (e - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS + sub;
+}
+
+/* largest value that falls into bucket b */
+static uint64_t bucket_limit(int b)
+{
+	if (b < HIST_SUB_BUCKETS) return (uint64_t)b;
+	int e = b / HIST_SUB_BUCKETS + HIST_SUB_BITS - 1;
+	uint64_t sub = b % HIST_SUB_BUCKETS;
+	uint64_t base = (1ULL << e) | (sub << (e - HIST_SUB_BITS));
+	return base + (1ULL << (e - HIST_SUB_BITS)) - 1;
+}
+
+void hist_record(struct histogram *h, uint64_t value)
+{
+	h->counts[bucket_of(value)]++;
+	h->total++;
+	h->sum += (double)value;
+	if (value > h->max) h->max = value;
+}
+
+void hist_merge(struct histogram *dst, const struct histogram *src)
+{
+	for (int b = 0; b < HIST_BUCKETS; b++)
+		dst->counts[b] += src->counts[b];
+	dst->total += src->total;
+	dst->sum += src->sum;
+	if (src->max > dst->max) dst->max = src->max;
+}
+
+uint64_t hist_percentile(const struct histogram *h, double p)
+{
+	if (h->total == 0) return 0;
+	uint64_t rank = (uint64_t)(p * (h->total - 1)) + 1;
+	uint64_t seen = 0;
+	for (int b = 0; b < HIST_BUCKETS; b++) {
+		seen += h->counts[b];
+		if (seen >= rank) {
+			uint64_t limit = bucket_limit(b);
+			return limit < h->max ? limit : h->max;
+		}
+	}
+	return h->max;
+}
+
+double hist_mean(const struct histogram *h)
+{
+	return h->total ? h->sum / h->total : 0.0;
+}
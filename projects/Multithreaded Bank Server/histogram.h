@@ -0,0 +1,46 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+/*
+ *  Log-linear latency histogram. Every power of two is split into
+ *  HIST_SUB_BUCKETS linear buckets, so a percentile is reported within
+ *  12.5% of the true value, for any value from 1 ns to hundreds of years,
+ *  in a fixed 4 KiB. Not thread safe: give each thread its own histogram
+ *  and merge them, or record under a lock.
+ */
+
+#include <stdint.h>
+
+#define HIST_SUB_BITS 3
+#define HIST_SUB_BUCKETS (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS ((64 - HIST_SUB_BITS + 1) * HIST_SUB_BUCKETS)
+
+struct histogram {
+	uint64_t counts[HIST_BUCKETS];
+	uint64_t total;
+	uint64_t max;
+	double sum;
+};
+
+/*
+ *  Count one value (e.g. nanoseconds).
+ */
+void hist_record(struct histogram *h, uint64_t value);
+
+/*
+ *  Add every value counted in src to dst.
+ */
+void hist_merge(struct histogram *dst, const struct histogram *src);
+
+/*
+ *  Value below which a fraction p (0..1) of the counted values fall.
+ *  Return:  the upper bound of that bucket, or 0 if nothing was counted
+ */
+uint64_t hist_percentile(const struct histogram *h, double p);
+
+/*
+ *  Average of the counted values, or 0.
+ */
+double hist_mean(const struct histogram *h);
+
+#endif
@@ -0,0 +1,127 @@
+#define _GNU_SOURCE	// clock_gettime
+#include "lockprof.h"
+#include <stdlib.h>
+#include <time.h>
+
+static uint64_t now_ns()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+uint64_t lockprof_lock(pthread_mutex_t *mutex, struct lock_profile *prof)
+{
+	if (pthread_mutex_trylock(mutex) == 0) {
+		prof->acquisitions++;
+		return 0;
+	}
+
+	uint64_t start = now_ns();
+	pthread_mutex_lock(mutex);
+	uint64_t waited = now_ns() - start;
+	prof->acquisitions++;
+	prof->contended++;
+	prof->wait_ns += waited;
+	if (waited > prof->max_wait_ns) prof->max_wait_ns = waited;
+	return waited > 0 ? waited : 1;
+}
+
+/* one lock of the top-N table */
+struct lock_ref {
+	const struct lockprof_group *group;
+	int index;
+};
+
+static int by_wait(const void *a, const void *b)
+{
+	const struct lock_ref *x = a, *y = b;
+	uint64_t wx = x->group->profiles[x->index].wait_ns;
+	uint64_t wy = y->group->profiles[y->index].wait_ns;
+	return (wx < wy) - (wx > wy);
+}
+
+static void print_label(FILE *out, const struct lockprof_group *group, int index)
+{
+	char label[64];
+	if (group->first_id < 0)
+		snprintf(label, sizeof(label), "%s", group->name);
+	else
+		snprintf(label, sizeof(label), "%s %d", group->name, group->first_id + index);
+	fprintf(out, "  %-20s", label);
+}
+
+static void print_row(FILE *out, long acquisitions, long contended, uint64_t wait_ns, uint64_t max_wait_ns)
+{
+	fprintf(out, " %12ld %10ld %6.1f%% %12.3f %10.3f\n", acquisitions, contended,
+		acquisitions ? 100.0 * contended / acquisitions : 0.0,
+		wait_ns / 1e6, max_wait_ns / 1e6);
+}
+
+void lockprof_report(FILE *out, const struct lockprof_group *groups, int num_groups, int top)
+{
+	int total = 0;
+	for (int g = 0; g < num_groups; g++)
+		total += groups[g].count;
+
+	struct lock_ref *refs = malloc(total * sizeof(struct lock_ref));
+	int num_refs = 0;
+
+	fprintf(out, "Lock profile:\n  %-20s %12s %10s %7s %12s %10s\n", "lock",
+		"acquisitions", "contended", "", "wait ms", "max ms");
+	for (int g = 0; g < num_groups; g++) {
+		const struct lockprof_group *group = &groups[g];
+		long acquisitions = 0, contended = 0;
+		uint64_t wait_ns = 0, max_wait_ns = 0;
+		for (int i = 0; i < group->count; i++) {
+			const struct lock_profile *p = &group->profiles[i];
+			acquisitions += p->acquisitions;
+			contended += p->contended;
+			wait_ns += p->wait_ns;
+			if (p->max_wait_ns > max_wait_ns) max_wait_ns = p->max_wait_ns;
+			if (p->contended > 0 && refs != NULL)
+				refs[num_refs++] = (struct lock_ref){group, i};
+		}
+		char label[64];
+		snprintf(label, sizeof(label), group->first_id < 0 ? "%s" : "%s (all %d)",
+			 group->name, group->count);
+		fprintf(out, "  %-20s", label);
+		print_row(out, acquisitions, contended, wait_ns, max_wait_ns);
+	}
+
+	if (refs == NULL || num_refs == 0) {
+		free(refs);
+		return;
+	}
+	qsort(refs, num_refs, sizeof(struct lock_ref), by_wait);
+	if (num_refs > top) num_refs = top;
+	fprintf(out, " Top %d by wait:\n", num_refs);
+	for (int r = 0; r < num_refs; r++) {
+		const struct lock_profile *p = &refs[r].group->profiles[refs[r].index];
+		print_label(out, refs[r].group, refs[r].index);
+		print_row(out, p->acquisitions, p->contended, p->wait_ns, p->max_wait_ns);
+	}
+	free(refs);
+}
+
+int lockprof_write_csv(const char *path, const struct lockprof_group *groups, int num_groups)
+{
+	FILE *csv = fopen(path, "w");
+	if (csv == NULL) return 0;
+
+	fprintf(csv, "lock,id,acquisitions,contended,wait_ns,max_wait_ns\n");
+	for (int g = 0; g < num_groups; g++) {
+		const struct lockprof_group *group = &groups[g];
+		for (int i = 0; i < group->count; i++) {
+			const struct lock_profile *p = &group->profiles[i];
+			if (p->acquisitions == 0) continue;
+			if (group->first_id < 0)
+				fprintf(csv, "%s,", group->name);
+			else
+				fprintf(csv, "%s,%d", group->name, group->first_id + i);
+			fprintf(csv, ",%ld,%ld,%llu,%llu\n", p->acquisitions, p->contended,
+				(unsigned long long)p->wait_ns, (unsigned long long)p->max_wait_ns);
+		}
+	}
+	return fclose(csv) == 0;
+}
@@ -0,0 +1,55 @@
+#ifndef LOCKPROF_H
+#define LOCKPROF_H
+
+/*
+ *  Lock contention profiler. lockprof_lock() stands in for
+ *  pthread_mutex_lock(): it tries the lock first and only times the blocking
+ *  lock if that fails, so an uncontended acquisition costs one trylock and no
+ *  clock read. Each lock has its own counters, updated while holding that
+ *  lock, so they need no atomics. Waits inside pthread_cond_wait() are not
+ *  seen.
+ */
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+struct lock_profile {
+	long acquisitions;
+	long contended;		/* acquisitions that found the lock held */
+	uint64_t wait_ns;	/* total time spent blocked */
+	uint64_t max_wait_ns;
+};
+
+/*
+ *  Lock mutex and count the acquisition in prof, which mutex must guard.
+ *  Return:  nanoseconds spent blocked (at least 1) if the lock was held by
+ *           another thread, 0 if it was free
+ */
+uint64_t lockprof_lock(pthread_mutex_t *mutex, struct lock_profile *prof);
+
+/*
+ *  A set of locks reported together, e.g. every account lock. Entry i is
+ *  labelled "<name> <first_id + i>", or just "<name>" if first_id is -1.
+ */
+struct lockprof_group {
+	const char *name;
+	const struct lock_profile *profiles;
+	int count;
+	int first_id;
+};
+
+/*
+ *  Print the totals of each group, then the top locks by total wait time.
+ */
+void lockprof_report(FILE *out, const struct lockprof_group *groups, int num_groups, int top);
+
+/*
+ *  Write one CSV row per lock acquired at least once:
+ *  lock,id,acquisitions,contended,wait_ns,max_wait_ns (id is empty for a
+ *  single lock).
+ *  Return:  1 if succeeded, 0 if error
+ */
+int lockprof_write_csv(const char *path, const struct lockprof_group *groups, int num_groups);
+
+#endif
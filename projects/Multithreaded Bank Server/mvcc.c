@@ -0,0 +1,233 @@
+#define _GNU_SOURCE     // posix_memalign
+#include "mvcc.h"
+#include <stdlib.h>
+#include <sched.h>
+
+#define CACHE_LINE 64
+#define VERSION_SLAB 256
+#define READER_IDLE UINT64_MAX
+#define SPIN_TRIES 64
+
+struct version {
+	struct version *prev;	/* next older version; free list link when unused */
+	uint64_t ts;
+	int value;
+};
+
+struct version_slab {
+	struct version_slab *next;
+	struct version versions[VERSION_SLAB];
+};
+
+/*
+ *  Per-thread state, one cache line apart. read_ts is written only by its
+ *  thread and scanned by every commit.
+ */
+struct mvcc_thread {
+	uint64_t read_ts;		/* READER_IDLE when not reading */
+	struct version *free;
+	struct version_slab *slabs;
+	long heap_versions, installed, reclaimed;
+	int max_chain;
+} __attribute__((aligned(CACHE_LINE)));
+
+struct mvcc {
+	struct version **heads;		/* newest version of account i + 1 */
+	struct version *initial;	/* version 0 of every account */
+	struct mvcc_thread *threads;
+	int accounts, num_threads;
+
+	uint64_t clock __attribute__((aligned(CACHE_LINE)));	/* last timestamp handed out */
+	uint64_t visible __attribute__((aligned(CACHE_LINE)));	/* every commit up to here is complete */
+};
+
+struct mvcc *mvcc_create(int accounts, int threads, int (*initial)(int id))
+{
+	struct mvcc *m;
+	if (posix_memalign((void **)&m, CACHE_LINE, sizeof(struct mvcc)) != 0) return NULL;
+	m->heads = (struct version **)malloc(accounts * sizeof(struct version *));
+	m->initial = (struct version *)malloc(accounts * sizeof(struct version));
+	if (posix_memalign((void **)&m->threads, CACHE_LINE, threads * sizeof(struct mvcc_thread)) != 0)
+		m->threads = NULL;
+	if (m->heads == NULL || m->initial == NULL || m->threads == NULL) {
+		free(m->heads);
+		free(m->initial);
+		free(m->threads);
+		free(m);
+		return NULL;
+	}
+
+	for (int i = 0; i < accounts; i++) {
+		m->initial[i].prev = NULL;
+		m->initial[i].ts = 0;
+		m->initial[i].value = initial(i + 1);
+		m->heads[i] = &m->initial[i];
+	}
+	for (int t = 0; t < threads; t++) {
+		struct mvcc_thread *self = &m->threads[t];
+		self->read_ts = READER_IDLE;
+		self->free = NULL;
+		self->slabs = NULL;
+		self->heap_versions = self->installed = self->reclaimed = 0;
+		self->max_chain = 1;
+	}
+	m->accounts = accounts;
+	m->num_threads = threads;
+	m->clock = m->visible = 0;
+	return m;
+}
+
+void mvcc_destroy(struct mvcc *m)
+{
+	if (m == NULL) return;
+	for (int t = 0; t < m->num_threads; t++) {
+		struct version_slab *slab = m->threads[t].slabs;
+		while (slab != NULL) {
+			struct version_slab *next = slab->next;
+			free(slab);
+			slab = next;
+		}
+	}
+	free(m->heads);
+	free(m->initial);
+	free(m->threads);
+	free(m);
+}
+
+/*
+ *  Announce the read timestamp before using it. A commit that scanned the
+ *  slots before the announcement also read visible before it, so the value
+ *  read after the announcement is never older than what that commit kept.
+ */
+uint64_t mvcc_begin(struct mvcc *m, int thread)
+{
+	uint64_t announced = __atomic_load_n(&m->visible, __ATOMIC_SEQ_CST);
+	__atomic_store_n(&m->threads[thread].read_ts, announced, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&m->visible, __ATOMIC_SEQ_CST);
+}
+
+int mvcc_get(struct mvcc *m, uint64_t read_ts, int id)
+{
+	struct version *v = __atomic_load_n(&m->heads[id - 1], __ATOMIC_ACQUIRE);
+	while (v->ts > read_ts)
+		v = __atomic_load_n(&v->prev, __ATOMIC_ACQUIRE);
+	return v->value;
+}
+
+void mvcc_end(struct mvcc *m, int thread)
+{
+	__atomic_store_n(&m->threads[thread].read_ts, READER_IDLE, __ATOMIC_RELEASE);
+}
+
+int mvcc_read(struct mvcc *m, int thread, int id)
+{
+	uint64_t read_ts = mvcc_begin(m, thread);
+	int value = mvcc_get(m, read_ts, id);
+	mvcc_end(m, thread);
+	return value;
+}
+
+static struct version *version_alloc(struct mvcc_thread *self)
+{
+	if (self->free == NULL) {
+		struct version_slab *slab = (struct version_slab *)malloc(sizeof(struct version_slab));
+		if (slab == NULL) return NULL;
+		slab->next = self->slabs;
+		self->slabs = slab;
+		for (int i = 0; i < VERSION_SLAB; i++) {
+			slab->versions[i].prev = self->free;
+			self->free = &slab->versions[i];
+		}
+		self->heap_versions += VERSION_SLAB;
+	}
+	struct version *v = self->free;
+	self->free = v->prev;
+	return v;
+}
+
+/* Oldest timestamp any current or future reader may still ask for */
+static uint64_t oldest_reader(struct mvcc *m)
+{
+	uint64_t oldest = __atomic_load_n(&m->visible, __ATOMIC_SEQ_CST);
+	for (int t = 0; t < m->num_threads; t++) {
+		uint64_t ts = __atomic_load_n(&m->threads[t].read_ts, __ATOMIC_SEQ_CST);
+		if (ts < oldest) oldest = ts;
+	}
+	return oldest;
+}
+
+/*
+ *  Keep the newest version at or below oldest (some reader may still need
+ *  it) and everything newer; recycle the rest. Readers never walk past the
+ *  kept version, so the recycled ones can be reused at once.
+ */
+static void prune(struct mvcc *m, struct mvcc_thread *self, int id, uint64_t oldest)
+{
+	struct version *keep = m->heads[id - 1];
+	int length = 1;
+	while (keep->prev != NULL && keep->ts > oldest) {
+		keep = keep->prev;
+		length++;
+	}
+	struct version *old = keep->prev;
+	__atomic_store_n(&keep->prev, NULL, __ATOMIC_RELEASE);
+	while (old != NULL) {
+		struct version *next = old->prev;
+		old->prev = self->free;
+		self->free = old;
+		self->reclaimed++;
+		length++;
+		old = next;
+	}
+	if (length > self->max_chain) self->max_chain = length;
+}
+
+uint64_t mvcc_commit(struct mvcc *m, int thread, const int *ids, const int *values, int n)
+{
+	struct mvcc_thread *self = &m->threads[thread];
+	struct version *fresh[n];
+
+	for (int i = 0; i < n; i++) {
+		fresh[i] = version_alloc(self);
+		if (fresh[i] == NULL) {
+			while (i-- > 0) {
+				fresh[i]->prev = self->free;
+				self->free = fresh[i];
+			}
+			return 0;
+		}
+	}
+
+	uint64_t ts = __atomic_add_fetch(&m->clock, 1, __ATOMIC_SEQ_CST);
+	for (int i = 0; i < n; i++) {
+		fresh[i]->ts = ts;
+		fresh[i]->value = values[i];
+		fresh[i]->prev = m->heads[ids[i] - 1];
+		__atomic_store_n(&m->heads[ids[i] - 1], fresh[i], __ATOMIC_RELEASE);
+	}
+	self->installed += n;
+
+	/* Publish in timestamp order: a reader at ts must find every commit up to it */
+	for (int spins = 0; __atomic_load_n(&m->visible, __ATOMIC_ACQUIRE) != ts - 1; spins++) {
+		if (spins >= SPIN_TRIES) sched_yield();
+	}
+	__atomic_store_n(&m->visible, ts, __ATOMIC_SEQ_CST);
+
+	uint64_t oldest = oldest_reader(m);
+	for (int i = 0; i < n; i++)
+		prune(m, self, ids[i], oldest);
+	return ts;
+}
+
+void mvcc_get_stats(struct mvcc *m, struct mvcc_stats *stats)
+{
+	stats->heap_versions = stats->installed = stats->reclaimed = 0;
+	stats->max_chain = 1;
+	for (int t = 0; t < m->num_threads; t++) {
+		struct mvcc_thread *self = &m->threads[t];
+		stats->heap_versions += self->heap_versions;
+		stats->installed += self->installed;
+		stats->reclaimed += self->reclaimed;
+		if (self->max_chain > stats->max_chain) stats->max_chain = self->max_chain;
+	}
+}
@@ -0,0 +1,73 @@
+#ifndef MVCC_H
+#define MVCC_H
+
+/*
+ *  Multi-version account balances. Each account keeps a short chain of
+ *  versions, newest first, stamped with the commit timestamp of the TRANS
+ *  that wrote them. A commit installs all versions of one TRANS under a
+ *  single timestamp and only then makes that timestamp visible, so a
+ *  reader sees either every write of a TRANS or none of them.
+ *
+ *  Readers take no lock: they pick a read timestamp and walk the chain to
+ *  the newest version at or below it. The read timestamps of active readers
+ *  double as reclamation epochs: a version older than what the oldest active
+ *  reader can still ask for is unlinked by the next commit on that account
+ *  and recycled through the committing thread's free list.
+ *
+ *  Threads are numbered 0..threads-1; each number may be used by one thread
+ *  at a time. Writers must own the accounts they commit (their own locks),
+ *  so commits on one account are serialized by the caller.
+ */
+
+#include <stdint.h>
+
+struct mvcc;
+
+/*
+ *  Create the store with version 0 of every account.
+ *  Input:  int accounts - IDs 1..accounts
+ *  Input:  int threads - number of reader/writer slots
+ *  Input:  int (*initial)(int id) - starting balance of account id
+ *  Return:  the store, or NULL if out of memory
+ */
+struct mvcc *mvcc_create(int accounts, int threads, int (*initial)(int id));
+
+/*
+ *  Free the store. No thread may still be using it.
+ */
+void mvcc_destroy(struct mvcc *m);
+
+/*
+ *  Start a consistent read for thread. Every mvcc_get() with the returned
+ *  timestamp sees the same committed state, until mvcc_end().
+ */
+uint64_t mvcc_begin(struct mvcc *m, int thread);
+int mvcc_get(struct mvcc *m, uint64_t read_ts, int id);
+void mvcc_end(struct mvcc *m, int thread);
+
+/*
+ *  Latest committed balance of one account (begin, get, end).
+ */
+int mvcc_read(struct mvcc *m, int thread, int id);
+
+/*
+ *  Commit new balances for ids[0..n) atomically. An ID listed twice keeps
+ *  its last value. The caller owns every account involved.
+ *  Return:  the commit timestamp, or 0 if out of memory (nothing committed)
+ */
+uint64_t mvcc_commit(struct mvcc *m, int thread, const int *ids, const int *values, int n);
+
+/*
+ *  Counters since mvcc_create(): versions allocated from the heap (slabs
+ *  included), versions installed by commits, versions reclaimed, and the
+ *  longest chain a commit found.
+ */
+struct mvcc_stats {
+	long heap_versions;
+	long installed;
+	long reclaimed;
+	int max_chain;
+};
+void mvcc_get_stats(struct mvcc *m, struct mvcc_stats *stats);
+
+#endif
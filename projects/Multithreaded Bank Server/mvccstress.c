@@ -0,0 +1,212 @@
+/**
+ * MVCC stress test.
+ *
+ * Writer threads move money between random accounts through mvcc.c, locking
+ * their accounts in ID order as appserver does. Reader threads take
+ * lock-free consistent reads of every account and check that the balances
+ * add up to the money deposited: a reader that saw part of a transfer would
+ * find the sum off. Exits 1 on any violation, so it can gate a build.
+ *
+ *   $ ./mvccstress --writers=4 --readers=4 --accounts=64 --seconds=5
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <getopt.h>
+#include "mvcc.h"
+
+#define INITIAL_BALANCE 1000
+#define MAX_PARTS 4	/* accounts per transfer */
+
+/* test parameters */
+int num_writers = 4;
+int num_readers = 4;
+int num_accounts = 64;
+int num_seconds = 2;
+
+struct mvcc *store;
+pthread_mutex_t *locks;
+int *balances;		/* writers' view, guarded by locks[] */
+long expected_sum;
+int stop;
+
+struct thread_stats {
+	pthread_t thread;
+	int slot;
+	long operations;
+	long violations;
+	long first_bad_sum;
+};
+
+int initial_balance(int id)
+{
+	(void)id;
+	return INITIAL_BALANCE;
+}
+
+int int_compare(const void *a, const void *b)
+{
+	return *(const int *)a - *(const int *)b;
+}
+
+/* Move random amounts from up to MAX_PARTS - 1 accounts into one more */
+void *writer_routine(void *arg)
+{
+	struct thread_stats *stats = (struct thread_stats *)arg;
+	unsigned seed = 1234 + stats->slot;
+	int ids[MAX_PARTS], values[MAX_PARTS];
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		int parts = 2 + rand_r(&seed) % (MAX_PARTS - 1);
+		for (int i = 0; i < parts; i++) {
+			int j;
+			do {
+				ids[i] = 1 + rand_r(&seed) % num_accounts;
+				for (j = 0; j < i && ids[j] != ids[i]; j++);
+			} while (j < i);
+		}
+		qsort(ids, parts, sizeof(int), int_compare);
+		for (int i = 0; i < parts; i++)
+			pthread_mutex_lock(&locks[ids[i] - 1]);
+
+		int sink = rand_r(&seed) % parts, moved = 0;
+		for (int i = 0; i < parts; i++) {
+			int amount = i == sink ? 0 : rand_r(&seed) % (balances[ids[i] - 1] + 1);
+			balances[ids[i] - 1] -= amount;
+			moved += amount;
+		}
+		balances[ids[sink] - 1] += moved;
+		for (int i = 0; i < parts; i++)
+			values[i] = balances[ids[i] - 1];
+		if (mvcc_commit(store, stats->slot, ids, values, parts) == 0) {
+			fprintf(stderr, "mvccstress: out of memory\n");
+			exit(1);
+		}
+
+		for (int i = parts - 1; i >= 0; i--)
+			pthread_mutex_unlock(&locks[ids[i] - 1]);
+		stats->operations++;
+	}
+	return NULL;
+}
+
+/* Sum every account at one read timestamp */
+void *reader_routine(void *arg)
+{
+	struct thread_stats *stats = (struct thread_stats *)arg;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		uint64_t read_ts = mvcc_begin(store, stats->slot);
+		long sum = 0;
+		for (int id = 1; id <= num_accounts; id++)
+			sum += mvcc_get(store, read_ts, id);
+		mvcc_end(store, stats->slot);
+
+		if (sum != expected_sum) {
+			if (stats->violations++ == 0) stats->first_bad_sum = sum;
+		}
+		stats->operations++;
+	}
+	return NULL;
+}
+
+void print_usage()
+{
+	fprintf(stderr, "Usage: ./mvccstress [options]\n");
+	fprintf(stderr, "  --writers=N   transfer threads (default %d)\n", num_writers);
+	fprintf(stderr, "  --readers=N   consistent-read threads (default %d)\n", num_readers);
+	fprintf(stderr, "  --accounts=N  accounts (default %d)\n", num_accounts);
+	fprintf(stderr, "  --seconds=N   run time (default %d)\n", num_seconds);
+}
+
+int main(int argc, char **argv)
+{
+	static struct option long_options[] = {
+		{"writers",  required_argument, NULL, 'w'},
+		{"readers",  required_argument, NULL, 'r'},
+		{"accounts", required_argument, NULL, 'a'},
+		{"seconds",  required_argument, NULL, 's'},
+		{"help",     no_argument,       NULL, 'h'},
+		{NULL, 0, NULL, 0}
+	};
+	int opt;
+
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'w': num_writers = atoi(optarg); break;
+		case 'r': num_readers = atoi(optarg); break;
+		case 'a': num_accounts = atoi(optarg); break;
+		case 's': num_seconds = atoi(optarg); break;
+		default: print_usage(); return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (num_writers < 1 || num_readers < 1 || num_accounts < MAX_PARTS || num_seconds < 1) {
+		print_usage();
+		return 1;
+	}
+
+	int num_threads = num_writers + num_readers;
+	store = mvcc_create(num_accounts, num_threads, initial_balance);
+	locks = (pthread_mutex_t *)malloc(num_accounts * sizeof(pthread_mutex_t));
+	balances = (int *)malloc(num_accounts * sizeof(int));
+	struct thread_stats *threads = (struct thread_stats *)calloc(num_threads, sizeof(struct thread_stats));
+	if (store == NULL || locks == NULL || balances == NULL || threads == NULL) {
+		fprintf(stderr, "mvccstress: out of memory\n");
+		return 1;
+	}
+	for (int i = 0; i < num_accounts; i++) {
+		pthread_mutex_init(&locks[i], NULL);
+		balances[i] = INITIAL_BALANCE;
+	}
+	expected_sum = (long)num_accounts * INITIAL_BALANCE;
+
+	for (int t = 0; t < num_threads; t++) {
+		threads[t].slot = t;
+		pthread_create(&threads[t].thread, NULL, t < num_writers ? writer_routine : reader_routine, &threads[t]);
+	}
+	sleep(num_seconds);
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+	long commits = 0, reads = 0, violations = 0, bad_sum = 0;
+	for (int t = 0; t < num_threads; t++) {
+		pthread_join(threads[t].thread, NULL);
+		if (t < num_writers) {
+			commits += threads[t].operations;
+		} else {
+			reads += threads[t].operations;
+			if (threads[t].violations > 0 && violations == 0) bad_sum = threads[t].first_bad_sum;
+			violations += threads[t].violations;
+		}
+	}
+
+	/* the newest versions must match the writers' balances exactly */
+	long mismatched = 0;
+	for (int id = 1; id <= num_accounts; id++) {
+		if (mvcc_read(store, 0, id) != balances[id - 1]) mismatched++;
+	}
+
+	struct mvcc_stats stats;
+	mvcc_get_stats(store, &stats);
+	printf("mvccstress: %d writers, %d readers, %d accounts, %d s\n",
+	       num_writers, num_readers, num_accounts, num_seconds);
+	printf("  %ld transfers committed, %ld consistent reads of all accounts\n", commits, reads);
+	printf("  versions: %ld installed, %ld reclaimed, %ld allocated, longest chain %d\n",
+	       stats.installed, stats.reclaimed, stats.heap_versions, stats.max_chain);
+	if (violations > 0)
+		printf("  FAILED: %ld reads saw a partial transfer (e.g. sum %ld, expected %ld)\n",
+		       violations, bad_sum, expected_sum);
+	if (mismatched > 0)
+		printf("  FAILED: %ld accounts end with a stale newest version\n", mismatched);
+	if (violations == 0 && mismatched == 0)
+		printf("  OK: every read summed to %ld\n", expected_sum);
+
+	mvcc_destroy(store);
+	free(locks);
+	free(balances);
+	free(threads);
+	return violations == 0 && mismatched == 0 ? 0 : 1;
+}
@@ -0,0 +1,321 @@
+#include "protocol.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+static int is_separator(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+char *proto_next_token(char **cursor, int *len)
+{
+	char *p = *cursor;
+	while (is_separator(*p)) p++;
+	if (*p == '\0') return NULL;
+
+	char *start = p;
+	while (*p != '\0' && !is_separator(*p)) p++;
+	*len = p - start;
+	*cursor = p;
+	return start;
+}
+
+int proto_token_int(const char *token, int len)
+{
+	int i = 0, negative = 0, value = 0;
+	if (i < len && (token[i] == '-' || token[i] == '+')) negative = token[i++] == '-';
+	for (; i < len && token[i] >= '0' && token[i] <= '9'; i++)
+		value = value * 10 + (token[i] - '0');
+	return negative ? -value : value;
+}
+
+int proto_parse_text(char *line, struct proto_frame *frame)
+{
+	char *cursor = line, *token;
+	int len, count = 1;
+
+	token = proto_next_token(&cursor, &len);
+	if (token == NULL) return 0;
+	frame->priority = -1;
+	frame->deadline_ms = 0;
+
+	if (len == 5 && memcmp(token, "CHECK", 5) == 0) frame->type = 'C';
+	else if (len == 5 && memcmp(token, "TRANS", 5) == 0) frame->type = 'T';
+	else if (len == 8 && memcmp(token, "SNAPSHOT", 8) == 0) frame->type = 'S';
+	else if (len == 5 && memcmp(token, "STATS", 5) == 0) frame->type = 'Q';
+	else if (len == 3 && memcmp(token, "END", 3) == 0) frame->type = 'E';
+	else return -1;
+
+	int options = 0;	/* PRIO / DEADLINE seen; no values may follow */
+	while (count < PROTO_MAX_TOKENS && (token = proto_next_token(&cursor, &len)) != NULL) {
+		int is_prio = len == 4 && memcmp(token, "PRIO", 4) == 0;
+		int is_deadline = len == 8 && memcmp(token, "DEADLINE", 8) == 0;
+		if ((is_prio || is_deadline) && (frame->type == 'C' || frame->type == 'T')) {
+			token = proto_next_token(&cursor, &len);
+			if (token == NULL) return -1;
+			int value = proto_token_int(token, len);
+			if (is_prio) {
+				if (value < 0 || value >= PROTO_PRIORITIES) return -1;
+				frame->priority = value;
+			} else {
+				if (value < 1) return -1;
+				frame->deadline_ms = value;
+			}
+			options = 1;
+			continue;
+		}
+		if (options) return -1;
+		if (frame->type == 'C' || frame->type == 'T')
+			frame->values[count - 1] = proto_token_int(token, len);
+		count++;
+	}
+
+	if (frame->type == 'C') {
+		if (count != 2) return -1;
+		frame->count = 1;
+	} else if (frame->type == 'T') {
+		if (count < 3 || count % 2 != 1) return -1;
+		frame->count = (count - 1) / 2;
+	} else if (frame->type == 'S' || frame->type == 'Q') {
+		if (count != 1) return -1;
+		frame->count = 0;
+	} else {
+		frame->count = 0;	/* END ignores anything after it, as before */
+	}
+	return 1;
+}
+
+/* number of int32 values carried by a frame */
+static int frame_values(char type, int count)
+{
+	return type == 'T' ? 2 * count : count;
+}
+
+static void put_int32(unsigned char *out, int32_t value)
+{
+	uint32_t v = (uint32_t)value;
+	out[0] = v & 0xff;
+	out[1] = (v >> 8) & 0xff;
+	out[2] = (v >> 16) & 0xff;
+	out[3] = v >> 24;
+}
+
+static int32_t get_int32(const unsigned char *v)
+{
+	return (int32_t)((uint32_t)v[0] | ((uint32_t)v[1] << 8) |
+			 ((uint32_t)v[2] << 16) | ((uint32_t)v[3] << 24));
+}
+
+int proto_encode(const struct proto_frame *frame, unsigned char *out)
+{
+	int values = frame_values(frame->type, frame->count);
+	int count = frame->count;
+
+	for (int i = 0; i < values; i++)
+		put_int32(out + 4 + 4 * i, frame->values[i]);
+	if (frame->priority >= 0) {
+		put_int32(out + 4 + 4 * values++, frame->priority);
+		count |= PROTO_HAS_PRIO;
+	}
+	if (frame->deadline_ms > 0) {
+		put_int32(out + 4 + 4 * values++, frame->deadline_ms);
+		count |= PROTO_HAS_DEADLINE;
+	}
+
+	int length = 2 + 4 * values;
+	out[0] = length & 0xff;
+	out[1] = length >> 8;
+	out[2] = (unsigned char)frame->type;
+	out[3] = (unsigned char)count;
+	return 2 + length;
+}
+
+void proto_print_text(FILE *out, const struct proto_frame *frame)
+{
+	if (frame->type == 'C') {
+		fprintf(out, "CHECK %d", frame->values[0]);
+	} else if (frame->type == 'T') {
+		fprintf(out, "TRANS");
+		for (int i = 0; i < frame->count; i++)
+			fprintf(out, " %d %d", frame->values[2 * i], frame->values[2 * i + 1]);
+	} else if (frame->type == 'S') {
+		fprintf(out, "SNAPSHOT");
+	} else if (frame->type == 'Q') {
+		fprintf(out, "STATS");
+	} else {
+		fprintf(out, "END");
+	}
+	if (frame->priority >= 0)
+		fprintf(out, " PRIO %d", frame->priority);
+	if (frame->deadline_ms > 0)
+		fprintf(out, " DEADLINE %d", frame->deadline_ms);
+}
+
+struct proto_reader {
+	proto_read_fn read_fn;
+	void *ctx;
+	int fd;			/* ctx of proto_reader_open() readers */
+	unsigned char *buf;
+	size_t block;		/* bytes requested per read */
+	size_t start, end;	/* unconsumed bytes are buf[start..end) */
+	int eof;
+	long reads;
+	char line[PROTO_MAX_LINE];	/* an over-long line, split like fgets() */
+};
+
+static ssize_t fd_read(void *ctx, void *buf, size_t len)
+{
+	return read(*(int *)ctx, buf, len);
+}
+
+/* Read once more. Return 0 if the stream has ended. */
+static int fill_more(struct proto_reader *r)
+{
+	if (r->eof) return 0;
+	if (r->start > 0) {
+		memmove(r->buf, r->buf + r->start, r->end - r->start);
+		r->end -= r->start;
+		r->start = 0;
+	}
+	for (;;) {
+		ssize_t n = r->read_fn(r->ctx, r->buf + r->end, r->block + PROTO_MAX_FRAME - r->end);
+		r->reads++;
+		if (n < 0 && errno == EINTR) continue;
+		if (n <= 0) { r->eof = 1; return 0; }
+		r->end += n;
+		return 1;
+	}
+}
+
+/* Make sure at least want bytes are buffered. Return 0 if the stream ends first. */
+static int fill(struct proto_reader *r, size_t want)
+{
+	while (r->end - r->start < want)
+		if (!fill_more(r)) return 0;
+	return 1;
+}
+
+struct proto_reader *proto_reader_new(proto_read_fn read_fn, void *ctx, size_t block)
+{
+	struct proto_reader *r = (struct proto_reader *)malloc(sizeof(struct proto_reader));
+	if (r == NULL) return NULL;
+	r->buf = (unsigned char *)malloc(block + PROTO_MAX_FRAME);
+	if (r->buf == NULL) { free(r); return NULL; }
+	r->read_fn = read_fn;
+	r->ctx = ctx;
+	r->block = block;
+	r->start = r->end = 0;
+	r->eof = 0;
+	r->reads = 0;
+	return r;
+}
+
+int proto_read_magic(struct proto_reader *r)
+{
+	if (!fill(r, PROTO_MAGIC_LEN) || memcmp(r->buf + r->start, PROTO_MAGIC, PROTO_MAGIC_LEN) != 0)
+		return 0;
+	r->start += PROTO_MAGIC_LEN;
+	return 1;
+}
+
+struct proto_reader *proto_reader_open(int fd, size_t block)
+{
+	struct proto_reader *r = proto_reader_new(fd_read, NULL, block);
+	if (r == NULL) return NULL;
+	r->fd = fd;
+	r->ctx = &r->fd;
+	return r;
+}
+
+int proto_read_line(struct proto_reader *r, char **line)
+{
+	size_t scanned = 0;
+	unsigned char *eol;
+
+	for (;;) {
+		unsigned char *start = r->buf + r->start;
+		size_t avail = r->end - r->start;
+		eol = (unsigned char *)memchr(start + scanned, '\n', avail - scanned);
+		if (eol != NULL && eol - start < PROTO_MAX_LINE - 1) break;
+		if (avail >= PROTO_MAX_LINE - 1 || (avail > 0 && r->eof)) {
+			/* no newline in time: hand out what fgets() would */
+			size_t len = avail < PROTO_MAX_LINE - 1 ? avail : PROTO_MAX_LINE - 1;
+			memcpy(r->line, start, len);
+			r->line[len] = '\0';
+			r->start += len;
+			*line = r->line;
+			return 1;
+		}
+		scanned = avail;
+		if (!fill_more(r) && r->end == r->start) return 0;
+	}
+
+	*eol = '\0';
+	*line = (char *)(r->buf + r->start);
+	r->start = eol + 1 - r->buf;
+	return 1;
+}
+
+long proto_reader_reads(struct proto_reader *r)
+{
+	return r->reads;
+}
+
+int proto_decode(const unsigned char *buf, size_t avail, struct proto_frame *frame)
+{
+	if (avail < 2) return 0;
+	int length = buf[0] | (buf[1] << 8);
+	if (length < 2 || length > PROTO_MAX_FRAME - 2) return -1;
+	if (avail < (size_t)(2 + length)) return 0;
+
+	frame->type = (char)buf[2];
+	int flags = buf[3] & (PROTO_HAS_PRIO | PROTO_HAS_DEADLINE);
+	frame->count = buf[3] & ~flags;
+	int values = frame_values(frame->type, frame->count);
+	int extra = !!(flags & PROTO_HAS_PRIO) + !!(flags & PROTO_HAS_DEADLINE);
+	if ((frame->type == 'C' && frame->count != 1) ||
+	    (frame->type == 'T' && (frame->count < 1 || frame->count > PROTO_MAX_PAIRS)) ||
+	    ((frame->type == 'E' || frame->type == 'S' || frame->type == 'Q') && buf[3] != 0) ||
+	    (frame->type != 'C' && frame->type != 'T' && frame->type != 'S' && frame->type != 'Q' &&
+	     frame->type != 'E') ||
+	    length != 2 + 4 * (values + extra))
+		return -1;
+
+	for (int i = 0; i < values; i++)
+		frame->values[i] = get_int32(buf + 4 + 4 * i);
+	frame->priority = -1;
+	frame->deadline_ms = 0;
+	if (flags & PROTO_HAS_PRIO) {
+		frame->priority = get_int32(buf + 4 + 4 * values++);
+		if (frame->priority < 0 || frame->priority >= PROTO_PRIORITIES) return -1;
+	}
+	if (flags & PROTO_HAS_DEADLINE) {
+		frame->deadline_ms = get_int32(buf + 4 + 4 * values);
+		if (frame->deadline_ms < 1) return -1;
+	}
+	return 2 + length;
+}
+
+int proto_read_frame(struct proto_reader *r, struct proto_frame *frame)
+{
+	int used;
+	size_t want = 2;
+
+	/* fill() grows the buffered span until a whole frame is there */
+	while ((used = proto_decode(r->buf + r->start, r->end - r->start, frame)) == 0) {
+		if (!fill(r, want)) return r->end == r->start ? 0 : -1;
+		want = r->end - r->start + 1;
+	}
+	if (used < 0) return -1;
+	r->start += used;
+	return 1;
+}
+
+void proto_reader_close(struct proto_reader *r)
+{
+	if (r == NULL) return;
+	free(r->buf);
+	free(r);
+}
@@ -0,0 +1,131 @@
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+/*
+ *  Request encodings understood by the bank server.
+ *
+ *  Text:    one request per line, "CHECK <id>", "TRANS <id> <amount> ...",
+ *           "SNAPSHOT", "STATS" or "END", tokens separated by blanks. A
+ *           CHECK or TRANS may end with "PRIO <class>" (0 high, 1 normal,
+ *           2 low) and/or "DEADLINE <ms>".
+ *
+ *  Binary:  the 8 byte magic "BANKBIN1", then one frame per request:
+ *             uint16  length   bytes after this field (2 + 4 * values)
+ *             uint8   type     'C', 'T', 'S', 'Q' (STATS) or 'E'
+ *             uint8   count    CHECK: 1, TRANS: account/amount pairs, others: 0;
+ *                              plus PROTO_HAS_PRIO / PROTO_HAS_DEADLINE
+ *             int32   values[] CHECK: account; TRANS: account, amount, ...;
+ *                              then the class and the deadline, if flagged
+ *           All integers are little-endian.
+ */
+
+#include <stdio.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#define PROTO_MAGIC "BANKBIN1"
+#define PROTO_MAGIC_LEN 8
+#define PROTO_MAX_TOKENS 50					/* text tokens read per line */
+#define PROTO_MAX_PAIRS ((PROTO_MAX_TOKENS - 1) / 2)		/* account/amount pairs per TRANS */
+#define PROTO_MAX_OPTIONS 2					/* PRIO and DEADLINE values after the pairs */
+#define PROTO_MAX_FRAME (4 + 8 * PROTO_MAX_PAIRS + 4 * PROTO_MAX_OPTIONS)
+#define PROTO_MAX_LINE 1024					/* longer text lines are split, as fgets() does */
+#define PROTO_PRIORITIES 3					/* PRIO classes 0 .. 2 */
+#define PROTO_HAS_PRIO 0x40					/* binary count flags */
+#define PROTO_HAS_DEADLINE 0x80
+
+struct proto_frame {
+	char type;		/* 'C', 'T', 'S', 'Q' or 'E' */
+	int count;		/* see above, without the flags */
+	int priority;		/* PRIO class, or -1 if not given */
+	int deadline_ms;	/* DEADLINE, or 0 if not given */
+	int32_t values[PROTO_MAX_TOKENS - 1];
+};
+
+/*
+ *  Return the next blank-separated token of *cursor and advance past it.
+ *  Output:  int *len - length of the token (it is not NUL terminated)
+ *  Return:  start of the token, or NULL at end of line
+ */
+char *proto_next_token(char **cursor, int *len);
+
+/*
+ *  atoi() of a token returned by proto_next_token().
+ */
+int proto_token_int(const char *token, int len);
+
+/*
+ *  Parse one text line in place (no copy). Tokens past PROTO_MAX_TOKENS
+ *  are ignored; PRIO and DEADLINE take two of them.
+ *  Return:  1 if frame was filled, 0 for a blank line, -1 if malformed
+ */
+int proto_parse_text(char *line, struct proto_frame *frame);
+
+/*
+ *  Encode a frame into out, which must hold PROTO_MAX_FRAME bytes.
+ *  Return:  number of bytes written
+ */
+int proto_encode(const struct proto_frame *frame, unsigned char *out);
+
+/*
+ *  Decode one frame from memory (no magic).
+ *  Return:  bytes consumed, 0 if buf does not hold a whole frame yet, or -1
+ *           if the frame is corrupt (bad length, type or count)
+ */
+int proto_decode(const unsigned char *buf, size_t avail, struct proto_frame *frame);
+
+/*
+ *  Write a frame as a text line (without the trailing newline).
+ */
+void proto_print_text(FILE *out, const struct proto_frame *frame);
+
+/*
+ *  Reads lines or frames in large blocks, from a file descriptor or from any
+ *  read()-like function.
+ */
+struct proto_reader;
+typedef ssize_t (*proto_read_fn)(void *ctx, void *buf, size_t len);
+
+/*
+ *  Start reading with read_fn(ctx, ...). Nothing is read yet.
+ *  Input:  size_t block - bytes asked for per call; at least PROTO_MAX_LINE
+ *  Return:  the reader, or NULL if out of memory
+ */
+struct proto_reader *proto_reader_new(proto_read_fn read_fn, void *ctx, size_t block);
+
+/*
+ *  Consume the binary stream magic.
+ *  Return:  1 if it was there, 0 otherwise
+ */
+int proto_read_magic(struct proto_reader *reader);
+
+/*
+ *  proto_reader_new() on read(fd).
+ */
+struct proto_reader *proto_reader_open(int fd, size_t block);
+
+/*
+ *  Next text line, newline removed. It stays valid until the next call.
+ *  Return:  1 if *line was set, 0 at end of stream
+ */
+int proto_read_line(struct proto_reader *reader, char **line);
+
+/*
+ *  Number of read_fn calls made so far.
+ */
+long proto_reader_reads(struct proto_reader *reader);
+
+/*
+ *  Decode the next frame.
+ *  Return:  1 if frame was filled, 0 at end of stream, -1 if the stream is
+ *           corrupt (bad length, type or count); reading cannot continue
+ */
+int proto_read_frame(struct proto_reader *reader, struct proto_frame *frame);
+
+/*
+ *  Free the reader. The file descriptor is not closed.
+ */
+void proto_reader_close(struct proto_reader *reader);
+
+#endif
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE     // syscall, posix_memalign
+#include "ringqueue.h"
+#include "futex.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <sched.h>
+
+#define CACHE_LINE 64
+#define SPIN_TRIES 64
+
+/*
+ *  Each slot carries a sequence number (Vyukov's bounded MPMC scheme):
+ *    seq == pos       slot is free for the producer claiming position pos
+ *    seq == pos + 1   slot holds the item for the consumer claiming pos
+ */
+struct ring_cell {
+	uint64_t seq;
+	void *data;
+};
+
+/*
+ *  Positions and futex words live on separate cache lines so producers
+ *  and consumers do not false-share.
+ */
+struct ring_queue {
+	struct ring_cell *cells;
+	uint64_t mask;
+
+	uint64_t enqueue_pos __attribute__((aligned(CACHE_LINE)));
+	uint64_t dequeue_pos __attribute__((aligned(CACHE_LINE)));
+
+	/* bumped on every push; consumers park on it when the ring is empty */
+	uint32_t push_events __attribute__((aligned(CACHE_LINE)));
+	uint32_t pop_waiters;
+
+	/* bumped on every pop; producers park on it when the ring is full */
+	uint32_t pop_events __attribute__((aligned(CACHE_LINE)));
+	uint32_t push_waiters;
+
+	int closed;
+};
+
+struct ring_queue *ring_create(unsigned capacity)
+{
+	unsigned size = 2;
+	while (size < capacity) size <<= 1;
+
+	struct ring_queue *q;
+	if (posix_memalign((void **)&q, CACHE_LINE, sizeof(*q)) != 0) return NULL;
+
+	q->cells = (struct ring_cell *)malloc(size * sizeof(struct ring_cell));
+	if (q->cells == NULL) { free(q); return NULL; }
+
+	for (unsigned i = 0; i < size; i++) {
+		q->cells[i].seq = i;
+		q->cells[i].data = NULL;
+	}
+	q->mask = size - 1;
+	q->enqueue_pos = q->dequeue_pos = 0;
+	q->push_events = q->pop_events = 0;
+	q->pop_waiters = q->push_waiters = 0;
+	q->closed = 0;
+	return q;
+}
+
+void ring_destroy(struct ring_queue *q)
+{
+	if (q == NULL) return;
+	free(q->cells);
+	free(q);
+}
+
+int ring_try_push(struct ring_queue *q, void *item)
+{
+	struct ring_cell *cell;
+	uint64_t pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int64_t dif = (int64_t)seq - (int64_t)pos;
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->enqueue_pos, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return 0;
+		} else {
+			pos = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	cell->data = item;
+	__atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+	// Dekker-style handshake with ring_pop(): the event bump must be ordered
+	// before we look at the waiter count, and vice versa on the consumer side.
+	__atomic_add_fetch(&q->push_events, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->pop_waiters, __ATOMIC_SEQ_CST) > 0)
+		futex_wake(&q->push_events, 1);
+	return 1;
+}
+
+void *ring_try_pop(struct ring_queue *q)
+{
+	struct ring_cell *cell;
+	uint64_t pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+
+	for (;;) {
+		cell = &q->cells[pos & q->mask];
+		uint64_t seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+		int64_t dif = (int64_t)seq - (int64_t)(pos + 1);
+
+		if (dif == 0) {
+			if (__atomic_compare_exchange_n(&q->dequeue_pos, &pos, pos + 1, 1,
+			                                __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		} else if (dif < 0) {
+			return NULL;
+		} else {
+			pos = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+		}
+	}
+
+	void *item = cell->data;
+	__atomic_store_n(&cell->seq, pos + q->mask + 1, __ATOMIC_RELEASE);
+
+	__atomic_add_fetch(&q->pop_events, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&q->push_waiters, __ATOMIC_SEQ_CST) > 0)
+		futex_wake(&q->pop_events, 1);
+	return item;
+}
+
+void ring_push(struct ring_queue *q, void *item)
+{
+	int spins = 0;
+	while (!ring_try_push(q, item)) {
+		if (spins++ < SPIN_TRIES) { sched_yield(); continue; }
+
+		uint32_t seen = __atomic_load_n(&q->pop_events, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+		if (ring_try_push(q, item)) {
+			__atomic_sub_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+			return;
+		}
+		futex_wait(&q->pop_events, seen);
+		__atomic_sub_fetch(&q->push_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void *ring_pop(struct ring_queue *q)
+{
+	int spins = 0;
+	void *item;
+
+	while ((item = ring_try_pop(q)) == NULL) {
+		if (__atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) {
+			// Closed: one last look in case a push raced with ring_close()
+			return ring_try_pop(q);
+		}
+		if (spins++ < SPIN_TRIES) { sched_yield(); continue; }
+
+		uint32_t seen = __atomic_load_n(&q->push_events, __ATOMIC_SEQ_CST);
+		__atomic_add_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+		if ((item = ring_try_pop(q)) != NULL ||
+		    __atomic_load_n(&q->closed, __ATOMIC_ACQUIRE)) {
+			__atomic_sub_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+			if (item != NULL) return item;
+			continue;
+		}
+		futex_wait(&q->push_events, seen);
+		__atomic_sub_fetch(&q->pop_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+	return item;
+}
+
+void ring_close(struct ring_queue *q)
+{
+	__atomic_store_n(&q->closed, 1, __ATOMIC_RELEASE);
+	__atomic_add_fetch(&q->push_events, 1, __ATOMIC_SEQ_CST);
+	futex_wake(&q->push_events, INT32_MAX);
+}
+
+unsigned ring_size(struct ring_queue *q)
+{
+	uint64_t head = __atomic_load_n(&q->dequeue_pos, __ATOMIC_RELAXED);
+	uint64_t tail = __atomic_load_n(&q->enqueue_pos, __ATOMIC_RELAXED);
+	return tail > head ? (unsigned)(tail - head) : 0;
+}
@@ -0,0 +1,60 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+
+/*
+ *  Bounded lock-free multi-producer/multi-consumer queue of pointers.
+ *  Producers and consumers never take a mutex; a thread that finds the
+ *  ring empty (or full) parks on a futex until the other side makes
+ *  progress.
+ */
+
+struct ring_queue;
+
+/*
+ *  Create a ring holding at least capacity items.
+ *  Input:  unsigned capacity - rounded up to the next power of two
+ *  Return:  the new ring, or NULL if out of memory
+ */
+struct ring_queue *ring_create(unsigned capacity);
+
+/*
+ *  Free a ring. No thread may still be using it.
+ */
+void ring_destroy(struct ring_queue *q);
+
+/*
+ *  Append an item, blocking while the ring is full.
+ *  Input:  void *item - must not be NULL
+ */
+void ring_push(struct ring_queue *q, void *item);
+
+/*
+ *  Append an item without blocking.
+ *  Return:  1 if the item was added, 0 if the ring is full
+ */
+int ring_try_push(struct ring_queue *q, void *item);
+
+/*
+ *  Remove the oldest item, blocking while the ring is empty.
+ *  Return:  the item, or NULL once the ring is closed and drained
+ */
+void *ring_pop(struct ring_queue *q);
+
+/*
+ *  Remove the oldest item without blocking.
+ *  Return:  the item, or NULL if the ring is empty
+ */
+void *ring_try_pop(struct ring_queue *q);
+
+/*
+ *  Mark the ring closed and wake every parked consumer. Items already
+ *  in the ring are still handed out by ring_pop().
+ */
+void ring_close(struct ring_queue *q);
+
+/*
+ *  Approximate number of queued items (exact when no push/pop is in flight).
+ */
+unsigned ring_size(struct ring_queue *q);
+
+#endif
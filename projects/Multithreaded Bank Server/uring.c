@@ -0,0 +1,165 @@
+#define _GNU_SOURCE     // syscall
+#include "uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+struct uring {
+	int fd;
+	void *sq_map, *cq_map;
+	size_t sq_map_size, cq_map_size;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	/* submission queue, shared with the kernel */
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned sq_pending;	/* queued since the last uring_submit() */
+
+	/* completion queue, shared with the kernel */
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	long enters;
+};
+
+struct uring *uring_create(unsigned entries, struct iovec *buffers, unsigned nbuffers)
+{
+	struct io_uring_params p;
+	struct uring *u = (struct uring *)calloc(1, sizeof(struct uring));
+	if (u == NULL) return NULL;
+
+	memset(&p, 0, sizeof(p));
+	u->fd = syscall(__NR_io_uring_setup, entries, &p);
+	if (u->fd < 0) {
+		free(u);
+		return NULL;
+	}
+
+	u->sq_map_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	u->cq_map_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		if (u->cq_map_size > u->sq_map_size) u->sq_map_size = u->cq_map_size;
+		u->cq_map_size = u->sq_map_size;
+	}
+	u->sq_map = mmap(NULL, u->sq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			 u->fd, IORING_OFF_SQ_RING);
+	if (u->sq_map == MAP_FAILED) goto fail;
+	if (p.features & IORING_FEAT_SINGLE_MMAP) {
+		u->cq_map = u->sq_map;
+	} else {
+		u->cq_map = mmap(NULL, u->cq_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+				 u->fd, IORING_OFF_CQ_RING);
+		if (u->cq_map == MAP_FAILED) goto fail;
+	}
+	u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	u->sqes = (struct io_uring_sqe *)mmap(NULL, u->sqes_size, PROT_READ | PROT_WRITE,
+					      MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+	if (u->sqes == MAP_FAILED) goto fail;
+
+	char *sq = (char *)u->sq_map, *cq = (char *)u->cq_map;
+	u->sq_head = (unsigned *)(sq + p.sq_off.head);
+	u->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+	u->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+	u->sq_array = (unsigned *)(sq + p.sq_off.array);
+	u->cq_head = (unsigned *)(cq + p.cq_off.head);
+	u->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+	u->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+	u->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+
+	if (nbuffers > 0 &&
+	    syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_BUFFERS, buffers, nbuffers) < 0)
+		goto fail;
+	return u;
+
+fail:
+	{
+		int saved = errno;
+		uring_destroy(u);
+		errno = saved;
+	}
+	return NULL;
+}
+
+void uring_destroy(struct uring *u)
+{
+	if (u == NULL) return;
+	if (u->sqes != NULL && u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_size);
+	if (u->cq_map != NULL && u->cq_map != MAP_FAILED && u->cq_map != u->sq_map)
+		munmap(u->cq_map, u->cq_map_size);
+	if (u->sq_map != NULL && u->sq_map != MAP_FAILED) munmap(u->sq_map, u->sq_map_size);
+	close(u->fd);
+	free(u);
+}
+
+static int queue_rw(struct uring *u, int opcode, int fd, unsigned buf_index, const void *addr,
+		    unsigned len, int64_t offset, uint64_t user_data)
+{
+	unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+	unsigned tail = *u->sq_tail;
+	if (tail - head > *u->sq_mask) return -1;
+
+	unsigned index = tail & *u->sq_mask;
+	struct io_uring_sqe *sqe = &u->sqes[index];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode = opcode;
+	sqe->fd = fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = len;
+	sqe->off = (uint64_t)offset;
+	sqe->buf_index = buf_index;
+	sqe->user_data = user_data;
+	u->sq_array[index] = index;
+
+	/* the kernel may read the entry as soon as it sees the new tail */
+	__atomic_store_n(u->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	u->sq_pending++;
+	return 0;
+}
+
+int uring_queue_read(struct uring *u, int fd, unsigned buf_index, void *addr, unsigned len,
+		     int64_t offset, uint64_t user_data)
+{
+	return queue_rw(u, IORING_OP_READ_FIXED, fd, buf_index, addr, len, offset, user_data);
+}
+
+int uring_queue_write(struct uring *u, int fd, unsigned buf_index, const void *addr, unsigned len,
+		      int64_t offset, uint64_t user_data)
+{
+	return queue_rw(u, IORING_OP_WRITE_FIXED, fd, buf_index, addr, len, offset, user_data);
+}
+
+int uring_submit(struct uring *u, unsigned wait_nr)
+{
+	unsigned flags = wait_nr > 0 ? IORING_ENTER_GETEVENTS : 0;
+	for (;;) {
+		u->enters++;
+		int ret = syscall(__NR_io_uring_enter, u->fd, u->sq_pending, wait_nr, flags, NULL, 0);
+		if (ret >= 0) {
+			u->sq_pending -= ret;
+			if (u->sq_pending == 0) return 0;
+			continue;	/* the kernel took only part of the queue */
+		}
+		if (errno != EINTR) return -1;
+	}
+}
+
+int uring_complete(struct uring *u, uint64_t *user_data, int *res)
+{
+	unsigned head = *u->cq_head;
+	if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE)) return 0;
+
+	struct io_uring_cqe *cqe = &u->cqes[head & *u->cq_mask];
+	*user_data = cqe->user_data;
+	*res = cqe->res;
+	__atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+	return 1;
+}
+
+long uring_enters(struct uring *u)
+{
+	return u->enters;
+}
@@ -0,0 +1,62 @@
+#ifndef URING_H
+#define URING_H
+
+/*
+ *  Minimal io_uring wrapper on the raw system calls (no liburing).
+ *  One submission queue and one completion queue shared with the kernel;
+ *  reads and writes use buffers registered once at setup, so the kernel
+ *  does not map them again for every request. A ring is meant to be used by
+ *  a single thread.
+ */
+
+#include <stdint.h>
+#include <sys/uio.h>
+
+struct uring;
+
+/*
+ *  Set up a ring and register buffers[0..nbuffers).
+ *  Input:  unsigned entries - submission queue size
+ *  Return:  the ring, or NULL with errno set (e.g. ENOSYS or EPERM when
+ *           io_uring is unavailable)
+ */
+struct uring *uring_create(unsigned entries, struct iovec *buffers, unsigned nbuffers);
+
+/*
+ *  Unmap and close the ring. Requests still in flight are cancelled, so
+ *  their buffers must not be freed before this returns.
+ */
+void uring_destroy(struct uring *u);
+
+/*
+ *  Queue a read into (or write from) registered buffer buf_index. addr and
+ *  len must lie inside that buffer. offset is the file position, or -1 for
+ *  the current position (pipes, terminals). Nothing reaches the kernel
+ *  before uring_submit().
+ *  Return:  0, or -1 if the submission queue is full
+ */
+int uring_queue_read(struct uring *u, int fd, unsigned buf_index, void *addr, unsigned len,
+		     int64_t offset, uint64_t user_data);
+int uring_queue_write(struct uring *u, int fd, unsigned buf_index, const void *addr, unsigned len,
+		      int64_t offset, uint64_t user_data);
+
+/*
+ *  Hand every queued request to the kernel and wait until at least wait_nr
+ *  completions are available, in one io_uring_enter() call.
+ *  Return:  0, or -1 with errno set
+ */
+int uring_submit(struct uring *u, unsigned wait_nr);
+
+/*
+ *  Take one completion, if any, without a system call.
+ *  Output:  user_data of the request; res - bytes transferred or -errno
+ *  Return:  1 if a completion was taken, 0 if none is available
+ */
+int uring_complete(struct uring *u, uint64_t *user_data, int *res);
+
+/*
+ *  Number of io_uring_enter() calls made so far.
+ */
+long uring_enters(struct uring *u);
+
+#endif